@@ -1,9 +1,19 @@
+#define _GNU_SOURCE
+#include <stdio.h>
 #include <string.h>
-#include <unistd.h>
-#include <stdbool.h>
+#include <strings.h>
+#include <stdlib.h>
 #include <ctype.h>
+#include <errno.h>
 
 #include "main.h"
+#include "session.h"
+#include "atdisp.h"
+#include "profile.h"
+#include "pdu.h"
+#include "sms.h"
+#include "urc.h"
+#include "cmux.h"
 #include "at.h"
 
 #define QUECTEL_5G
@@ -27,471 +37,1577 @@
 
 #endif
 
-enum cpms_t
+#define USSD_RESP "+CUSD: 2,\"42616c616e733a20302e343920736f276d2e\",-12"
+
+#define AT_OK	1	/* handler wants the final OK appended */
+#define AT_NONE	0	/* handler wrote (or scheduled) its own final result */
+#define AT_ERROR -1	/* handler wrote an error result, the command line ends */
+
+/* more commands of the line follow the one being run, its OK is left out */
+#define at_more(s) ((s)->cl_pos < (s)->cl_len)
+
+/*
+ * A complete reply that depends on nothing but the session state: all its
+ * lines terminated and followed by the final result, put together from
+ * string literals by the compiler. It is queued by reference, so replying
+ * costs one iovec no matter how many lines there are.
+ */
+struct at_blob {
+	const char *p;
+	unsigned len;
+};
+
+#define AT_LINE(lit) lit "\n\r"
+#define AT_BLOB(lines) { lines AT_LINE("OK"), sizeof(lines AT_LINE("OK")) - 1 }
+#define AT_OK_LEN (sizeof(AT_LINE("OK")) - 1)
+#define at_reply(s, b) tty_write_ref((s), (b)->p, (b)->len - (at_more(s) ? AT_OK_LEN : 0))
+
+struct at_cmd;
+typedef int (*at_handler_t)(struct session *s, const char *line, size_t len, const struct at_cmd *cmd);
+
+struct at_cmd {
+	at_handler_t fn;
+	struct at_blob rsp;	/* reply of AT_RSP commands */
+	unsigned plen;		/* pattern length, arguments of prefix commands follow */
+};
+
+/* argument (of length n) equals the string literal lit */
+#define ARG_IS(arg, n, lit) ((n) == sizeof(lit) - 1 && !memcmp((arg), lit, (n)))
+
+/*
+ * Response fragments emitted after a delay. A sequence ends with a NULL
+ * line; the session accepts no new commands until it has been played.
+ */
+struct at_step {
+	unsigned delay_ms;
+	const char *line;	/* terminated */
+	unsigned len;
+};
+
+static const struct at_step cops_auto_steps[] = {
+	{ 1, TTY_STR("+XACTIVATE: 2") },
+	{ 2000, TTY_STR("OK") },
+	{ 0, NULL, 0 }
+};
+
+static const struct at_step cops_scan_steps[] = {
+	{ 1000, TTY_STR("+COPS: "
+		"(1, \"GustaFon GUS\", \"GustaFon\", \"25202\", 2),"
+		"(1, \"Tele2 EU\", \"Tele2\", \"25220\", 2),"
+		"(1, \"GustaFon GUS\", \"GustaFon\", \"25202\", 7),"
+		"(1, \"Beeline\", \"Beeline\", \"25299\", 7),"
+		"(1, \"Tele2 EU\", \"Tele2)(\", \"25220\", 7),"
+		"(1, \"YOTA:)\", \"YOTA\", \"25211\", 7),"
+		"(1, \"MTS GUS\", \"MTS GUS\", \"25201\", 7),"
+		",(0,1,2,3,4),(0,1,2)") },
+	{ 0, TTY_STR("OK") },
+	{ 0, NULL, 0 }
+};
+
+static const struct at_step cusd_steps[] = {
+	{ 1000, TTY_STR("OK") },
+	{ 0, NULL, 0 }
+};
+
+static const struct at_step qscan_4g_steps[] = {
+	{ 1000, TTY_STR("+QSCAN: 3-26"
+		"-197963829,394,100,-8818,-1256,250,20,2,27864,3,1,1,275"
+		"-3979275,235,1802,-10056,-1381,250,1,2,17758,5,3,3,250"
+		"-26549576,0,2850,-9006,-912,250,2,2,9738,5,3,7,1375"
+		"-26549576,0,2850,-9006,-912,250,11,2,9738,5,1,7,1375"
+		"-26549676,0,3048,-9893,-1062,250,2,2,9738,5,3,7,1925"
+		"-26549676,0,3048,-9893,-1062,250,11,2,9738,5,1,7,1925"
+		"-197963798,370,3400,-10568,-2000,250,20,2,27864,3,1,7,-1275"
+		"-3979265,298,3200,-10575,-1668,250,1,2,17758,3,3,7,-1125"
+		"-130237446,212,3300,-11012,-1293,250,99,2,1277,3,2,7,-75"
+		"-199022880,334,38752,-10125,-1437,250,20,2,27864,5,1,40,450"
+		"-199022883,229,39550,-9812,-1225,250,20,2,27864,3,1,40,-1500"
+		"-26549536,200,1602,-9375,-1337,250,2,2,9738,5,3,3,1625"
+		"-26549536,200,1602,-9375,-1337,250,11,2,9738,5,1,3,1625"
+		"-3979276,374,1802,-10112,-1562,250,1,2,17758,5,3,3,-225"
+		"-197963799,120,3400,-9806,-1750,250,20,2,27864,3,1,7,-550"
+		"-130237445,132,3300,-10837,-1100,250,99,2,1277,3,2,7,250"
+		"-197963859,470,6200,-8687,-1206,250,20,2,27864,3,1,20,650"
+		"-130237448,306,1301,-10487,-1256,250,99,2,1277,5,2,3,375"
+		"-26549516,20,225,-9312,-718,250,2,2,9738,4,3,1,1875"
+		"-26549516,20,225,-9312,-718,250,11,2,9738,4,1,1,1875"
+		"-199022881,341,38752,-9593,-1225,250,20,2,27864,5,1,40,25"
+		"-26549636,200,1458,-9681,-1287,250,2,2,9738,3,3,3,1675"
+		"-26549636,200,1458,-9681,-1287,250,11,2,9738,3,1,3,1675"
+		"-1013792,327,375,-12212,-1743,250,1,2,17758,4,3,1,-600"
+		"-128005223,330,525,-12462,-1781,250,99,2,1277,4,2,1,-450"
+		"-26474793,406,37900,-12918,-1800,250,2,2,9758,5,3,38,-925"
+		"-26474793,406,37900,-12918,-1800,250,11,2,9758,5,1,38,-925"
+		"-1013832,434,38100,-12606,-1650,250,1,2,17758,5,3,38,-525"
+		"-199022884,278,39550,-10443,-1362,250,20,2,27864,3,1,40,250"
+		"-249532211,268,100,-10481,-1843,250,20,2,27864,3,1,1,-950"
+		"-3979266,296,3200,-11318,-1725,250,1,2,17758,3,3,7,-400"
+		"-197963828,393,100,-8862,-693,250,20,2,27864,3,1,1,150") },
+	{ 0, TTY_STR("+QSCAN: 254") },
+	{ 0, NULL, 0 }
+};
+
+static const struct at_step qscan_5g_steps[] = {
+	{ 1000, TTY_STR("+QSCAN: 4-7"
+		"-2573795420,498,641280,-9425,-1075,250,2,2,49914,1,80,78,531,"
+			"4,0,0,0,\"\",\"\""
+		"-22016524410,473,631296,-8325,-956,250,3,2,3279616,1,20,78,2387,"
+			"6,0,0,0,\"\",\"\""
+		"-22016524400,473,632640,-9600,-975,250,3,2,3279616,1,100,78,1543,"
+			"5,0,0,0,\"\",\"\""
+		"-2574532700,884,641280,-9837,-1181,250,2,2,49906,1,80,78,318,"
+			"0,0,0,0,\"\",\"\""
+		"-18064655858,679,644640,-9300,-1337,250,1,2,10684034,1,40,78,-37,"
+			"1,0,0,0,\"\",\"\""
+		"-18063574513,406,650976,-9681,-1125,250,1,2,10684034,1,100,78,418,"
+			"1,0,0,0,\"\",\"\""
+		"-18063574514,406,644640,-9175,-1037,250,1,2,10684034,1,40,78,731,"
+			"1,0,0,0,\"\",\"\"") },
+	{ 0, TTY_STR("+QSCAN: 254") },
+	{ 0, NULL, 0 }
+};
+
+static const struct at_step qscan_3g_steps[] = {
+	{ 1000, TTY_STR("+QSCAN: 1-4"
+		"-10387651,10563,475,17,-8,250,20,2,27864,1,1"
+		"-0,10563,28,14,-21,250,20,2,27864,1,1"
+		"-0,10563,359,13,-27,250,20,2,27864,1,1"
+		"-6646701,10687,423,16,-5,250,2,2,9746,1,1") },
+	{ 0, TTY_STR("+QSCAN: 254") },
+	{ 0, NULL, 0 }
+};
+
+static void at_cl_run(struct session *s);
+static int at_pdu_feed(struct splitter *sp, char *p, int n);
+
+#define at_is_ok(p, len) ((len) == AT_OK_LEN && !memcmp((p), AT_LINE("OK"), AT_OK_LEN))
+
+/* the final OK of a command, unless more commands of its line follow */
+static void at_ok(struct session *s)
+{
+	if (!at_more(s)) tty_write_str(s, "OK");
+}
+
+static void at_step_cb(struct ev_timer *t)
+{
+	struct session *s = container_of(t, struct session, timer);
+
+	while (s->step) {
+		/* static or in the profile the session holds; a closing OK waits for the line */
+		if (s->step[1].line || !at_more(s) || !at_is_ok(s->step->line, s->step->len))
+			tty_write_ref(s, s->step->line, s->step->len);
+		s->step++;
+		if (s->step->line == NULL) {
+			s->step = NULL;
+			at_cl_run(s);
+			if (!session_busy(s)) {
+				stats_reply(s);
+				urc_flush(s);
+			}
+			break;
+		} else if (s->step->delay_ms) {
+			ev_timer_start(s->loop, &s->timer, s->step->delay_ms);
+			break;
+		}
+	}
+
+	s->kick(s);
+}
+
+static void at_defer(struct session *s, const struct at_step *steps)
+{
+	s->step = steps;
+	ev_timer_start(s->loop, &s->timer, steps->delay_ms);
+}
+
+void at_session_init(struct session *s, struct ev_loop *loop)
+{
+	s->cpms = CPMS_SM;
+	s->net_mode = NET_MODE_AUTO;
+	s->echo = 0;
+	s->enqueueUssd = 0;
+	s->waitPdu = 0;
+	s->step = NULL;
+	s->prof = NULL;
+	s->sms[CPMS_SM] = s->sms[CPMS_ME] = NULL;
+	s->cmgl.st = NULL;
+	s->cmgl.done = 0;
+	s->pdu_len = 0;
+	s->pdu_n = 0;
+	s->pdu_bad = 0;
+	s->mr = 0;
+	s->dlci = 0;
+	s->cmux_n1 = 0;
+	s->split.len = 0;
+	s->split.raw = NULL;
+	s->cl_pos = s->cl_len = 0;
+	outq_init(&s->q, TTY_Q_HWM);
+	s->lat.rd = s->lat.wr = 0;
+	s->loop = loop;
+	ev_timer_init(&s->timer, at_step_cb);
+	urc_session_init(s);
+}
+
+static int at_echo_on(struct session *s, const char *line, size_t len, const struct at_cmd *cmd)
 {
-	CPMS_SM,
-	CPMS_ME
-} cpms = CPMS_SM;
+	s->echo = 1;
 
-enum network_mode_t
+	return AT_OK;
+}
+
+static int at_echo_off(struct session *s, const char *line, size_t len, const struct at_cmd *cmd)
 {
-	NET_MODE_AUTO,
-	NET_MODE_NR,
-	NET_MODE_LTE,
-	NET_MODE_UMTS
-} net_mode = NET_MODE_AUTO;
+	s->echo = 0;
 
-int echo = 0;
-int enqueueUssd = 0;
-int waitPdu = 0;
+	return AT_OK;
+}
 
-const char* USSD_RESP = "+CUSD: 2,\"42616c616e733a20302e343920736f276d2e\",-12";
+static const struct at_blob ati_blob = AT_BLOB(
+	AT_LINE("Manufacturer: " MANUFACTURER_)
+	AT_LINE("Model: " MODEL_)
+	AT_LINE("Revision: V1.0.009")
+	AT_LINE("IMEI: " IMEI_));
 
-static bool isPdu1a(const char *str)
+static int at_ati(struct session *s, const char *line, size_t len, const struct at_cmd *cmd)
 {
-	if (str == NULL || *str == 0) {
-		return false;
+	at_reply(s, &ati_blob);
+
+	return AT_NONE;
+}
+
+static const struct at_blob simcomati_blob = AT_BLOB(
+	AT_LINE("Manufacturer: " MANUFACTURER_)
+	AT_LINE("Model: " MODEL_)
+	AT_LINE("Revision: " FW_VERSION_)
+	AT_LINE("IMEI: " IMEI_));
+
+static int at_simcomati(struct session *s, const char *line, size_t len, const struct at_cmd *cmd)
+{
+	at_reply(s, &simcomati_blob);
+
+	return AT_NONE;
+}
+
+static const struct at_blob ati_csub_blob = AT_BLOB(
+	AT_LINE(MANUFACTURER_)
+	AT_LINE(MODEL_)
+	AT_LINE("Revision: " FW_VERSION_)
+	AT_LINE("SubEdition: " SUBEDITION_));
+
+static int at_ati_csub(struct session *s, const char *line, size_t len, const struct at_cmd *cmd)
+{
+	at_reply(s, &ati_csub_blob);
+
+	return AT_NONE;
+}
+
+static int at_cnum(struct session *s, const char *line, size_t len, const struct at_cmd *cmd)
+{
+	tty_write_str(s, "+CME ERROR: 4");
+	return AT_ERROR;
+}
+
+/* AUTO and NR reply with the LTE cell, as do the tables below */
+#define CPSI_LTE AT_BLOB( \
+	AT_LINE("+CPSI: LTE,Online,252-02,0x260A,196089506,299,EUTRAN-BAND7,2850,5,5,21,47,43,17"))
+
+static const struct at_blob cpsi_blobs[NET_MODE_MAX] = {
+	[NET_MODE_AUTO] = CPSI_LTE,
+	[NET_MODE_NR] = CPSI_LTE,
+	[NET_MODE_LTE] = CPSI_LTE,
+	[NET_MODE_UMTS] = AT_BLOB(
+		AT_LINE("+CPSI: WCDMA,Online,252-02,0x2612,-294967296,WCDMA IMT 2000,437,10687,0,-3,-83,-32768,-83,-15")),
+};
+
+static int at_cpsi_get(struct session *s, const char *line, size_t len, const struct at_cmd *cmd)
+{
+	at_reply(s, &cpsi_blobs[s->net_mode]);
+
+	return AT_NONE;
+}
+
+#define COPS_LTE AT_BLOB( \
+	AT_LINE("+COPS: 0,0,\"GustaFon\",9"))
+
+static const struct at_blob cops_blobs[NET_MODE_MAX] = {
+	[NET_MODE_AUTO] = COPS_LTE,
+	[NET_MODE_NR] = COPS_LTE,
+	[NET_MODE_LTE] = COPS_LTE,
+	[NET_MODE_UMTS] = AT_BLOB(
+		AT_LINE("+COPS: 0,0,\"GustaFon\",6")),
+};
+
+static int at_cops_get(struct session *s, const char *line, size_t len, const struct at_cmd *cmd)
+{
+	at_reply(s, &cops_blobs[s->net_mode]);
+
+	return AT_NONE;
+}
+
+#define ZCAINFO_LTE AT_BLOB( \
+	AT_LINE("+ZCAINFO: 299,7,17758,2850,10;341,1,3,1802,20"))
+
+static const struct at_blob zcainfo_blobs[NET_MODE_MAX] = {
+	[NET_MODE_AUTO] = ZCAINFO_LTE,
+	[NET_MODE_NR] = ZCAINFO_LTE,
+	[NET_MODE_LTE] = ZCAINFO_LTE,
+	[NET_MODE_UMTS] = AT_BLOB(),
+};
+
+static int at_zcainfo_get(struct session *s, const char *line, size_t len, const struct at_cmd *cmd)
+{
+	at_reply(s, &zcainfo_blobs[s->net_mode]);
+
+	return AT_NONE;
+}
+
+static int at_cops_auto(struct session *s, const char *line, size_t len, const struct at_cmd *cmd)
+{
+	tty_write_str(s, "+XACTIVATE: 1");
+	at_defer(s, cops_auto_steps);
+	return AT_NONE;
+}
+
+static int at_cops_scan(struct session *s, const char *line, size_t len, const struct at_cmd *cmd)
+{
+	at_defer(s, cops_scan_steps);
+	return AT_NONE;
+}
+
+static int at_cgpaddr(struct session *s, const char *line, size_t len, const struct at_cmd *cmd)
+{
+	if (s->enqueueUssd) {
+		s->enqueueUssd = 0;
+		tty_write_str(s, USSD_RESP);
 	}
+	tty_write_str(s, "+CGPADDR: 1, \"10.36.130.148\"");
 
-	while (*str) {
-		if (!isxdigit(*str)) {
+	return AT_OK;
+}
 
-			if (*str == 0x1a)
-			{
-				return true;
-			}
+#define CNETCI_LTE AT_BLOB( \
+	AT_LINE("+CNETCISRVINFO: MCC-MNC: 252-02,TAC: 9738,cellid: 196089506,rsrp: 47,rsrq: 21, pci: 299,earfcn: 2850") \
+	AT_LINE("+CNETCINONINFO: 0,MCC-MNC: 000-00,TAC: 0,cellid: -1,rsrp: 23,rsrq: 0,pci: 195,earfcn: 1602") \
+	AT_LINE("+CNETCINONINFO: 1,MCC-MNC: 000-00,TAC: 0,cellid: -1,rsrp: 31,rsrq: 17,pci: 92,earfcn: 1602") \
+	AT_LINE("+CNETCI: 0"))
+
+static const struct at_blob cnetci_blobs[NET_MODE_MAX] = {
+	[NET_MODE_AUTO] = CNETCI_LTE,
+	[NET_MODE_NR] = CNETCI_LTE,
+	[NET_MODE_LTE] = CNETCI_LTE,
+	[NET_MODE_UMTS] = AT_BLOB(
+		AT_LINE("+CNETCI: 0")),
+};
+
+static int at_cnetci_get(struct session *s, const char *line, size_t len, const struct at_cmd *cmd)
+{
+	at_reply(s, &cnetci_blobs[s->net_mode]);
+
+	return AT_NONE;
+}
+
+#define SIGNS_LTE AT_BLOB( \
+	AT_LINE("+RSRP0: -109") \
+	AT_LINE("+RSRP1: -112") \
+	AT_LINE("+RSRQ0: -11") \
+	AT_LINE("+RSRQ1: -11") \
+	AT_LINE("+RSSI0: -61") \
+	AT_LINE("+RSSI1: -64"))
+
+static const struct at_blob signs_blobs[NET_MODE_MAX] = {
+	[NET_MODE_AUTO] = SIGNS_LTE,
+	[NET_MODE_NR] = SIGNS_LTE,
+	[NET_MODE_LTE] = SIGNS_LTE,
+	[NET_MODE_UMTS] = AT_BLOB(),
+};
+
+static int at_signs(struct session *s, const char *line, size_t len, const struct at_cmd *cmd)
+{
+	at_reply(s, &signs_blobs[s->net_mode]);
+
+	return AT_NONE;
+}
+
+static const struct at_blob qnetdevctl_blob = AT_BLOB(
+	AT_LINE("+QNETDEVCTL: 1,2,1")
+	AT_LINE("+QNETDEVCTL: 2,2,0"));
+
+static int at_qnetdevctl_get(struct session *s, const char *line, size_t len, const struct at_cmd *cmd)
+{
+	at_reply(s, &qnetdevctl_blob);
+
+	return AT_NONE;
+}
+
+static const struct at_blob qnwinfo_blobs[NET_MODE_MAX] = {
+	[NET_MODE_AUTO] = AT_BLOB(
+		AT_LINE("+QNWINFO: \"FDD LTE\",26203,\"LTE BAND 1\",300")
+		AT_LINE("+QNWINFO: \"NR5G-NSA\",26203,\"NR N41\",529950")),
+	[NET_MODE_NR] = AT_BLOB(
+		AT_LINE("+QNWINFO: \"NR5G-SA\",26203,\"NR N41\",529950")),
+	[NET_MODE_LTE] = AT_BLOB(
+		AT_LINE("+QNWINFO: \"FDD LTE\",26202,\"LTE BAND 7\",2850")),
+	[NET_MODE_UMTS] = AT_BLOB(
+		AT_LINE("+QNWINFO: \"HSPA+\",25002,\"WCDMA 2100\",10687")),
+};
+
+static int at_qnwinfo(struct session *s, const char *line, size_t len, const struct at_cmd *cmd)
+{
+	at_reply(s, &qnwinfo_blobs[s->net_mode]);
+
+	return AT_NONE;
+}
+
+static const struct at_blob qeng_servingcell_blobs[NET_MODE_MAX] = {
+	[NET_MODE_AUTO] = AT_BLOB(
+		AT_LINE("+QENG: \"servingcell\",\"CONNECT\"")
+		AT_LINE("+QENG: \"LTE\",\"FDD\",262,03,1212126,118,300,1,5,5,B8FD,-108,-10,-78,4,10,23,19")
+		AT_LINE("+QENG: \"NR5G-NSA\",262,03,170,-93,3,-8,529950,41,0,157E,1")),
+	[NET_MODE_NR] = AT_BLOB(
+		AT_LINE("+QENG: \"servingcell\",\"CONNECT\",\"NR5G-SA\",\"TDD\",262,00,C22221001,808,1421AF,504990,41,100,-71,0,27,7,42,1")),
+	[NET_MODE_LTE] = AT_BLOB(
+		AT_LINE("+QENG: \"servingcell\",\"CONNECT\",\"LTE\",\"FDD\",262,02,1951D49,12,2850,7,5,5,260A,-92,-8,-68,20,13,0,31")),
+	[NET_MODE_UMTS] = AT_BLOB(
+		AT_LINE("+QENG: \"servingcell\",\"CONNECT\",\"WCDMA\",262,02,2612,656BAF,10687,166,-84,-8,1,6,0")),
+};
+
+static int at_qeng_servingcell(struct session *s, const char *line, size_t len, const struct at_cmd *cmd)
+{
+	at_reply(s, &qeng_servingcell_blobs[s->net_mode]);
+
+	return AT_NONE;
+}
+
+static const struct at_blob qeng_neighbourcell_blobs[NET_MODE_MAX] = {
+	[NET_MODE_AUTO] = AT_BLOB(
+		AT_LINE("+QENG: \"neighbourcell intra\",\"LTE\",6300,319,-102,-10,26,1,7,-,-,-,-")
+		AT_LINE("+QENG: \"neighbourcell inter\",\"LTE\",100,183,-131,-24,0,-13,255,-1,-1,16")),
+	[NET_MODE_NR] = AT_BLOB(
+		AT_LINE("+QENG: \"neighbourcell\",\"NR\",529950,170,-88,-6,7,32")),
+	[NET_MODE_LTE] = AT_BLOB(
+		AT_LINE("+QENG: \"neighbourcell intra\",\"LTE\",300,118,-11,-11,17,1,1,-,-,-,-")
+		AT_LINE("+QENG: \"neighbourcell inter\",\"LTE\",6200,297,-106,-16,0,2,255,-1,-1,16")
+		AT_LINE("+QENG: \"neighbourcell inter\",\"LTE\",1600,183,-110,-15,0,-2,255,-1,-1,16")),
+	[NET_MODE_UMTS] = AT_BLOB(),
+};
 
-			return false;
+static int at_qeng_neighbourcell(struct session *s, const char *line, size_t len, const struct at_cmd *cmd)
+{
+	at_reply(s, &qeng_neighbourcell_blobs[s->net_mode]);
+
+	return AT_NONE;
+}
+
+static const struct at_blob qtemp_blob = AT_BLOB(
+	AT_LINE("+QTEMP: \"soc-thermal\",\"36\"")
+	AT_LINE("+QTEMP: \"pa-thermal\",\"36\"")
+	AT_LINE("+QTEMP: \"pa5g-thermal\",\"36\""));
+
+static int at_qtemp(struct session *s, const char *line, size_t len, const struct at_cmd *cmd)
+{
+	at_reply(s, &qtemp_blob);
+
+	return AT_NONE;
+}
+
+static const struct at_blob qcainfo_blobs[NET_MODE_MAX] = {
+	[NET_MODE_AUTO] = AT_BLOB(
+		AT_LINE("+QCAINFO: \"PCC\",6300,50,\"LTE BAND 20\",1,319,-103,-9,-76,8")
+		AT_LINE("+QCAINFO: \"SCC\",100,100,\"LTE BAND 1\",1,372,-111,-13,-,6")
+		AT_LINE("+QCAINFO: \"SCC\",372750,20,\"NR N3\",2,431,-108,-7,-89,7")),
+	[NET_MODE_NR] = AT_BLOB(
+		AT_LINE("+QCAINFO: \"PCC\",504990,100,\"NR N41\",1,808,-71,0,-57,26")),
+	[NET_MODE_LTE] = AT_BLOB(
+		AT_LINE("+QCAINFO: \"PCC\",300,100,\"LTE BAND 1\",1,118,-108,-10,-79,3")
+		AT_LINE("+QCAINFO: \"SCC\",6300,50,\"LTE BAND 20\",1,319,-103,-9,-76,8")),
+	[NET_MODE_UMTS] = AT_BLOB(),
+};
+
+static int at_qcainfo(struct session *s, const char *line, size_t len, const struct at_cmd *cmd)
+{
+	at_reply(s, &qcainfo_blobs[s->net_mode]);
+
+	return AT_NONE;
+}
+
+static const struct at_blob qantrssi_blobs[NET_MODE_MAX] = {
+	[NET_MODE_AUTO] = AT_BLOB(
+		AT_LINE("+QANTRSSI: 1,-,-59,-,-58,-56,-53")),
+	[NET_MODE_NR] = AT_BLOB(
+		AT_LINE("+QANTRSSI: 1,-,-59,-,-58,-56,-53")),
+	[NET_MODE_LTE] = AT_BLOB(
+		AT_LINE("+QANTRSSI: 2,-74,-79")),
+	[NET_MODE_UMTS] = AT_BLOB(),
+};
+
+static int at_qantrssi_get(struct session *s, const char *line, size_t len, const struct at_cmd *cmd)
+{
+	at_reply(s, &qantrssi_blobs[s->net_mode]);
+
+	return AT_NONE;
+}
+
+static const struct at_blob qnwprefcfg_test_blob = AT_BLOB(
+	AT_LINE("+QNWPREFCFG: \"mode_pref\",AUTO:WCDMA:LTE:NR5G:NR5G-SA:NR5G-NSA")
+	AT_LINE("+QNWPREFCFG: \"gw_band\",1:2:5:8")
+	AT_LINE("+QNWPREFCFG: \"lte_band\",1:2:3:4:5:7:8:20:28:38:40:41:66")
+	AT_LINE("+QNWPREFCFG: \"nr5g_band\",1:3:5:7:8:20:28:38:40:41:66:77:78")
+	AT_LINE("+QNWPREFCFG: \"all_band_reset\"")
+	AT_LINE("+QNWPREFCFG: \"srv_domain\",(0-2)")
+	AT_LINE("+QNWPREFCFG: \"voice_domain\",(0-3)")
+	AT_LINE("+QNWPREFCFG: \"ue_usage_setting\",(0,1)")
+	AT_LINE("+QNWPREFCFG: \"roam_pref\",(0-3)")
+	AT_LINE("+QNWPREFCFG: \"cell_blacklist\",(1-3),(0-15),<freq-pci list>")
+	AT_LINE("+QNWPREFCFG: \"mode_blacklist\",(0-5)")
+	AT_LINE("+QNWPREFCFG: \"rat_acq_order\",NR5G:LTE:WCDMA")
+	AT_LINE("+QNWPREFCFG: \"nr5g_band_blacklist\",(0,1),<nr5g_band_blacklist>"));
+
+static int at_qnwprefcfg_test(struct session *s, const char *line, size_t len, const struct at_cmd *cmd)
+{
+	at_reply(s, &qnwprefcfg_test_blob);
+
+	return AT_NONE;
+}
+
+static int at_qnwprefcfg_mode_pref(struct session *s, const char *line, size_t len, const struct at_cmd *cmd)
+{
+	const char *arg = line + cmd->plen;
+	size_t n = len - cmd->plen;
+
+	if (ARG_IS(arg, n, "WCDMA")) {
+		s->net_mode = NET_MODE_UMTS;
+	} else if (ARG_IS(arg, n, "LTE")) {
+		s->net_mode = NET_MODE_LTE;
+	} else if (ARG_IS(arg, n, "NR5G")) {
+		s->net_mode = NET_MODE_NR;
+	}
+
+	return AT_OK;
+}
+
+static int at_cnmp(struct session *s, const char *line, size_t len, const struct at_cmd *cmd)
+{
+	if (ARG_IS(line + cmd->plen, len - cmd->plen, "14")) {
+		s->net_mode = NET_MODE_UMTS;
+	}
+
+	return AT_OK;
+}
+
+/* messages a new storage starts with */
+struct at_sms_seed {
+	unsigned idx;
+	enum sms_stat stat;
+	unsigned tpdu_len;
+	const char *pdu;
+};
+
+static const struct at_sms_seed sm_seed[] = {
+	{ 0, SMS_REC_READ, 67,
+		"07919731899699F3040b919780514257f800085210223250138230042d0442043e0442002004300431043e043d0435043d0442002004370432043e043d0438043b002004320430043c002e" },
+};
+
+static const struct at_sms_seed me_seed[] = {
+	{ 0, SMS_REC_READ, 160,
+		"07919762020041F7400DD0CDF2396C7CBB010008223081916324218C05000303030100310039002E00300033002E003200300032003200200432002000310039003A00330036002004370430043F043B0430043D04380440043E04320430043D043E00200441043F043804410430043D043804350020043F043B04300442044B0020043F043E00200442043004400438044404430020201300200037003000300020044004430431" },
+	{ 1, SMS_REC_READ, 160,
+		"07919762020041F7400DD0CDF2396C7CBB010008223081916324218C050003030302002E000A041D04300441043B04300436043404300439044204350441044C0020043E043104490435043D04380435043C0020002D002004340435043D043504330020043D043000200441044704350442043500200434043E0441044204300442043E0447043D043E002E041204300448002004310430043B0430043D0441003A002000390039" },
+	{ 2, SMS_REC_READ, 108,
+		"07919762020041F7440DD0CDF2396C7CBB01000822308191632421580500030303030031002E003200370020044004430431002E000A000A041F043E043F043E043B043D04380442044C00200441044704350442003A0020007000610079002E006D0065006700610066006F006E002E00720075" },
+	{ 3, SMS_REC_READ, 160,
+		"07919762020041F7400DD0CDF2396C7CBB010008223091916324218C0500031104010421043F043804410430043D043E00200037003000300020044004430431002E0020043F043E00200442043004400438044404430020002204170430043A04300447043004390441044F00210020041B04350433043A043E00220020043704300020043F043504400438043E043400200441002000310039002E00300033002E003200300032" },
+	{ 4, SMS_REC_READ, 160,
+		"07919762020041F7400DD0CDF2396C7CBB010008223091916324218C05000311040200320020043F043E002000310038002E00300034002E0032003000320032002E000A000A0418043D044204350440043D043504420020043D043000200441043A043E0440043E04410442043800200434043E0020003200350020041C043104380442002F044100200431044304340435044200200434043E044104420443043F0435043D0020" },
+	{ 5, SMS_REC_READ, 160,
+		"07919762020041F7400DD0CDF2396C7CBB010008223091916324218C0500031104030434043E00200441043B043504340443044E044904350433043E00200441043F043804410430043D0438044F0020043F043E0020044204300440043804440443002000310038002E00300034002E0032003000320032002E0020000A000A041F043E043F043E043B043D04380442044C002004310430043B0430043D0441003A002000700061" },
+	{ 6, SMS_REC_READ, 50,
+		"07919762020041F7440DD0CDF2396C7CBB010008223091916324211E0500031104040079002E006D0065006700610066006F006E002E00720075" },
+	{ 7, SMS_REC_READ, 160,
+		"07919762020041F7600DD0CDF2396C7CBB010008224031718101218C050003C407010421002004430441043B04430433043E0439002000AB0414043E043F043E043B043D043804420435043B044C043D044B04390020043D043E043C0435044000BB00200412044B0020043C043E04360435044204350020043F043E0434043A043B044E044704380442044C0020043D043000200412043004480443002000530049004D002D043A" },
+	{ 8, SMS_REC_READ, 160,
+		"07919762020041F7600DD0CDF2396C7CBB010008224031718101218C050003C407020430044004420443002004350449043500200434043E00200033002D04450020043D043E043C04350440043E0432002E0020041804450020043C043E0436043D043E002004380441043F043E043B044C0437043E043204300442044C002C0020043A043E04330434043000200412044B0020043D043500200445043E04420438044204350020" },
+	{ 9, SMS_REC_READ, 160,
+		"07919762020041F7600DD0CDF2396C7CBB010008224031718101218C050003C40703043E0441044204300432043B044F0442044C002004410432043E04390020043E0441043D043E0432043D043E04390020043D043E043C04350440002C0020043D0430043F04400438043C04350440002C00200434043B044F002004410432044F0437043800200441043E00200441043B0443043604310430043C043800200434043E04410442" },
+	{ 10, SMS_REC_READ, 160,
+		"07919762020041F7600DD0CDF2396C7CBB010008224031718101218C050003C4070404300432043A0438002C00200438043D044204350440043D043504420020043C04300433043004370438043D0430043C0438002004380020043C0430043B043E0437043D0430043A043E043C044B043C04380020043B044E0434044C043C0438002E000A04170432043E043D043804420435002004380020043E0442043F044004300432043B" },
+	{ 11, SMS_REC_READ, 160,
+		"07919762020041F7600DD0CDF2396C7CBB010008224031718101218C050003C40705044F04390442043500200053004D00530020043F043E002004430441043B043E04320438044F043C0020043E0441043D043E0432043D043E0433043E0020044204300440043804440430002E002004210442043E0438043C043E04410442044C0020043F043E0434043A043B044E04470435043D0438044F00200434043E043F043E043B043D" },
+	{ 12, SMS_REC_READ, 160,
+		"07919762020041F7600DD0CDF2396C7CBB010008224031718101218C050003C40706043804420435043B044C043D043E0433043E0020043D043E043C043504400430002020140020003300300020044004430431043B04350439002E00200415043604350434043D04350432043D0430044F0020043F043B04300442043000202014002000320020044004430431043B044F00200432002004340435043D044C002E0020041F043E" },
+	{ 13, SMS_REC_READ, 156,
+		"07919762020041F7640DD0CDF2396C7CBB0100082240317181012188050003C407070434043A043B044E044704380442044C002000680074007400700073003A002F002F006C006B002E006D0065006700610066006F006E002E00720075002F0069006E006100700070002F006100640064006900740069006F006E0061006C004E0075006D006200650072007300200438043B04380020002A0034003800310023000A" },
+	{ 14, SMS_REC_READ, 27,
+		"07919762020041F7040B919781314259F800084290526173402108041E043A04300439" },
+	{ 24, SMS_REC_READ, 159,
+		"07919762020041F7440B919780314257F8000842211131754421880500033B0701041F04400435043404320438043604430020043204410435003A00200432043004410020043E0441043A043E0440043104380442000A041F043504470430043B044C043D043E04390020044204300439043D044B0020043E0431044A044F0441043D0435043D044C0435002E000A041A0430043A043E043500200433043E0440044C" },
+	{ 25, SMS_REC_READ, 159,
+		"07919762020041F7440B919780314257F80008422111317545218C0500033B0702043A043E04350020043F04400435043704400435043D044C0435000A04120430044800200433043E04400434044B04390020043204370433043B044F0434002004380437043E0431044004300437043804420021000A042704350433043E00200445043E04470443003F002004410020043A0430043A043E044E002004460435043B044C044E" },
+	{ 26, SMS_REC_READ, 159,
+		"07919762020041F7440B919780314257F80008422111317555218C0500033B0703000A041E0442043A0440043E044E00200434044304480443002004320430043C002004410432043E044E003F000A041A0430043A043E043C044300200437043B043E0431043D043E043C044300200432043504410435043B044C044E002C000A0411044B0442044C0020043C043E043604350442002C0020043F043E0432043E04340020043F" },
+	{ 27, SMS_REC_READ, 159,
+		"07919762020041F7440B919780314257F80008422111317575218C0500033B0704043E04340430044E0021000A0421043B0443044704300439043D043E00200432043004410020043A043E043304340430002D0442043E0020043204410442044004350442044F002C000A04120020043204300441002004380441043A044004430020043D04350436043D043E044104420438002004370430043C04350442044F002C000A042F" },
+	{ 28, SMS_REC_READ, 159,
+		"07919762020041F7440B919780314257F80008422111317585218C0500033B07050020043504390020043F043E04320435044004380442044C0020043D04350020043F043E0441043C0435043B003A000A041F044004380432044B0447043A04350020043C0438043B043E04390020043D0435002004340430043B00200445043E04340443003B000A04210432043E044E0020043F043E04410442044B043B0443044E00200441" },
+	{ 29, SMS_REC_READ, 159,
+		"07919762020041F7440B919780314257F80008422111317595218C0500033B07060432043E0431043E04340443000A042F0020043F043E044204350440044F0442044C0020043D04350020043704300445043E04420435043B002E000A0415044904350020043E0434043D043E0020043D043004410020044004300437043B044304470438043B043E002E002E002E000A041D043504410447043004410442043D043E04390020" },
+	{ 30, SMS_REC_READ, 57,
+		"07919762020041F7440B919780314257F8000842211131850021260500033B070704360435044004420432043E04390020041B0435043D0441043A043804390020" },
+};
+
+static const struct {
+	const struct at_sms_seed *seed;
+	unsigned n;
+} at_sms_seeds[CPMS_MAX] = {
+	[CPMS_SM] = { sm_seed, sizeof(sm_seed) / sizeof(sm_seed[0]) },
+	[CPMS_ME] = { me_seed, sizeof(me_seed) / sizeof(me_seed[0]) },
+};
+
+static const char * const at_mem_names[CPMS_MAX] = {
+	[CPMS_SM] = "SM",
+	[CPMS_ME] = "ME",
+};
+
+/* SMS storage sizes and where they are kept, see at_sms_setup() */
+static struct {
+	unsigned slots[CPMS_MAX];
+	unsigned fill;
+	const char *dir;
+} at_sms_cfg = {
+	.slots = { [CPMS_SM] = 5, [CPMS_ME] = 200 },
+	.fill = 0,
+	.dir = NULL,
+};
+
+void at_sms_setup(unsigned me_slots, unsigned fill, const char *dir)
+{
+	at_sms_cfg.slots[CPMS_ME] = me_slots;
+	at_sms_cfg.fill = fill;
+	at_sms_cfg.dir = dir;
+}
+
+/* the storage mem of the session, opened and filled on first use */
+static struct sms_store *at_sms(struct session *s, enum cpms_t mem)
+{
+	const struct at_sms_seed *seed = at_sms_seeds[mem].seed;
+	unsigned i, n = at_sms_seeds[mem].n;
+	struct sms_store *st;
+	const char *base;
+	char *path = NULL;
+	int r;
+
+	if (s->sms[mem]) return s->sms[mem];
+
+	st = malloc(sizeof(*st));
+	if (st == NULL) return NULL;
+
+	if (at_sms_cfg.dir) {
+		base = strrchr(s->name, '/');
+		if (asprintf(&path, "%s/%s.%s", at_sms_cfg.dir, base ? base + 1 : s->name,
+					at_mem_names[mem]) < 0) {
+			free(st);
+			return NULL;
+		}
+	}
+
+	r = sms_store_open(st, at_sms_cfg.slots[mem], path);
+	if (r < 0) {
+		DPRINTF("%s: cannot open %s storage %s: %s\n", s->name, at_mem_names[mem],
+				path ? path : "", strerror(errno));
+		free(path);
+		free(st);
+		return NULL;
+	}
+	free(path);
+
+	if (r) {
+		for (i = 0; i < n; i++)
+			sms_put_at(st, seed[i].idx, seed[i].stat, seed[i].tpdu_len,
+					seed[i].pdu, strlen(seed[i].pdu));
+		/* ME storage can be filled up to stress pollers */
+		for (i = 0; mem == CPMS_ME && i < at_sms_cfg.fill; i++) {
+			if (sms_put(st, SMS_REC_UNREAD, seed[i % n].tpdu_len,
+						seed[i % n].pdu, strlen(seed[i % n].pdu)) < 0)
+				break;
 		}
-		str++;
 	}
 
-	return false;
+	s->sms[mem] = st;
+
+	return st;
 }
 
-void at_read_line_cb(const char *line)
+void at_session_close(struct session *s)
 {
-	if (echo)
-	{
-		tty_write_line(line);
+	int i;
+
+	for (i = 0; i < CPMS_MAX; i++) {
+		if (s->sms[i] == NULL) continue;
+		sms_store_close(s->sms[i]);
+		free(s->sms[i]);
+		s->sms[i] = NULL;
 	}
+	s->cmgl.st = NULL;
+	urc_session_close(s);
 
-	if (waitPdu)
-	{
-		waitPdu = 0;
-		tty_write_line(isPdu1a(line) ? "OK" : "ERROR");
+	ev_timer_stop(s->loop, &s->timer);
+	s->step = NULL;
+	if (s->prof) {
+		at_profile_put(s->prof);
+		s->prof = NULL;
+	}
+}
 
-		return;
+/* parse a decimal argument, returns the position after it or NULL */
+static const char *at_arg_uint(const char *p, const char *end, unsigned *v)
+{
+	const char *start = p;
+
+	for (*v = 0; p < end && *p >= '0' && *p <= '9' && p - start < 9; p++)
+		*v = *v * 10 + (*p - '0');
+
+	return (p == start) ? NULL : p;
+}
+
+/* take the next matching messages into the listing window */
+static void at_cmgl_fill(struct session *s)
+{
+	struct sms_store *st = s->cmgl.st;
+	const struct sms *m;
+	unsigned w;
+	int idx;
+
+	while (s->cmgl.n < SESSION_CMGL_WIN) {
+		idx = sms_next(st, s->cmgl.stat, s->cmgl.next);
+		if (idx < 0) break;
+		m = sms_get(st, idx);
+		w = (s->cmgl.first + s->cmgl.n++) % SESSION_CMGL_WIN;
+		s->cmgl.win[w].idx = idx;
+		s->cmgl.win[w].hdr_len = snprintf(s->cmgl.win[w].hdr,
+				sizeof(s->cmgl.win[w].hdr), "+CMGL: %d,%d,,%u\n\r",
+				idx, sms_stat(m), m->tpdu_len);
+		s->cmgl.next = idx + 1;
 	}
+}
 
-	if (!strcasecmp(line, "AT") ||
-		!strcasecmp(line, "AT+CMEE=1") ||
-		!strncasecmp(line, "AT+CFUN=", 8) ||
-		!strcasecmp(line, "AT+CREG=0") ||
-		!strcasecmp(line, "AT+CEREG=0") ||
-		!strcasecmp(line, "AT+C5GREG=0") ||
-		!strcasecmp(line, "AT+DIALMODE=0") ||
-		!strcasecmp(line, "AT+CNETCI=0") ||
-		!strcasecmp(line, "AT+CNMI=2,1") ||
-		!strcasecmp(line, "AT+USBNETIP=1") ||
-		!strncasecmp(line, "AT+CNBP=", 8) ||
-		!strncasecmp(line, "AT+CGDCONT=1,", 13) ||
-		!strncasecmp(line, "AT+ZGDCONT=1,", 13) ||
-		!strncasecmp(line, "AT+CGAUTH=", 10) ||
-		!strncasecmp(line, "AT+AUTOAPN=", 11) ||
-		!strcasecmp(line, "AT+CMGF=0") ||
-		!strcasecmp(line, "AT+COPS=2") ||
-		!strcasecmp(line, "AT*CELL=0") ||
-		!strcasecmp(line, "AT+CGACT=1,1") ||
-		!strcasecmp(line, "AT+CGACT=0") ||
-		!strcasecmp(line, "AT+CGATT=0") ||
-		!strcasecmp(line, "AT+ZGACT=1,1") ||
-		!strcasecmp(line, "AT+COPS=3,0") ||
-		!strcasecmp(line, "AT+QCFG=\"autoapn\",0") ||
-		!strncasecmp(line, "AT+QCFG=\"ims\",", 14) ||
-		!strncasecmp(line, "AT+QNWLOCK=", 11) ||
-		!strcasecmp(line, "AT+QSIMDET=1,1") ||
-		!strcasecmp(line, "AT+QIACT=1") ||
-		!strcasecmp(line, "AT+QNETDEVCTL=1,1,1") ||
-		!strncasecmp(line, "AT+CGPIAF=", 10) ||
-		!strncasecmp(line, "AT+QICSGP=", 10) ||
-		!strncasecmp(line, "AT+CSCS=\"", 9) ||
-		!strcasecmp(line, "AT+CMEE=1")) {
-		;
-	} else if (!strcasecmp(line, "ATE1")) {
-		echo = 1;
-	} else if (!strcasecmp(line, "ATE0")) {
-		echo = 0;
-	} else if (!strcasecmp(line, "ATI")) {
-		tty_write_line("Manufacturer: " MANUFACTURER_);
-		tty_write_line("Model: " MODEL_);
-		tty_write_line("Revision: V1.0.009");
-		tty_write_line("IMEI: " IMEI_);
-	} else if (!strcasecmp(line, "AT+SIMCOMATI")) {
-		tty_write_line("Manufacturer: " MANUFACTURER_);
-		tty_write_line("Model: " MODEL_);
-		tty_write_line("Revision: " FW_VERSION_);
-		tty_write_line("IMEI: " IMEI_);
-	} else if (!strcasecmp(line, "ATI;+CSUB")) {
-		tty_write_line(MANUFACTURER_);
-		tty_write_line(MODEL_);
-		tty_write_line("Revision: " FW_VERSION_);
-		tty_write_line("SubEdition: " SUBEDITION_);
-	} else if (!strcasecmp(line, "AT+GSN")) {
-		tty_write_line(IMEI_);
-	} else if (!strcasecmp(line, "AT+CGMR")) {
-		tty_write_line("+CGMR: " FW_VERSION_);
-	} else if (!strcasecmp(line, "AT+QGMR")) {
-		tty_write_line(FW_VERSION_);
-	} else if (!strcasecmp(line, "AT+CMEE?")) {
-		tty_write_line("+CMEE: 1");
-	} else if (!strcasecmp(line, "AT+CSUB")) {
-		tty_write_line("+CSUB: " SUBEDITION_);
-	} else if (!strcasecmp(line, "AT+UIMHOTSWAPLEVEL?")) {
-		tty_write_line("+UIMHOTSWAPLEVEL: 1");
-	} else if (!strcasecmp(line, "AT+UIMHOTSWAPON?")) {
-		tty_write_line("+UIMHOTSWAPON: 1");
-	} else if (!strcasecmp(line, "AT+USBNETIP?")) {
-		tty_write_line("USBNETIP=1");
-	} else if (!strcasecmp(line, "AT+CMGF?")) {
-		tty_write_line("+CMGF: 0");
-	} else if (!strcasecmp(line, "AT+CPIN?")) {
-		tty_write_line("+CPIN: READY");
-	} else if (!strcasecmp(line, "AT+CNBP?")) {
-		tty_write_line("+CNBP: 0X000700000FEB0180,0X000007FF3FDF3FFF");
-	} else if (!strcasecmp(line, "AT+CICCID")) {
-		tty_write_line("+ICCID: " ICCID_);
-	} else if (!strcasecmp(line, "AT+CSIM=10,\"0020000100\"")) {
-		tty_write_line("+CSIM:4,\"63C3\"");
-	} else if (!strcasecmp(line, "AT+QPINC=\"SC\"")) {
-		tty_write_line("+QPINC: \"SC\",3,10");
-	} else if (!strcasecmp(line, "AT+CIMI")) {
-		tty_write_line(IMSI_);
-	} else if (!strcasecmp(line, "AT+CNUM")) {
-		tty_write_line("+CME ERROR: 4");
-		return;
-	} else if (!strcasecmp(line, "AT+CSPN?")) {
-		tty_write_line("+CSPN: \"Virtual\",0");
-	} else if (!strcasecmp(line, "AT+CREG?")) {
-		tty_write_line("+CREG: 0,0");
-	} else if (!strcasecmp(line, "AT+CEREG?")) {
-		tty_write_line("+CEREG: 0,1");
-	} else if (!strcasecmp(line, "AT+C5GREG?")) {
-		tty_write_line("+C5GREG: 0,0");
-	} else if (!strcasecmp(line, "AT+CGCONTRDP")) {
-		tty_write_line("+CGCONTRDP: 1,5,\"test.MNC002.MCC255.GPRS\",\"10.36.130.148\",\"\",\"10.97.52.68\",\"10.97.52.76\",\"\",\"\",0,0");
-	} else if (!strcasecmp(line, "AT+CSQ")) {
-		tty_write_line("+CSQ: 23,99");
-	} else if (!strcasecmp(line, "AT+CGATT?")) {
-		tty_write_line("+CGATT: 1");
-	} else if (!strcasecmp(line, "AT+CPSI?")) {
-		if (net_mode == NET_MODE_UMTS) {
-			tty_write_line("+CPSI: WCDMA,Online,252-02,0x2612,-294967296,WCDMA IMT 2000,437,10687,0,-3,-83,-32768,-83,-15");
-		} else {
-			tty_write_line("+CPSI: LTE,Online,252-02,0x260A,196089506,299,EUTRAN-BAND7,2850,5,5,21,47,43,17");
+/* describe len bytes at p but the first *off and at most *max, returns 1 if any */
+static int at_iov(struct iovec *iov, const char *p, size_t len, size_t *off, size_t *max)
+{
+	if (*off >= len) {
+		*off -= len;
+		return 0;
+	}
+
+	iov->iov_base = (char *)p + *off;
+	iov->iov_len = (len - *off < *max) ? len - *off : *max;
+	*max -= iov->iov_len;
+	*off = 0;
+
+	return 1;
+}
+
+static int at_cmgl_iov(struct outq_src *src, struct iovec *iov, int iovcnt, size_t max)
+{
+	struct session *s = container_of(src, struct session, cmgl.src);
+	const struct sms *m;
+	size_t off = s->cmgl.off;
+	unsigned i, w;
+	int n = 0;
+
+	at_cmgl_fill(s);
+
+	/* the header from the window, the PDU in place in the store */
+	for (i = 0; i < s->cmgl.n && n + 2 <= iovcnt && max; i++) {
+		w = (s->cmgl.first + i) % SESSION_CMGL_WIN;
+		m = sms_get(s->cmgl.st, s->cmgl.win[w].idx);
+		n += at_iov(&iov[n], s->cmgl.win[w].hdr, s->cmgl.win[w].hdr_len, &off, &max);
+		if (max) n += at_iov(&iov[n], m->pdu, m->len, &off, &max);
+	}
+
+	return n;
+}
+
+static int at_cmgl_consume(struct outq_src *src, size_t n)
+{
+	struct session *s = container_of(src, struct session, cmgl.src);
+	struct sms_store *st = s->cmgl.st;
+	const struct sms *m;
+	size_t len;
+	unsigned w;
+
+	s->cmgl.off += n;
+	while (s->cmgl.n) {
+		w = s->cmgl.first;
+		m = sms_get(st, s->cmgl.win[w].idx);
+		len = s->cmgl.win[w].hdr_len + m->len;
+		if (s->cmgl.off < len) return 0;
+
+		/* listed, so read */
+		if (sms_stat(m) == SMS_REC_UNREAD)
+			sms_set_stat(st, s->cmgl.win[w].idx, SMS_REC_READ);
+		s->cmgl.off -= len;
+		s->cmgl.first = (w + 1) % SESSION_CMGL_WIN;
+		s->cmgl.n--;
+	}
+
+	if (sms_next(st, s->cmgl.stat, s->cmgl.next) >= 0) return 0;
+
+	s->cmgl.done = 1;
+	return 1;
+}
+
+/*
+ * The listing is not built up front: it is queued as a source the writer
+ * drains straight from the store, so listing any number of messages copies
+ * no PDU and takes no queue capacity. The session is held until it has been
+ * sent and at_session_written() has queued the final OK.
+ */
+static int at_cmgl(struct session *s, const char *line, size_t len, const struct at_cmd *cmd)
+{
+	const char *end = line + len;
+	struct sms_store *st;
+	unsigned stat;
+
+	if (at_arg_uint(line + cmd->plen, end, &stat) != end || stat > SMS_ALL) {
+		tty_write_str(s, "+CMS ERROR: 304");
+		return AT_ERROR;
+	}
+
+	st = at_sms(s, s->cpms);
+	if (st == NULL) {
+		tty_write_str(s, "+CMS ERROR: 500");
+		return AT_ERROR;
+	}
+
+	if (sms_next(st, stat, 0) < 0) return AT_OK;
+
+	s->cmgl.st = st;
+	s->cmgl.stat = stat;
+	s->cmgl.done = 0;
+	s->cmgl.next = 0;
+	s->cmgl.first = s->cmgl.n = 0;
+	s->cmgl.off = 0;
+	s->cmgl.src.iov = at_cmgl_iov;
+	s->cmgl.src.consume = at_cmgl_consume;
+	tty_write_src(s, &s->cmgl.src);
+
+	return AT_NONE;
+}
+
+static int at_cmgr(struct session *s, const char *line, size_t len, const struct at_cmd *cmd)
+{
+	const char *end = line + len;
+	const struct sms *m;
+	struct sms_store *st;
+	unsigned idx;
+	char hdr[48];
+	int n;
+
+	if (at_arg_uint(line + cmd->plen, end, &idx) != end) {
+		tty_write_str(s, "+CMS ERROR: 304");
+		return AT_ERROR;
+	}
+
+	st = at_sms(s, s->cpms);
+	if (st == NULL) {
+		tty_write_str(s, "+CMS ERROR: 500");
+		return AT_ERROR;
+	}
+
+	m = sms_get(st, idx);
+	if (m == NULL) {
+		tty_write_str(s, "+CMS ERROR: 321");
+		return AT_ERROR;
+	}
+
+	n = snprintf(hdr, sizeof(hdr), "+CMGR: %d,,%u\n\r", sms_stat(m), m->tpdu_len);
+	tty_write(s, hdr, n);
+	tty_write(s, m->pdu, m->len);
+	if (sms_stat(m) == SMS_REC_UNREAD) sms_set_stat(st, idx, SMS_REC_READ);
+
+	return AT_OK;
+}
+
+/* AT+CMGD=<index>[,<delflag>], delflag 1 to 4 deletes by status, index ignored */
+static int at_cmgd(struct session *s, const char *line, size_t len, const struct at_cmd *cmd)
+{
+	static const unsigned del_stats[] = {
+		[1] = 1 << SMS_REC_READ,
+		[2] = 1 << SMS_REC_READ | 1 << SMS_STO_SENT,
+		[3] = 1 << SMS_REC_READ | 1 << SMS_STO_SENT | 1 << SMS_STO_UNSENT,
+		[4] = (1 << SMS_STAT_MAX) - 1,
+	};
+	const char *p, *end = line + len;
+	struct sms_store *st;
+	unsigned idx, flag = 0;
+	int i, stat;
+
+	p = at_arg_uint(line + cmd->plen, end, &idx);
+	if (p && p < end && *p == ',') p = at_arg_uint(p + 1, end, &flag);
+	if (p != end || flag > 4) {
+		tty_write_str(s, "+CMS ERROR: 304");
+		return AT_ERROR;
+	}
+
+	st = at_sms(s, s->cpms);
+	if (st == NULL) {
+		tty_write_str(s, "+CMS ERROR: 500");
+		return AT_ERROR;
+	}
+
+	if (!flag) {
+		if (idx >= st->nslots) {
+			tty_write_str(s, "+CMS ERROR: 321");
+			return AT_ERROR;
 		}
-	} else if (!strcasecmp(line, "AT+COPS?")) {
-		if (net_mode == NET_MODE_UMTS) {
-			tty_write_line("+COPS: 0,0,\"GustaFon\",6");
+		sms_del(st, idx);
+		return AT_OK;
+	}
+
+	for (stat = 0; stat < SMS_STAT_MAX; stat++) {
+		if (!(del_stats[flag] & (1 << stat))) continue;
+		for (i = sms_next(st, stat, 0); i >= 0; i = sms_next(st, stat, i + 1))
+			sms_del(st, i);
+	}
+
+	return AT_OK;
+}
+
+static int at_cpms(struct session *s, enum cpms_t mem)
+{
+	struct sms_store *st;
+	char buf[64];
+	int n;
+
+	st = at_sms(s, mem);
+	if (st == NULL) {
+		tty_write_str(s, "+CMS ERROR: 500");
+		return AT_ERROR;
+	}
+	s->cpms = mem;
+
+	n = snprintf(buf, sizeof(buf), "+CPMS: %u,%u,%u,%u,%u,%u",
+			st->used, st->nslots, st->used, st->nslots, st->used, st->nslots);
+	tty_write_line(s, buf, n);
+
+	return AT_OK;
+}
+
+static int at_cpms_sm(struct session *s, const char *line, size_t len, const struct at_cmd *cmd)
+{
+	return at_cpms(s, CPMS_SM);
+}
+
+static int at_cpms_me(struct session *s, const char *line, size_t len, const struct at_cmd *cmd)
+{
+	return at_cpms(s, CPMS_ME);
+}
+
+/* the current storage first, messages are written to and received in ME */
+static int at_cpms_get(struct session *s, const char *line, size_t len, const struct at_cmd *cmd)
+{
+	struct sms_store *cur, *me;
+	char buf[96];
+	int n;
+
+	cur = at_sms(s, s->cpms);
+	me = at_sms(s, CPMS_ME);
+	if (cur == NULL || me == NULL) {
+		tty_write_str(s, "+CMS ERROR: 500");
+		return AT_ERROR;
+	}
+
+	n = snprintf(buf, sizeof(buf), "+CPMS: \"%s\",%u,%u,\"ME\",%u,%u,\"ME\",%u,%u",
+			at_mem_names[s->cpms], cur->used, cur->nslots,
+			me->used, me->nslots, me->used, me->nslots);
+	tty_write_line(s, buf, n);
+
+	return AT_OK;
+}
+
+static int at_cusd(struct session *s, const char *line, size_t len, const struct at_cmd *cmd)
+{
+	s->enqueueUssd = 1;
+	at_defer(s, cusd_steps);
+	return AT_NONE;
+}
+
+/*
+ * AT+CMGS=<length>, the PDU follows the prompt. It is taken from the input
+ * as it arrives, however it is cut into reads and however long it is,
+ * until Ctrl-Z sends it or ESC drops it.
+ */
+static int at_cmgs(struct session *s, const char *line, size_t len, const struct at_cmd *cmd)
+{
+	const char *end = line + len;
+
+	if (at_arg_uint(line + cmd->plen, end, &s->pdu_len) != end ||
+			!s->pdu_len || s->pdu_len >= SMS_PDU_MAX) {
+		tty_write_str(s, "+CMS ERROR: 304");
+		return AT_ERROR;
+	}
+
+	s->waitPdu = 1;
+	s->pdu_n = 0;
+	s->pdu_bad = 0;
+	s->split.raw = at_pdu_feed;
+	tty_write_ref(s, "> ", 2);
+
+	return AT_NONE;
+}
+
+/* a message sent with AT+CMGS is kept in the current storage, if there is room */
+static void at_cmgs_store(struct session *s, unsigned mr)
+{
+	struct sms_store *st;
+	char *tpdu = s->pdu + s->pdu_n - s->pdu_len * 2;
+
+	st = at_sms(s, s->cpms);
+	if (st == NULL) return;
+
+	/* with the reference it was given */
+	tpdu[2] = "0123456789ABCDEF"[mr >> 4];
+	tpdu[3] = "0123456789ABCDEF"[mr & 0xf];
+	sms_put(st, SMS_STO_SENT, s->pdu_len, s->pdu, s->pdu_n);
+}
+
+/* +CDS for a message that asked for a status report, delivered as soon as sent */
+static void at_cds(struct session *s, const struct pdu_submit *m, unsigned mr)
+{
+	char pdu[PDU_REPORT_HEX], buf[32 + PDU_REPORT_HEX];
+	unsigned tpdu_len;
+	int n;
+
+	tpdu_len = pdu_status_report(pdu, m, mr, time(NULL));
+	n = snprintf(buf, sizeof(buf), "+CDS: %u\n\r%s\n\r", tpdu_len, pdu);
+	tty_write(s, buf, n);
+	stats_add(stats_self->urcs, 1);
+}
+
+/*
+ * Ctrl-Z sends the PDU entered, ESC drops it; lines are split again after.
+ * A PDU that decodes to an SMS-SUBMIT of <length> octets gets the next
+ * message reference of the session.
+ */
+static void at_pdu_end(struct session *s, int send)
+{
+	struct pdu_submit m;
+	char buf[24];
+	unsigned mr;
+	int n;
+
+	s->split.raw = NULL;
+	s->waitPdu = 0;
+
+	stats_line(s);
+	if (!send) {
+		tty_write_str(s, "OK");
+	} else if (!s->pdu_bad && s->pdu_n <= sizeof(s->pdu) &&
+			pdu_submit_decode(&m, s->pdu, s->pdu_n) == (int)s->pdu_len) {
+		mr = s->mr++;
+		at_cmgs_store(s, mr);
+		n = snprintf(buf, sizeof(buf), "+CMGS: %u\n\r", mr);
+		tty_write(s, buf, n);
+		tty_write_str(s, "OK");
+		if (pdu_srr(&m)) at_cds(s, &m, mr);
+	} else {
+		tty_write_str(s, "+CMS ERROR: 304");
+	}
+	stats_reply(s);
+	urc_flush(s);
+}
+
+/*
+ * Input after the prompt: runs of hex digits are collected, line breaks
+ * between them are ignored and anything else spoils the PDU.
+ */
+static int at_pdu_feed(struct splitter *sp, char *p, int n)
+{
+	struct session *s = container_of(sp, struct session, split);
+	char *start = p, *end = p + n, *q;
+	size_t k;
+	char c = 0;
+
+	while (p < end) {
+		q = (char *)split_find_nonhex(p, end);
+		k = q - p;
+		if (k > sizeof(s->pdu) || s->pdu_n > sizeof(s->pdu) - k) {
+			/* too long, however much more comes */
+			s->pdu_n = sizeof(s->pdu) + 1;
 		} else {
-			tty_write_line("+COPS: 0,0,\"GustaFon\",9");
-		}
-	} else if (!strcasecmp(line, "AT+ZCAINFO?")) {
-		if (net_mode != NET_MODE_UMTS) {
-			tty_write_line("+ZCAINFO: 299,7,17758,2850,10;341,1,3,1802,20");
-		}
-	} else if (!strcasecmp(line, "AT+COPS=0")) {
-		tty_write_line("+XACTIVATE: 1");
-		usleep(500);
-		tty_write_line("+XACTIVATE: 2");
-		sleep(2);
-	} else if (!strcasecmp(line, "AT+COPS=?")) {
-		sleep(1);
-		tty_write_line("+COPS: "
-			"(1, \"GustaFon GUS\", \"GustaFon\", \"25202\", 2),"
-			"(1, \"Tele2 EU\", \"Tele2\", \"25220\", 2),"
-			"(1, \"GustaFon GUS\", \"GustaFon\", \"25202\", 7),"
-			"(1, \"Beeline\", \"Beeline\", \"25299\", 7),"
-			"(1, \"Tele2 EU\", \"Tele2)(\", \"25220\", 7),"
-			"(1, \"YOTA:)\", \"YOTA\", \"25211\", 7),"
-			"(1, \"MTS GUS\", \"MTS GUS\", \"25201\", 7),"
-			",(0,1,2,3,4),(0,1,2)");
-	} else if (!strcasecmp(line, "AT+CGPADDR=1")) {
-		if (enqueueUssd) {
-			enqueueUssd = 0;
-			tty_write_line(USSD_RESP);
+			memcpy(s->pdu + s->pdu_n, p, k);
+			s->pdu_n += k;
 		}
+		p = q;
+		if (p == end) break;
 
-		tty_write_line("+CGPADDR: 1, \"10.36.130.148\"");
-	} else if (!strcasecmp(line, "AT+CPMUTEMP")) {
-		tty_write_line("+CPMUTEMP: 36");
-	} else if (!strcasecmp(line, "AT+CNETCI?")) {
-		if (net_mode != NET_MODE_UMTS) {
-			tty_write_line("+CNETCISRVINFO: MCC-MNC: 252-02,TAC: 9738,cellid: 196089506,rsrp: 47,rsrq: 21, pci: 299,earfcn: 2850");
-			tty_write_line("+CNETCINONINFO: 0,MCC-MNC: 000-00,TAC: 0,cellid: -1,rsrp: 23,rsrq: 0,pci: 195,earfcn: 1602");
-			tty_write_line("+CNETCINONINFO: 1,MCC-MNC: 000-00,TAC: 0,cellid: -1,rsrp: 31,rsrq: 17,pci: 92,earfcn: 1602");
-		}
-		tty_write_line("+CNETCI: 0");
-	} else if (!strcasecmp(line, "AT+SIGNS")) {
-		if (net_mode != NET_MODE_UMTS) {
-			tty_write_line("+RSRP0: -109");
-			tty_write_line("+RSRP1: -112");
-			tty_write_line("+RSRQ0: -11");
-			tty_write_line("+RSRQ1: -11");
-			tty_write_line("+RSSI0: -61");
-			tty_write_line("+RSSI1: -64");
-		}
-	} else if (!strcasecmp(line, "AT+DIALMODE?")) {
-		tty_write_line("+DIALMODE: 0");
-	} else if (!strcasecmp(line, "AT+QCFG=\"nat\"")) {
-		tty_write_line("+QCFG: \"nat\",1");
-	} else if (!strcasecmp(line, "AT+QCFG=\"ethernet\"")) {
-		tty_write_line("+QCFG: \"ethernet\",0");
-	} else if (!strcasecmp(line, "AT+QCFG=\"pcie/mode\"")) {
-		tty_write_line("+QCFG: \"pcie/mode\",0");
-	} else if (!strcasecmp(line, "AT+QCFG=\"usbnet\"")) {
-		tty_write_line("+QCFG: \"usbnet\",0");
-	} else if (!strcasecmp(line, "AT+QCFG=\"ip6/cfg\"")) {
-		tty_write_line("+QCFG: \"ip6/cfg\",\"neigh\",1");
-	} else if (!strcasecmp(line, "AT+QUIMSLOT?")) {
-		tty_write_line("+QUIMSLOT: 1");
-	} else if (!strcasecmp(line, "AT+QCCID")) {
-		tty_write_line("+QCCID: " ICCID_);
-	} else if (!strcasecmp(line, "AT+QSPN")) {
-		tty_write_line("+QSPN: \"Virtual\",\"Virtual\",\"Virtual\",0,\"25201\"");
-	} else if (!strcasecmp(line, "AT+QNETDEVCTL?")) {
-		tty_write_line("+QNETDEVCTL: 1,2,1");
-		tty_write_line("+QNETDEVCTL: 2,2,0");
-	} else if (!strcasecmp(line, "AT+QNWINFO")) {
-		if (net_mode == NET_MODE_AUTO) {
-			tty_write_line("+QNWINFO: \"FDD LTE\",26203,\"LTE BAND 1\",300");
-			tty_write_line("+QNWINFO: \"NR5G-NSA\",26203,\"NR N41\",529950");
-		} else if (net_mode == NET_MODE_NR) {
-			tty_write_line("+QNWINFO: \"NR5G-SA\",26203,\"NR N41\",529950");
-		} else if (net_mode == NET_MODE_LTE) {
-			tty_write_line("+QNWINFO: \"FDD LTE\",26202,\"LTE BAND 7\",2850");
-		} else if (net_mode == NET_MODE_UMTS) {
-			tty_write_line("+QNWINFO: \"HSPA+\",25002,\"WCDMA 2100\",10687");
-		}
-	} else if (!strcasecmp(line, "AT+QENG=\"servingcell\"")) {
-		if (net_mode == NET_MODE_AUTO) {
-			tty_write_line("+QENG: \"servingcell\",\"CONNECT\"");
-			tty_write_line("+QENG: \"LTE\",\"FDD\",262,03,1212126,118,300,1,5,5,B8FD,-108,-10,-78,4,10,23,19");
-			tty_write_line("+QENG: \"NR5G-NSA\",262,03,170,-93,3,-8,529950,41,0,157E,1");
-		} else if (net_mode == NET_MODE_NR) {
-			tty_write_line("+QENG: \"servingcell\",\"CONNECT\",\"NR5G-SA\",\"TDD\",262,00,C22221001,808,1421AF,504990,41,100,-71,0,27,7,42,1");
-		} else if (net_mode == NET_MODE_LTE) {
-			tty_write_line("+QENG: \"servingcell\",\"CONNECT\",\"LTE\",\"FDD\",262,02,1951D49,12,2850,7,5,5,260A,-92,-8,-68,20,13,0,31");
-		} else if (net_mode == NET_MODE_UMTS) {
-			tty_write_line("+QENG: \"servingcell\",\"CONNECT\",\"WCDMA\",262,02,2612,656BAF,10687,166,-84,-8,1,6,0");
+		c = *p++;
+		if (c == 0x1a || c == 0x1b) break;
+		if (c != '\r' && c != '\n') s->pdu_bad = 1;
+		c = 0;
+	}
+
+	if (s->echo) tty_write(s, start, p - start);
+	if (c) at_pdu_end(s, c == 0x1a);
+
+	return p - start;
+}
+
+/*
+ * AT+CMUX=<mode>[,<subset>[,<port_speed>[,<N1>[,...]]]], basic option with
+ * UIH frames only. The port switches over once the OK is queued.
+ */
+static int at_cmux(struct session *s, const char *line, size_t len, const struct at_cmd *cmd)
+{
+	const char *p = line + cmd->plen, *q, *end = line + len;
+	unsigned v[4] = { 0, 0, 0, CMUX_N1_DEF };
+	unsigned val;
+	int i;
+
+	p = at_arg_uint(p, end, &v[0]);
+	for (i = 1; p && p < end && *p == ','; i++) {
+		q = at_arg_uint(p + 1, end, &val);
+		if (q == NULL) q = p + 1;	/* left out */
+		else if (i < 4) v[i] = val;
+		p = q;
+	}
+
+	if (p != end || s->dlci || v[0] || v[1] || !v[3] || v[3] > CMUX_N1_MAX) {
+		tty_write_str(s, "ERROR");
+		return AT_ERROR;
+	}
+
+	s->cmux_n1 = v[3];
+
+	return AT_OK;
+}
+
+/* 4G */
+static int at_qscan_4g(struct session *s, const char *line, size_t len, const struct at_cmd *cmd)
+{
+	at_defer(s, qscan_4g_steps);
+	return AT_NONE;
+}
+
+/* 5G */
+static int at_qscan_5g(struct session *s, const char *line, size_t len, const struct at_cmd *cmd)
+{
+	at_defer(s, qscan_5g_steps);
+	return AT_NONE;
+}
+
+/* 3G */
+static int at_qscan_3g(struct session *s, const char *line, size_t len, const struct at_cmd *cmd)
+{
+	at_defer(s, qscan_3g_steps);
+	return AT_NONE;
+}
+
+static int at_nop(struct session *s, const char *line, size_t len, const struct at_cmd *cmd)
+{
+	return AT_OK;
+}
+
+static int at_rsp(struct session *s, const char *line, size_t len, const struct at_cmd *cmd)
+{
+	at_reply(s, &cmd->rsp);
+
+	return AT_NONE;
+}
+
+static const struct at_cmd at_cmds[] = {
+#define AT_CMD(match, pattern, handler) { handler, { NULL, 0 }, sizeof(pattern) - 1 },
+#define AT_RSP(match, pattern, line) { at_rsp, AT_BLOB(AT_LINE(line)), sizeof(pattern) - 1 },
+#include "at_cmds.h"
+#undef AT_CMD
+#undef AT_RSP
+};
+
+/* handlers a profile can refer to by name */
+static const struct {
+	const char *name;
+	at_handler_t fn;
+} at_handlers[] = {
+#define AT_CMD(match, pattern, handler) { #handler, handler },
+#define AT_RSP(match, pattern, line)
+#include "at_cmds.h"
+#undef AT_CMD
+#undef AT_RSP
+};
+
+_Static_assert(PROFILE_NET_MODES == NET_MODE_MAX && PROFILE_CPMS == CPMS_MAX,
+		"profile states do not match the session states");
+
+/*
+ * A mapped profile image and what cannot be used from the image directly.
+ *
+ * Every thread serving sessions has its own active profile, at_prof, so
+ * lookups take no lock and a reload swaps a single pointer in each thread
+ * (see at_profile_use()). A replaced profile stays mapped while sessions
+ * hold it: a session takes a reference when a reply of the profile is
+ * queued or deferred and drops it once the reply has been written and its
+ * thread has moved on to another profile.
+ */
+struct at_profile {
+	struct profile img;
+	int refs;			/* threads and sessions holding it */
+	struct at_cmd *cmds;		/* handler commands */
+	int *stat_id;			/* built-in command id for the statistics */
+	const struct at_step **steps;	/* delayed part of each reply, NULL if none */
+};
+
+static __thread struct at_profile *at_prof;
+
+static void at_profile_free(struct at_profile *p)
+{
+	int i;
+
+	if (p->steps) {
+		for (i = 0; i < (int)p->img.hdr->ncmds * PROFILE_STATES; i++)
+			free((void *)p->steps[i]);
+	}
+	free(p->steps);
+	free(p->stat_id);
+	free(p->cmds);
+	profile_close(&p->img);
+	free(p);
+}
+
+void at_profile_hold(struct at_profile *p)
+{
+	__atomic_add_fetch(&p->refs, 1, __ATOMIC_RELAXED);
+}
+
+void at_profile_put(struct at_profile *p)
+{
+	if (__atomic_sub_fetch(&p->refs, 1, __ATOMIC_ACQ_REL) == 0)
+		at_profile_free(p);
+}
+
+/* the steps played from a timer: all of them unless the first is immediate */
+static const struct at_step *at_profile_steps(const struct profile *img,
+		const struct profile_reply *r)
+{
+	struct at_step *steps;
+	uint32_t i, first;
+
+	first = r->step[0].delay_ms ? 0 : 1;
+	if (first == r->nsteps) return NULL;
+
+	steps = calloc(r->nsteps - first + 1, sizeof(*steps));
+	if (steps == NULL) return NULL;
+
+	for (i = first; i < r->nsteps; i++) {
+		steps[i - first].delay_ms = r->step[i].delay_ms;
+		steps[i - first].line = profile_str(img, r->step[i].text);
+		steps[i - first].len = r->step[i].len;
+	}
+
+	return steps;
+}
+
+struct at_profile *at_profile_open(const char *path)
+{
+	struct at_profile *p;
+	const struct profile_cmd *pc;
+	const struct profile_reply *r;
+	const char *pattern;
+	int i, j, n, id;
+
+	p = calloc(1, sizeof(*p));
+	if (p == NULL) return NULL;
+
+	if (profile_open(&p->img, path) < 0) {
+		free(p);
+		return NULL;
+	}
+
+	n = p->img.hdr->ncmds;
+	p->cmds = calloc(n ? n : 1, sizeof(*p->cmds));
+	p->stat_id = calloc(n ? n : 1, sizeof(*p->stat_id));
+	p->steps = calloc(n ? n * PROFILE_STATES : 1, sizeof(*p->steps));
+	if (p->cmds == NULL || p->stat_id == NULL || p->steps == NULL)
+		goto nomem;
+
+	for (i = 0; i < n; i++) {
+		pc = &p->img.cmds[i];
+		pattern = profile_str(&p->img, p->img.tab.pattern_off[i]);
+
+		id = at_lookup(pattern, p->img.tab.pattern_len[i]);
+		p->stat_id[i] = (id >= 0 && !strcasecmp(at_name(id), pattern)) ? id : -1;
+
+		p->cmds[i].plen = p->img.tab.pattern_len[i];
+		if (pc->handler) {
+			for (j = 0; j < (int)(sizeof(at_handlers) / sizeof(at_handlers[0])); j++)
+				if (!strcmp(at_handlers[j].name, profile_str(&p->img, pc->handler))) break;
+			if (j == (int)(sizeof(at_handlers) / sizeof(at_handlers[0]))) {
+				at_profile_free(p);
+				errno = ENOENT;
+				return NULL;
+			}
+			p->cmds[i].fn = at_handlers[j].fn;
+			continue;
 		}
-	} else if (!strcasecmp(line, "AT+QENG=\"neighbourcell\"")) {
-		if (net_mode == NET_MODE_AUTO) {
-			tty_write_line("+QENG: \"neighbourcell intra\",\"LTE\",6300,319,-102,-10,26,1,7,-,-,-,-");
-			tty_write_line("+QENG: \"neighbourcell inter\",\"LTE\",100,183,-131,-24,0,-13,255,-1,-1,16");
-		} else if (net_mode == NET_MODE_NR) {
-			tty_write_line("+QENG: \"neighbourcell\",\"NR\",529950,170,-88,-6,7,32");
-		} else if (net_mode == NET_MODE_LTE) {
-			tty_write_line("+QENG: \"neighbourcell intra\",\"LTE\",300,118,-11,-11,17,1,1,-,-,-,-");
-			tty_write_line("+QENG: \"neighbourcell inter\",\"LTE\",6200,297,-106,-16,0,2,255,-1,-1,16");
-			tty_write_line("+QENG: \"neighbourcell inter\",\"LTE\",1600,183,-110,-15,0,-2,255,-1,-1,16");
+
+		for (j = 0; j < PROFILE_STATES; j++) {
+			r = profile_reply(&p->img, pc->reply[j]);
+			if (r->nsteps == 1 && !r->step[0].delay_ms) continue;
+			p->steps[i * PROFILE_STATES + j] = at_profile_steps(&p->img, r);
+			if (p->steps[i * PROFILE_STATES + j] == NULL) goto nomem;
 		}
-	} else if (!strcasecmp(line, "AT+QTEMP")) {
-		tty_write_line("+QTEMP: \"soc-thermal\",\"36\"");
-		tty_write_line("+QTEMP: \"pa-thermal\",\"36\"");
-		tty_write_line("+QTEMP: \"pa5g-thermal\",\"36\"");
-	} else if (!strcasecmp(line, "AT+QCAINFO")) {
-		if (net_mode == NET_MODE_AUTO) {
-			tty_write_line("+QCAINFO: \"PCC\",6300,50,\"LTE BAND 20\",1,319,-103,-9,-76,8");
-			tty_write_line("+QCAINFO: \"SCC\",100,100,\"LTE BAND 1\",1,372,-111,-13,-,6");
-			tty_write_line("+QCAINFO: \"SCC\",372750,20,\"NR N3\",2,431,-108,-7,-89,7");
-		} else if (net_mode == NET_MODE_NR) {
-			tty_write_line("+QCAINFO: \"PCC\",504990,100,\"NR N41\",1,808,-71,0,-57,26");
-		} else if (net_mode == NET_MODE_LTE) {
-			tty_write_line("+QCAINFO: \"PCC\",300,100,\"LTE BAND 1\",1,118,-108,-10,-79,3");
-			tty_write_line("+QCAINFO: \"SCC\",6300,50,\"LTE BAND 20\",1,319,-103,-9,-76,8");
-		} else if (net_mode == NET_MODE_UMTS) {
-			;
+	}
+
+	p->refs = 1;
+
+	return p;
+
+nomem:
+	at_profile_free(p);
+	errno = ENOMEM;
+	return NULL;
+}
+
+void at_profile_use(struct at_profile *p)
+{
+	struct at_profile *old = at_prof;
+
+	/* lookups see the new profile from now on, sessions let go of the old */
+	at_prof = p;
+	if (old) at_profile_put(old);
+}
+
+static int at_profile_run(struct session *s, struct at_profile *p, int id,
+		const char *line, size_t len)
+{
+	const struct profile_reply *r;
+	const struct at_step *steps;
+	const char *text;
+	size_t n;
+	int state;
+
+	if (p->cmds[id].fn) return p->cmds[id].fn(s, line, len, &p->cmds[id]);
+
+	if (s->prof != p) {
+		if (s->prof) at_profile_put(s->prof);
+		at_profile_hold(p);
+		s->prof = p;
+	}
+
+	state = profile_state(s->net_mode, s->cpms);
+	r = profile_reply(&p->img, p->img.cmds[id].reply[state]);
+	steps = p->steps[id * PROFILE_STATES + state];
+	if (!r->step[0].delay_ms) {
+		text = profile_str(&p->img, r->step[0].text);
+		n = r->step[0].len;
+		/* a complete reply closes with its OK, see at_reply() */
+		if (!steps && at_more(s) && n >= AT_OK_LEN &&
+				at_is_ok(text + n - AT_OK_LEN, AT_OK_LEN) &&
+				(n == AT_OK_LEN || text[n - AT_OK_LEN - 1] == '\r'))
+			n -= AT_OK_LEN;
+		tty_write_ref(s, text, n);
+	}
+
+	if (steps) at_defer(s, steps);
+
+	return AT_NONE;
+}
+
+void at_session_written(struct session *s)
+{
+	/* a listing is complete once it has been sent */
+	if (s->cmgl.done) {
+		s->cmgl.st = NULL;
+		s->cmgl.done = 0;
+		at_ok(s);
+		at_cl_run(s);
+		if (!session_busy(s)) stats_reply(s);
+		s->kick(s);
+	}
+
+	/* held URCs go out as soon as the queue has room again */
+	urc_flush(s);
+
+	if (outq_empty(&s->q)) at_session_release(s);
+}
+
+void at_session_release(struct session *s)
+{
+	if (s->prof == NULL || s->prof == at_prof || session_busy(s) || !outq_empty(&s->q))
+		return;
+
+	at_profile_put(s->prof);
+	s->prof = NULL;
+}
+
+/* run one command, returns what its handler did */
+static int at_command(struct session *s, const char *line, size_t len)
+{
+	struct at_profile *p;
+	int id, r;
+
+	/* commands of the profile take precedence */
+	p = at_prof;
+	id = p ? at_lookup_in(&p->img.tab, line, len) : -1;
+	if (id >= 0) {
+		s->lat.cmd = p->stat_id[id];
+		r = at_profile_run(s, p, id, line, len);
+	} else {
+		id = at_lookup(line, len);
+		s->lat.cmd = id;
+		if (id < 0) {
+			tty_write_str(s, "ERROR");
+			r = AT_ERROR;
+		} else {
+			r = at_cmds[id].fn(s, line, len, &at_cmds[id]);
 		}
-	} else if (!strcasecmp(line, "AT+QANTRSSI?")) {
-		if (net_mode == NET_MODE_AUTO || net_mode == NET_MODE_NR) {
-			tty_write_line("+QANTRSSI: 1,-,-59,-,-58,-56,-53");
-		} else if (net_mode == NET_MODE_LTE) {
-			tty_write_line("+QANTRSSI: 2,-74,-79");
-		} else if (net_mode == NET_MODE_UMTS) {
-			;
+	}
+
+	/* an error ends the line, so does a command taking over the input */
+	if (r == AT_ERROR || s->waitPdu || s->cmux_n1) s->cl_pos = s->cl_len;
+	if (r == AT_OK) at_ok(s);
+
+	return r;
+}
+
+/* the line as a whole is a command, e.g. ATI;+CSUB */
+static int at_whole(const char *line, size_t len)
+{
+	struct at_profile *p = at_prof;
+	int id;
+
+	id = p ? at_lookup_in(&p->img.tab, line, len) : -1;
+	if (id >= 0) return p->cmds[id].plen == len;
+
+	id = at_lookup(line, len);
+	return id >= 0 && at_cmds[id].plen == len;
+}
+
+/* past blanks left between commands and the ; after one */
+static void at_cl_skip(struct session *s)
+{
+	while (at_more(s) && s->cl[s->cl_pos] == ';')
+		s->cl_pos++;
+}
+
+/*
+ * Take a line of several commands into the session, 0 if it is run as a
+ * single command. Blanks outside strings carry no meaning and are dropped.
+ */
+static int at_cl_start(struct session *s, const char *line, size_t len)
+{
+	int quoted = 0;
+	size_t i;
+
+	if (len < 2 || at_fold(line[0]) != 'a' || at_fold(line[1]) != 't' ||
+			at_whole(line, len))
+		return 0;
+
+	s->cl_len = 0;
+	for (i = 2; i < len; i++) {
+		if (line[i] == '"') quoted = !quoted;
+		if (line[i] != ' ' || quoted) s->cl[s->cl_len++] = line[i];
+	}
+	s->cl_pos = 0;
+	at_cl_skip(s);
+
+	return 1;
+}
+
+/*
+ * The next command of the line as AT<command> into cmd, NUL terminated;
+ * returns its length, 0 if the line does not parse. An extended command
+ * (+CSQ, *CELL=0, ...) runs up to the next ; outside a string, a basic
+ * one is a letter, optionally after &, with an optional = or ? and a
+ * number (E0, &F, S0=1, S7?), D dials the rest of the line.
+ */
+static size_t at_cl_next(struct session *s, char *cmd)
+{
+	const char *p = s->cl + s->cl_pos, *end = s->cl + s->cl_len;
+	int quoted = 0;
+	size_t n = 2;
+	char c;
+
+	cmd[0] = 'A';
+	cmd[1] = 'T';
+
+	c = at_fold(*p);
+	if (strchr("+*^$%#", c)) {
+		for (; p < end && (quoted || *p != ';'); p++) {
+			if (*p == '"') quoted = !quoted;
+			cmd[n++] = *p;
 		}
-	} else if (!strcasecmp(line, "AT+QNWPREFCFG=?")) {
-		tty_write_line("+QNWPREFCFG: \"mode_pref\",AUTO:WCDMA:LTE:NR5G:NR5G-SA:NR5G-NSA");
-		tty_write_line("+QNWPREFCFG: \"gw_band\",1:2:5:8");
-		tty_write_line("+QNWPREFCFG: \"lte_band\",1:2:3:4:5:7:8:20:28:38:40:41:66");
-		tty_write_line("+QNWPREFCFG: \"nr5g_band\",1:3:5:7:8:20:28:38:40:41:66:77:78");
-		tty_write_line("+QNWPREFCFG: \"all_band_reset\"");
-		tty_write_line("+QNWPREFCFG: \"srv_domain\",(0-2)");
-		tty_write_line("+QNWPREFCFG: \"voice_domain\",(0-3)");
-		tty_write_line("+QNWPREFCFG: \"ue_usage_setting\",(0,1)");
-		tty_write_line("+QNWPREFCFG: \"roam_pref\",(0-3)");
-		tty_write_line("+QNWPREFCFG: \"cell_blacklist\",(1-3),(0-15),<freq-pci list>");
-		tty_write_line("+QNWPREFCFG: \"mode_blacklist\",(0-5)");
-		tty_write_line("+QNWPREFCFG: \"rat_acq_order\",NR5G:LTE:WCDMA");
-		tty_write_line("+QNWPREFCFG: \"nr5g_band_blacklist\",(0,1),<nr5g_band_blacklist>");
-	} else if (!strncasecmp(line, "AT+QNWPREFCFG=\"mode_pref\",", 26)) {
-		if (!strcmp(line + 26, "WCDMA")) {
-			net_mode = NET_MODE_UMTS;
-		} else if (!strcmp(line + 26, "LTE")) {
-			net_mode = NET_MODE_LTE;
-		} else if (!strcmp(line + 26, "NR5G")) {
-			net_mode = NET_MODE_NR;
+	} else if (c == 'd') {
+		while (p < end)
+			cmd[n++] = *p++;
+	} else {
+		if (c == '&') cmd[n++] = *p++;
+		if (p == end || !isalpha((unsigned char)*p)) return 0;
+		c = at_fold(*p);
+		cmd[n++] = *p++;
+		if (c == 's') {
+			while (p < end && isdigit((unsigned char)*p))
+				cmd[n++] = *p++;
 		}
-	} else if (!strncasecmp(line, "AT+QNWPREFCFG=", 14)) {
-		;
-	} else if (!strncasecmp(line, "AT+CNMP=", 8)) {
-		if (!strcmp(line + 8, "14")) {
-			net_mode = NET_MODE_UMTS;
+		if (p < end && (*p == '=' || *p == '?')) cmd[n++] = *p++;
+		while (p < end && isdigit((unsigned char)*p))
+			cmd[n++] = *p++;
+	}
+	cmd[n] = '\0';
+
+	s->cl_pos = p - s->cl;
+	at_cl_skip(s);
+
+	return n;
+}
+
+/*
+ * Run the commands left on the line in turn until one defers its reply or
+ * holds the session; at_step_cb() and at_session_written() go on with the
+ * rest once it is done. Only the last command closes with OK, so the line
+ * gets a single final result. A line of several commands is timed as a
+ * whole, under (other).
+ */
+static void at_cl_run(struct session *s)
+{
+	char cmd[TTY_RD_SZ + 3];
+	size_t n;
+
+	while (at_more(s) && !session_busy(s)) {
+		n = at_cl_next(s, cmd);
+		if (!n) {
+			s->cl_pos = s->cl_len;
+			tty_write_str(s, "ERROR");
+			break;
 		}
-	} else if (!strcasecmp(line, "AT+CNMI?")) {
-		tty_write_line("+CNMI: 2,1,1,1,1");
-	} else if (!strncasecmp(line, "AT+CPMS=\"SM\"",12)) {
-		cpms = CPMS_SM;
-		tty_write_line("+CPMS: 1,5,1,5,1,5");
-	} else if (!strncasecmp(line, "AT+CPMS=\"ME\"",12)) {
-		cpms = CPMS_ME;
-		tty_write_line("+CPMS: 37,200,37,200,37,200");
-	} else if (!strcasecmp(line, "AT+CPMS?")) {
-		if (cpms == CPMS_SM) {
-			tty_write_line("+CPMS: \"SM\",1,5,\"ME\",37,200,\"ME\",37,200");
+		at_command(s, cmd, n);
+		s->lat.cmd = -1;
+	}
+}
+
+void at_read_line_cb(struct session *s, const char *line, size_t len)
+{
+	char cmd[TTY_RD_SZ + 3];
+	size_t pos, n;
+
+	if (s->echo)
+	{
+		tty_write_line(s, line, len);
+	}
+
+	/* a line that is not a command as a whole may be several, ATE0V1 */
+	if (at_cl_start(s, line, len)) {
+		pos = s->cl_pos;
+		n = at_more(s) ? at_cl_next(s, cmd) : 0;
+		if (n && !at_more(s)) {
+			/* one command after all, e.g. AT+CFUN=1, timed as itself */
+			at_command(s, cmd, n);
+		} else if (pos == s->cl_len) {
+			at_command(s, "AT", 2);	/* nothing but blanks */
 		} else {
-			tty_write_line("+CPMS: \"ME\",37,200,\"ME\",37,200,\"ME\",37,200");
+			s->cl_pos = pos;
+			at_cl_run(s);
 		}
-	} else if (!strcasecmp(line, "AT+CMGL=4")) {
-		if (cpms == CPMS_ME) {
-			tty_write_line("+CMGL: 0,1,,160");
-			tty_write_line("07919762020041F7400DD0CDF2396C7CBB010008223081916324218C05000303030100310039002E00300033002E003200300032003200200432002000310039003A00330036002004370430043F043B0430043D04380440043E04320430043D043E00200441043F043804410430043D043804350020043F043B04300442044B0020043F043E00200442043004400438044404430020201300200037003000300020044004430431");
-			tty_write_line("+CMGL: 1,1,,160");
-			tty_write_line("07919762020041F7400DD0CDF2396C7CBB010008223081916324218C050003030302002E000A041D04300441043B04300436043404300439044204350441044C0020043E043104490435043D04380435043C0020002D002004340435043D043504330020043D043000200441044704350442043500200434043E0441044204300442043E0447043D043E002E041204300448002004310430043B0430043D0441003A002000390039");
-			tty_write_line("+CMGL: 2,1,,108");
-			tty_write_line("07919762020041F7440DD0CDF2396C7CBB01000822308191632421580500030303030031002E003200370020044004430431002E000A000A041F043E043F043E043B043D04380442044C00200441044704350442003A0020007000610079002E006D0065006700610066006F006E002E00720075");
-			tty_write_line("+CMGL: 3,1,,160");
-			tty_write_line("07919762020041F7400DD0CDF2396C7CBB010008223091916324218C0500031104010421043F043804410430043D043E00200037003000300020044004430431002E0020043F043E00200442043004400438044404430020002204170430043A04300447043004390441044F00210020041B04350433043A043E00220020043704300020043F043504400438043E043400200441002000310039002E00300033002E003200300032");
-			tty_write_line("+CMGL: 4,1,,160");
-			tty_write_line("07919762020041F7400DD0CDF2396C7CBB010008223091916324218C05000311040200320020043F043E002000310038002E00300034002E0032003000320032002E000A000A0418043D044204350440043D043504420020043D043000200441043A043E0440043E04410442043800200434043E0020003200350020041C043104380442002F044100200431044304340435044200200434043E044104420443043F0435043D0020");
-			tty_write_line("+CMGL: 5,1,,160");
-			tty_write_line("07919762020041F7400DD0CDF2396C7CBB010008223091916324218C0500031104030434043E00200441043B043504340443044E044904350433043E00200441043F043804410430043D0438044F0020043F043E0020044204300440043804440443002000310038002E00300034002E0032003000320032002E0020000A000A041F043E043F043E043B043D04380442044C002004310430043B0430043D0441003A002000700061");
-			tty_write_line("+CMGL: 6,1,,50");
-			tty_write_line("07919762020041F7440DD0CDF2396C7CBB010008223091916324211E0500031104040079002E006D0065006700610066006F006E002E00720075");
-			tty_write_line("+CMGL: 7,1,,160");
-			tty_write_line("07919762020041F7600DD0CDF2396C7CBB010008224031718101218C050003C407010421002004430441043B04430433043E0439002000AB0414043E043F043E043B043D043804420435043B044C043D044B04390020043D043E043C0435044000BB00200412044B0020043C043E04360435044204350020043F043E0434043A043B044E044704380442044C0020043D043000200412043004480443002000530049004D002D043A");
-			tty_write_line("+CMGL: 8,1,,160");
-			tty_write_line("07919762020041F7600DD0CDF2396C7CBB010008224031718101218C050003C407020430044004420443002004350449043500200434043E00200033002D04450020043D043E043C04350440043E0432002E0020041804450020043C043E0436043D043E002004380441043F043E043B044C0437043E043204300442044C002C0020043A043E04330434043000200412044B0020043D043500200445043E04420438044204350020");
-			tty_write_line("+CMGL: 9,1,,160");
-			tty_write_line("07919762020041F7600DD0CDF2396C7CBB010008224031718101218C050003C40703043E0441044204300432043B044F0442044C002004410432043E04390020043E0441043D043E0432043D043E04390020043D043E043C04350440002C0020043D0430043F04400438043C04350440002C00200434043B044F002004410432044F0437043800200441043E00200441043B0443043604310430043C043800200434043E04410442");
-			tty_write_line("+CMGL: 10,1,,160");
-			tty_write_line("07919762020041F7600DD0CDF2396C7CBB010008224031718101218C050003C4070404300432043A0438002C00200438043D044204350440043D043504420020043C04300433043004370438043D0430043C0438002004380020043C0430043B043E0437043D0430043A043E043C044B043C04380020043B044E0434044C043C0438002E000A04170432043E043D043804420435002004380020043E0442043F044004300432043B");
-			tty_write_line("+CMGL: 11,1,,160");
-			tty_write_line("07919762020041F7600DD0CDF2396C7CBB010008224031718101218C050003C40705044F04390442043500200053004D00530020043F043E002004430441043B043E04320438044F043C0020043E0441043D043E0432043D043E0433043E0020044204300440043804440430002E002004210442043E0438043C043E04410442044C0020043F043E0434043A043B044E04470435043D0438044F00200434043E043F043E043B043D");
-			tty_write_line("+CMGL: 12,1,,160");
-			tty_write_line("07919762020041F7600DD0CDF2396C7CBB010008224031718101218C050003C40706043804420435043B044C043D043E0433043E0020043D043E043C043504400430002020140020003300300020044004430431043B04350439002E00200415043604350434043D04350432043D0430044F0020043F043B04300442043000202014002000320020044004430431043B044F00200432002004340435043D044C002E0020041F043E");
-			tty_write_line("+CMGL: 13,1,,156");
-			tty_write_line("07919762020041F7640DD0CDF2396C7CBB0100082240317181012188050003C407070434043A043B044E044704380442044C002000680074007400700073003A002F002F006C006B002E006D0065006700610066006F006E002E00720075002F0069006E006100700070002F006100640064006900740069006F006E0061006C004E0075006D006200650072007300200438043B04380020002A0034003800310023000A");
-			tty_write_line("+CMGL: 14,1,,27");
-			tty_write_line("07919762020041F7040B919781314259F800084290526173402108041E043A04300439");
-			tty_write_line("+CMGL: 24,1,,159");
-			tty_write_line("07919762020041F7440B919780314257F8000842211131754421880500033B0701041F04400435043404320438043604430020043204410435003A00200432043004410020043E0441043A043E0440043104380442000A041F043504470430043B044C043D043E04390020044204300439043D044B0020043E0431044A044F0441043D0435043D044C0435002E000A041A0430043A043E043500200433043E0440044C");
-			tty_write_line("+CMGL: 25,1,,159");
-			tty_write_line("07919762020041F7440B919780314257F80008422111317545218C0500033B0702043A043E04350020043F04400435043704400435043D044C0435000A04120430044800200433043E04400434044B04390020043204370433043B044F0434002004380437043E0431044004300437043804420021000A042704350433043E00200445043E04470443003F002004410020043A0430043A043E044E002004460435043B044C044E");
-			tty_write_line("+CMGL: 26,1,,159");
-			tty_write_line("07919762020041F7440B919780314257F80008422111317555218C0500033B0703000A041E0442043A0440043E044E00200434044304480443002004320430043C002004410432043E044E003F000A041A0430043A043E043C044300200437043B043E0431043D043E043C044300200432043504410435043B044C044E002C000A0411044B0442044C0020043C043E043604350442002C0020043F043E0432043E04340020043F");
-			tty_write_line("+CMGL: 27,1,,159");
-			tty_write_line("07919762020041F7440B919780314257F80008422111317575218C0500033B0704043E04340430044E0021000A0421043B0443044704300439043D043E00200432043004410020043A043E043304340430002D0442043E0020043204410442044004350442044F002C000A04120020043204300441002004380441043A044004430020043D04350436043D043E044104420438002004370430043C04350442044F002C000A042F");
-			tty_write_line("+CMGL: 28,1,,159");
-			tty_write_line("07919762020041F7440B919780314257F80008422111317585218C0500033B07050020043504390020043F043E04320435044004380442044C0020043D04350020043F043E0441043C0435043B003A000A041F044004380432044B0447043A04350020043C0438043B043E04390020043D0435002004340430043B00200445043E04340443003B000A04210432043E044E0020043F043E04410442044B043B0443044E00200441");
-			tty_write_line("+CMGL: 29,1,,159");
-			tty_write_line("07919762020041F7440B919780314257F80008422111317595218C0500033B07060432043E0431043E04340443000A042F0020043F043E044204350440044F0442044C0020043D04350020043704300445043E04420435043B002E000A0415044904350020043E0434043D043E0020043D043004410020044004300437043B044304470438043B043E002E002E002E000A041D043504410447043004410442043D043E04390020");
-			tty_write_line("+CMGL: 30,1,,57");
-			tty_write_line("07919762020041F7440B919780314257F8000842211131850021260500033B070704360435044004420432043E04390020041B0435043D0441043A043804390020");
-		} else
-		{
-			tty_write_line("+CMGL: 0,1,,67");
-			tty_write_line("07919731899699F3040b919780514257f800085210223250138230042d0442043e0442002004300431043e043d0435043d0442002004370432043e043d0438043b002004320430043c002e");
-		}
-	} else if (!strcasecmp(line, "AT+CMGF?")) {
-		tty_write_line("+CMGF: 0");
-	} else if (!strncasecmp(line, "AT+CUSD=1,", 10)) {
-		enqueueUssd = 1;
-		sleep(1);
-	} else if (!strncasecmp(line, "AT+CMGS=", 8)) {
-		waitPdu = 1;
-		return;
-	} else if (!strcasecmp(line, "AT+QSCAN=1")) { // 4G
-		sleep(1);
-		tty_write_line("+QSCAN: 3-26"
-			"-197963829,394,100,-8818,-1256,250,20,2,27864,3,1,1,275"
-			"-3979275,235,1802,-10056,-1381,250,1,2,17758,5,3,3,250"
-			"-26549576,0,2850,-9006,-912,250,2,2,9738,5,3,7,1375"
-			"-26549576,0,2850,-9006,-912,250,11,2,9738,5,1,7,1375"
-			"-26549676,0,3048,-9893,-1062,250,2,2,9738,5,3,7,1925"
-			"-26549676,0,3048,-9893,-1062,250,11,2,9738,5,1,7,1925"
-			"-197963798,370,3400,-10568,-2000,250,20,2,27864,3,1,7,-1275"
-			"-3979265,298,3200,-10575,-1668,250,1,2,17758,3,3,7,-1125"
-			"-130237446,212,3300,-11012,-1293,250,99,2,1277,3,2,7,-75"
-			"-199022880,334,38752,-10125,-1437,250,20,2,27864,5,1,40,450"
-			"-199022883,229,39550,-9812,-1225,250,20,2,27864,3,1,40,-1500"
-			"-26549536,200,1602,-9375,-1337,250,2,2,9738,5,3,3,1625"
-			"-26549536,200,1602,-9375,-1337,250,11,2,9738,5,1,3,1625"
-			"-3979276,374,1802,-10112,-1562,250,1,2,17758,5,3,3,-225"
-			"-197963799,120,3400,-9806,-1750,250,20,2,27864,3,1,7,-550"
-			"-130237445,132,3300,-10837,-1100,250,99,2,1277,3,2,7,250"
-			"-197963859,470,6200,-8687,-1206,250,20,2,27864,3,1,20,650"
-			"-130237448,306,1301,-10487,-1256,250,99,2,1277,5,2,3,375"
-			"-26549516,20,225,-9312,-718,250,2,2,9738,4,3,1,1875"
-			"-26549516,20,225,-9312,-718,250,11,2,9738,4,1,1,1875"
-			"-199022881,341,38752,-9593,-1225,250,20,2,27864,5,1,40,25"
-			"-26549636,200,1458,-9681,-1287,250,2,2,9738,3,3,3,1675"
-			"-26549636,200,1458,-9681,-1287,250,11,2,9738,3,1,3,1675"
-			"-1013792,327,375,-12212,-1743,250,1,2,17758,4,3,1,-600"
-			"-128005223,330,525,-12462,-1781,250,99,2,1277,4,2,1,-450"
-			"-26474793,406,37900,-12918,-1800,250,2,2,9758,5,3,38,-925"
-			"-26474793,406,37900,-12918,-1800,250,11,2,9758,5,1,38,-925"
-			"-1013832,434,38100,-12606,-1650,250,1,2,17758,5,3,38,-525"
-			"-199022884,278,39550,-10443,-1362,250,20,2,27864,3,1,40,250"
-			"-249532211,268,100,-10481,-1843,250,20,2,27864,3,1,1,-950"
-			"-3979266,296,3200,-11318,-1725,250,1,2,17758,3,3,7,-400"
-			"-197963828,393,100,-8862,-693,250,20,2,27864,3,1,1,150");
-		tty_write_line("+QSCAN: 254");
-		return;
-	} else if (!strcasecmp(line, "AT+QSCAN=2")) { // 5G
-		sleep(1);
-		tty_write_line("+QSCAN: 4-7"
-			"-2573795420,498,641280,-9425,-1075,250,2,2,49914,1,80,78,531,"
-				"4,0,0,0,\"\",\"\""
-			"-22016524410,473,631296,-8325,-956,250,3,2,3279616,1,20,78,2387,"
-				"6,0,0,0,\"\",\"\""
-			"-22016524400,473,632640,-9600,-975,250,3,2,3279616,1,100,78,1543,"
-				"5,0,0,0,\"\",\"\""
-			"-2574532700,884,641280,-9837,-1181,250,2,2,49906,1,80,78,318,"
-				"0,0,0,0,\"\",\"\""
-			"-18064655858,679,644640,-9300,-1337,250,1,2,10684034,1,40,78,-37,"
-				"1,0,0,0,\"\",\"\""
-			"-18063574513,406,650976,-9681,-1125,250,1,2,10684034,1,100,78,418,"
-				"1,0,0,0,\"\",\"\""
-			"-18063574514,406,644640,-9175,-1037,250,1,2,10684034,1,40,78,731,"
-				"1,0,0,0,\"\",\"\"");
-		tty_write_line("+QSCAN: 254");
-		return;
-	} else if (!strcasecmp(line, "AT+QSCAN=3")) { // 3G
-		sleep(1);
-		tty_write_line("+QSCAN: 1-4"
-			"-10387651,10563,475,17,-8,250,20,2,27864,1,1"
-			"-0,10563,28,14,-21,250,20,2,27864,1,1"
-			"-0,10563,359,13,-27,250,20,2,27864,1,1"
-			"-6646701,10687,423,16,-5,250,2,2,9746,1,1");
-		tty_write_line("+QSCAN: 254");
-		return;
-	} else
-	{
-		tty_write_line("ERROR");
 		return;
 	}
 
-	tty_write_line("OK");
+	at_command(s, line, len);
 }
@@ -1,6 +1,31 @@
 #ifndef __AT_H
 #define __AT_H
 
-extern void at_read_line_cb(const char *line);
+#include <stddef.h>
+
+struct session;
+struct ev_loop;
+struct at_profile;
+
+extern void at_session_init(struct session *s, struct ev_loop *loop);
+/* line is len bytes long and NUL terminated */
+extern void at_read_line_cb(struct session *s, const char *line, size_t len);
+/* map a compiled profile (see profile.h), NULL with errno set */
+extern struct at_profile *at_profile_open(const char *path);
+extern void at_profile_hold(struct at_profile *p);
+extern void at_profile_put(struct at_profile *p);
+/*
+ * serve the commands of p in the calling thread from now on, in place of
+ * its current profile; takes over the caller's reference
+ */
+extern void at_profile_use(struct at_profile *p);
+/* stop what the session has in progress and let go of its storages */
+extern void at_session_close(struct session *s);
+/* output was written: finish a listing, send held URCs, let go of a replaced profile */
+extern void at_session_written(struct session *s);
+/* let go of a replaced profile nothing refers to anymore */
+extern void at_session_release(struct session *s);
+/* ME storage size, messages to fill it with and directory to keep it in */
+extern void at_sms_setup(unsigned me_slots, unsigned fill, const char *dir);
 
 #endif /* __AT_H */
@@ -0,0 +1,119 @@
+/*
+ * AT command table, expanded by at.c (handlers), atdisp.c and atgen.c (the
+ * dispatcher lookup tables) with their own AT_CMD/AT_RSP definitions, so it
+ * has no include guard.
+ *
+ * AT_CMD(match, pattern, handler)  run handler for the command
+ * AT_RSP(match, pattern, line)     reply with a single line followed by OK
+ *
+ * match is EXACT (whole line) or PREFIX (line starts with pattern); both are
+ * case insensitive. Exact matches take precedence, then the longest prefix.
+ */
+
+AT_CMD(EXACT, "AT", at_nop)
+AT_CMD(EXACT, "AT+CMEE=1", at_nop)
+AT_CMD(PREFIX, "AT+CFUN=", at_nop)
+AT_CMD(EXACT, "AT+CREG=0", at_nop)
+AT_CMD(EXACT, "AT+CEREG=0", at_nop)
+AT_CMD(EXACT, "AT+C5GREG=0", at_nop)
+AT_CMD(EXACT, "AT+DIALMODE=0", at_nop)
+AT_CMD(EXACT, "AT+CNETCI=0", at_nop)
+AT_CMD(EXACT, "AT+CNMI=2,1", at_nop)
+AT_CMD(EXACT, "AT+USBNETIP=1", at_nop)
+AT_CMD(PREFIX, "AT+CNBP=", at_nop)
+AT_CMD(PREFIX, "AT+CGDCONT=1,", at_nop)
+AT_CMD(PREFIX, "AT+ZGDCONT=1,", at_nop)
+AT_CMD(PREFIX, "AT+CGAUTH=", at_nop)
+AT_CMD(PREFIX, "AT+AUTOAPN=", at_nop)
+AT_CMD(EXACT, "AT+CMGF=0", at_nop)
+AT_CMD(EXACT, "AT+COPS=2", at_nop)
+AT_CMD(EXACT, "AT*CELL=0", at_nop)
+AT_CMD(EXACT, "AT+CGACT=1,1", at_nop)
+AT_CMD(EXACT, "AT+CGACT=0", at_nop)
+AT_CMD(EXACT, "AT+CGATT=0", at_nop)
+AT_CMD(EXACT, "AT+ZGACT=1,1", at_nop)
+AT_CMD(EXACT, "AT+COPS=3,0", at_nop)
+AT_CMD(EXACT, "AT+QCFG=\"autoapn\",0", at_nop)
+AT_CMD(PREFIX, "AT+QCFG=\"ims\",", at_nop)
+AT_CMD(PREFIX, "AT+QNWLOCK=", at_nop)
+AT_CMD(EXACT, "AT+QSIMDET=1,1", at_nop)
+AT_CMD(EXACT, "AT+QIACT=1", at_nop)
+AT_CMD(EXACT, "AT+QNETDEVCTL=1,1,1", at_nop)
+AT_CMD(PREFIX, "AT+CGPIAF=", at_nop)
+AT_CMD(PREFIX, "AT+QICSGP=", at_nop)
+AT_CMD(PREFIX, "AT+CSCS=\"", at_nop)
+AT_CMD(EXACT, "ATZ", at_nop)
+AT_CMD(EXACT, "AT&F", at_nop)
+AT_CMD(EXACT, "ATV1", at_nop)
+AT_CMD(EXACT, "ATQ0", at_nop)
+AT_CMD(EXACT, "ATE1", at_echo_on)
+AT_CMD(EXACT, "ATE0", at_echo_off)
+AT_CMD(EXACT, "ATI", at_ati)
+AT_CMD(EXACT, "AT+SIMCOMATI", at_simcomati)
+AT_CMD(EXACT, "ATI;+CSUB", at_ati_csub)
+AT_RSP(EXACT, "AT+GSN", IMEI_)
+AT_RSP(EXACT, "AT+CGMR", "+CGMR: " FW_VERSION_)
+AT_RSP(EXACT, "AT+QGMR", FW_VERSION_)
+AT_RSP(EXACT, "AT+CMEE?", "+CMEE: 1")
+AT_RSP(EXACT, "AT+CSUB", "+CSUB: " SUBEDITION_)
+AT_RSP(EXACT, "AT+UIMHOTSWAPLEVEL?", "+UIMHOTSWAPLEVEL: 1")
+AT_RSP(EXACT, "AT+UIMHOTSWAPON?", "+UIMHOTSWAPON: 1")
+AT_RSP(EXACT, "AT+USBNETIP?", "USBNETIP=1")
+AT_RSP(EXACT, "AT+CMGF?", "+CMGF: 0")
+AT_RSP(EXACT, "AT+CPIN?", "+CPIN: READY")
+AT_RSP(EXACT, "AT+CNBP?", "+CNBP: 0X000700000FEB0180,0X000007FF3FDF3FFF")
+AT_RSP(EXACT, "AT+CICCID", "+ICCID: " ICCID_)
+AT_RSP(EXACT, "AT+CSIM=10,\"0020000100\"", "+CSIM:4,\"63C3\"")
+AT_RSP(EXACT, "AT+QPINC=\"SC\"", "+QPINC: \"SC\",3,10")
+AT_RSP(EXACT, "AT+CIMI", IMSI_)
+AT_CMD(EXACT, "AT+CNUM", at_cnum)
+AT_RSP(EXACT, "AT+CSPN?", "+CSPN: \"Virtual\",0")
+AT_RSP(EXACT, "AT+CREG?", "+CREG: 0,0")
+AT_RSP(EXACT, "AT+CEREG?", "+CEREG: 0,1")
+AT_RSP(EXACT, "AT+C5GREG?", "+C5GREG: 0,0")
+AT_RSP(EXACT, "AT+CGCONTRDP", "+CGCONTRDP: 1,5,\"test.MNC002.MCC255.GPRS\",\"10.36.130.148\",\"\",\"10.97.52.68\",\"10.97.52.76\",\"\",\"\",0,0")
+AT_RSP(EXACT, "AT+CSQ", "+CSQ: 23,99")
+AT_RSP(EXACT, "AT+CGATT?", "+CGATT: 1")
+AT_CMD(EXACT, "AT+CPSI?", at_cpsi_get)
+AT_CMD(EXACT, "AT+COPS?", at_cops_get)
+AT_CMD(EXACT, "AT+ZCAINFO?", at_zcainfo_get)
+AT_CMD(EXACT, "AT+COPS=0", at_cops_auto)
+AT_CMD(EXACT, "AT+COPS=?", at_cops_scan)
+AT_CMD(EXACT, "AT+CGPADDR=1", at_cgpaddr)
+AT_RSP(EXACT, "AT+CPMUTEMP", "+CPMUTEMP: 36")
+AT_CMD(EXACT, "AT+CNETCI?", at_cnetci_get)
+AT_CMD(EXACT, "AT+SIGNS", at_signs)
+AT_RSP(EXACT, "AT+DIALMODE?", "+DIALMODE: 0")
+AT_RSP(EXACT, "AT+QCFG=\"nat\"", "+QCFG: \"nat\",1")
+AT_RSP(EXACT, "AT+QCFG=\"ethernet\"", "+QCFG: \"ethernet\",0")
+AT_RSP(EXACT, "AT+QCFG=\"pcie/mode\"", "+QCFG: \"pcie/mode\",0")
+AT_RSP(EXACT, "AT+QCFG=\"usbnet\"", "+QCFG: \"usbnet\",0")
+AT_RSP(EXACT, "AT+QCFG=\"ip6/cfg\"", "+QCFG: \"ip6/cfg\",\"neigh\",1")
+AT_RSP(EXACT, "AT+QUIMSLOT?", "+QUIMSLOT: 1")
+AT_RSP(EXACT, "AT+QCCID", "+QCCID: " ICCID_)
+AT_RSP(EXACT, "AT+QSPN", "+QSPN: \"Virtual\",\"Virtual\",\"Virtual\",0,\"25201\"")
+AT_CMD(EXACT, "AT+QNETDEVCTL?", at_qnetdevctl_get)
+AT_CMD(EXACT, "AT+QNWINFO", at_qnwinfo)
+AT_CMD(EXACT, "AT+QENG=\"servingcell\"", at_qeng_servingcell)
+AT_CMD(EXACT, "AT+QENG=\"neighbourcell\"", at_qeng_neighbourcell)
+AT_CMD(EXACT, "AT+QTEMP", at_qtemp)
+AT_CMD(EXACT, "AT+QCAINFO", at_qcainfo)
+AT_CMD(EXACT, "AT+QANTRSSI?", at_qantrssi_get)
+AT_CMD(EXACT, "AT+QNWPREFCFG=?", at_qnwprefcfg_test)
+AT_CMD(PREFIX, "AT+QNWPREFCFG=\"mode_pref\",", at_qnwprefcfg_mode_pref)
+AT_CMD(PREFIX, "AT+QNWPREFCFG=", at_nop)
+AT_CMD(PREFIX, "AT+CNMP=", at_cnmp)
+AT_RSP(EXACT, "AT+CNMI?", "+CNMI: 2,1,1,1,1")
+AT_CMD(PREFIX, "AT+CPMS=\"SM\"", at_cpms_sm)
+AT_CMD(PREFIX, "AT+CPMS=\"ME\"", at_cpms_me)
+AT_CMD(EXACT, "AT+CPMS?", at_cpms_get)
+AT_CMD(PREFIX, "AT+CMGL=", at_cmgl)
+AT_CMD(PREFIX, "AT+CMGR=", at_cmgr)
+AT_CMD(PREFIX, "AT+CMGD=", at_cmgd)
+AT_CMD(PREFIX, "AT+CUSD=1,", at_cusd)
+AT_CMD(PREFIX, "AT+CMGS=", at_cmgs)
+AT_RSP(EXACT, "AT+CMUX=?", "+CMUX: (0),(0),(1-8),(1-1540),(1-255),(0-100),(2-255),(1-255),(1-7)")
+AT_CMD(PREFIX, "AT+CMUX=", at_cmux)
+AT_CMD(EXACT, "AT+QSCAN=1", at_qscan_4g)
+AT_CMD(EXACT, "AT+QSCAN=2", at_qscan_5g)
+AT_CMD(EXACT, "AT+QSCAN=3", at_qscan_3g)
@@ -0,0 +1,53 @@
+#include <string.h>
+#include <strings.h>
+
+#include "atdisp.h"
+#include "at_table.h"
+
+const struct at_table at_builtin = {
+	AT_HASH_SEED,
+	AT_HASH_MASK,
+	at_strings,
+	at_pattern_off,
+	at_pattern_len,
+	at_hash_slots,
+	at_trie,
+	at_trie_edges,
+};
+
+const int at_ncmds = AT_NCMDS;
+
+int at_lookup_in(const struct at_table *t, const char *line, size_t len)
+{
+	const struct at_trie_node *node;
+	const struct at_trie_edge *e, *end;
+	int id, cmd;
+	size_t i;
+	char c;
+
+	id = t->slots[at_hash(t->seed, line, len) & t->mask];
+	if (id >= 0 && t->pattern_len[id] == len &&
+			!strncasecmp(line, t->strings + t->pattern_off[id], len))
+		return id;
+
+	/* longest prefix wins */
+	cmd = -1;
+	node = &t->trie[0];
+	for (i = 0; i < len; i++) {
+		c = at_fold(line[i]);
+		e = &t->edges[node->edge];
+		end = e + node->nedges;
+		while (e < end && e->c != c)
+			e++;
+		if (e == end) break;
+		node = &t->trie[e->node];
+		if (node->cmd >= 0) cmd = node->cmd;
+	}
+
+	return cmd;
+}
+
+const char *at_name(int id)
+{
+	return at_strings + at_pattern_off[id];
+}
@@ -0,0 +1,69 @@
+#ifndef __ATDISP_H
+#define __ATDISP_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * AT command lookup. Exact commands are found through a perfect hash over
+ * the case-folded line, prefix commands through a trie; both tables are
+ * generated from at_cmds.h at build time by atgen. The cost of a lookup
+ * depends on the line length only, not on the number of commands.
+ */
+
+#define AT_MATCH_EXACT	0
+#define AT_MATCH_PREFIX	1
+
+struct at_trie_node {
+	unsigned short edge;	/* first outgoing edge */
+	unsigned char nedges;
+	short cmd;		/* command ending here, -1 if none */
+};
+
+struct at_trie_edge {
+	char c;
+	unsigned short node;
+};
+
+/*
+ * A complete set of dispatcher tables. The built-in one is generated by
+ * atgen, others come from profile images (see profile.h).
+ */
+struct at_table {
+	uint32_t seed;
+	uint32_t mask;
+	const char *strings;		/* patterns, NUL terminated */
+	const uint32_t *pattern_off;	/* offset of each pattern in strings */
+	const uint16_t *pattern_len;
+	const int16_t *slots;		/* mask + 1 hash slots, -1 if empty */
+	const struct at_trie_node *trie;
+	const struct at_trie_edge *edges;
+};
+
+#define at_fold(c) (((c) >= 'A' && (c) <= 'Z') ? (c) + ('a' - 'A') : (c))
+
+static inline uint32_t at_hash(uint32_t seed, const char *p, size_t len)
+{
+	uint32_t h = 2166136261u ^ seed;
+
+	while (len--) {
+		h ^= (unsigned char)at_fold(*p);
+		h *= 16777619u;
+		p++;
+	}
+
+	return h ^ (h >> 15);
+}
+
+/* the tables of at_cmds.h and their number of commands */
+extern const struct at_table at_builtin;
+extern const int at_ncmds;
+
+/* returns the index of the command in t, -1 if there is none */
+int at_lookup_in(const struct at_table *t, const char *line, size_t len);
+/* returns the index of the command in at_cmds.h, -1 if there is none */
+#define at_lookup(line, len) at_lookup_in(&at_builtin, (line), (len))
+/* the pattern of command id in at_cmds.h */
+const char *at_name(int id);
+
+#endif /* __ATDISP_H */
@@ -0,0 +1,110 @@
+/*
+ * atgen: build-time generator of the AT dispatcher tables.
+ *
+ * Reads the command list from at_cmds.h and writes a header with a
+ * collision free hash table for the exact commands and a trie for the
+ * prefix commands. Used by atdisp.c only.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "attab.h"
+
+static const struct attab_cmd cmds[] = {
+#define AT_CMD(match, pattern, handler) { AT_MATCH_##match, pattern },
+#define AT_RSP(match, pattern, line) { AT_MATCH_##match, pattern },
+#include "at_cmds.h"
+#undef AT_CMD
+#undef AT_RSP
+};
+
+#define NCMDS ((int)(sizeof(cmds) / sizeof(cmds[0])))
+
+static void emit_string(FILE *f, const char *p);
+int main(int argc, char *argv[]);
+
+static void emit_string(FILE *f, const char *p)
+{
+	fputc('"', f);
+	for (; *p; p++) {
+		if (*p == '"' || *p == '\\') fputc('\\', f);
+		fputc(*p, f);
+	}
+	fputc('"', f);
+}
+
+int main(int argc, char *argv[])
+{
+	struct attab t;
+	FILE *f;
+	int i, off;
+
+	if (argc != 2) {
+		fprintf(stderr, "Usage: atgen <output header>\n");
+		return EXIT_FAILURE;
+	}
+
+	if (attab_build(&t, cmds, NCMDS) < 0) {
+		fprintf(stderr, "atgen: cannot build the dispatcher tables\n");
+		return EXIT_FAILURE;
+	}
+
+	f = fopen(argv[1], "w");
+	if (f == NULL) {
+		perror(argv[1]);
+		return EXIT_FAILURE;
+	}
+
+	fprintf(f, "/* generated by atgen from at_cmds.h, do not edit */\n\n");
+	fprintf(f, "#define AT_NCMDS %d\n", NCMDS);
+	fprintf(f, "#define AT_HASH_SEED %uu\n", t.seed);
+	fprintf(f, "#define AT_HASH_MASK %u\n\n", t.mask);
+
+	/* all patterns in one string, NUL separated */
+	fprintf(f, "static const char at_strings[] =\n");
+	for (i = 0; i < NCMDS; i++) {
+		fprintf(f, "\t");
+		emit_string(f, cmds[i].pattern);
+		fprintf(f, "%s\n", (i == NCMDS - 1) ? ";" : " \"\\0\"");
+	}
+	fprintf(f, "\n");
+
+	fprintf(f, "static const uint32_t at_pattern_off[%d] = {", NCMDS);
+	for (off = 0, i = 0; i < NCMDS; i++) {
+		fprintf(f, "%s%d,", (i % 16) ? " " : "\n\t", off);
+		off += strlen(cmds[i].pattern) + 1;
+	}
+	fprintf(f, "\n};\n\n");
+
+	fprintf(f, "static const uint16_t at_pattern_len[%d] = {", NCMDS);
+	for (i = 0; i < NCMDS; i++)
+		fprintf(f, "%s%d,", (i % 16) ? " " : "\n\t", (int)strlen(cmds[i].pattern));
+	fprintf(f, "\n};\n\n");
+
+	fprintf(f, "static const int16_t at_hash_slots[%u] = {", t.mask + 1);
+	for (i = 0; i <= (int)t.mask; i++)
+		fprintf(f, "%s%d,", (i % 16) ? " " : "\n\t", t.slots[i]);
+	fprintf(f, "\n};\n\n");
+
+	fprintf(f, "static const struct at_trie_node at_trie[%d] = {\n", t.ntrie);
+	for (i = 0; i < t.ntrie; i++)
+		fprintf(f, "\t{ %d, %d, %d },\n", t.trie[i].edge, t.trie[i].nedges, t.trie[i].cmd);
+	fprintf(f, "};\n\n");
+
+	fprintf(f, "static const struct at_trie_edge at_trie_edges[%d] = {\n",
+			t.nedges ? t.nedges : 1);
+	for (i = 0; i < t.nedges; i++) {
+		fprintf(f, "\t{ '%s%c', %d },\n",
+				(t.edges[i].c == '\'' || t.edges[i].c == '\\') ? "\\" : "",
+				t.edges[i].c, t.edges[i].node);
+	}
+	if (!t.nedges) fprintf(f, "\t{ 0, 0 },\n");
+	fprintf(f, "};\n");
+
+	fclose(f);
+	attab_free(&t);
+
+	return EXIT_SUCCESS;
+}
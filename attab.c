@@ -0,0 +1,164 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "attab.h"
+
+struct node {
+	int child[256];
+	int nchild;
+	char c[256];
+	int cmd;
+};
+
+static int find_seed(const struct attab_cmd *cmds, int n, uint32_t mask, uint32_t *seed);
+static int trie_insert(struct node *nodes, int *nnodes, const char *p, int cmd);
+
+static int find_seed(const struct attab_cmd *cmds, int n, uint32_t mask, uint32_t *seed)
+{
+	unsigned char *used;
+	uint32_t s, h;
+	int i;
+
+	used = malloc(mask + 1);
+	if (used == NULL) return -1;
+
+	for (s = 1; s < 10000000; s++) {
+		memset(used, 0, mask + 1);
+		for (i = 0; i < n; i++) {
+			if (cmds[i].match != AT_MATCH_EXACT) continue;
+			h = at_hash(s, cmds[i].pattern, strlen(cmds[i].pattern)) & mask;
+			if (used[h]) break;
+			used[h] = 1;
+		}
+		if (i == n) {
+			*seed = s;
+			free(used);
+			return 0;
+		}
+	}
+
+	free(used);
+	return -1;
+}
+
+static int trie_insert(struct node *nodes, int *nnodes, const char *p, int cmd)
+{
+	int n = 0;
+	int i;
+	char c;
+
+	for (; *p; p++) {
+		c = at_fold(*p);
+		for (i = 0; i < nodes[n].nchild; i++)
+			if (nodes[n].c[i] == c) break;
+		if (i == nodes[n].nchild) {
+			if (*nnodes == ATTAB_MAX_NODES) return -1;
+			nodes[*nnodes].cmd = -1;
+			nodes[n].c[i] = c;
+			nodes[n].child[i] = (*nnodes)++;
+			nodes[n].nchild++;
+		}
+		n = nodes[n].child[i];
+	}
+
+	if (nodes[n].cmd < 0) nodes[n].cmd = cmd;
+
+	return 0;
+}
+
+int attab_build(struct attab *t, const struct attab_cmd *cmds, int n)
+{
+	struct node *nodes;
+	int nexact, nnodes;
+	int i, j, e;
+
+	memset(t, 0, sizeof(*t));
+
+	for (i = 0; i < n; i++) {
+		for (j = 0; j < i; j++) {
+			if (cmds[i].match == cmds[j].match &&
+					!strcasecmp(cmds[i].pattern, cmds[j].pattern)) {
+				fprintf(stderr, "duplicate command %s\n", cmds[i].pattern);
+				return -1;
+			}
+		}
+	}
+
+	/* load factor of at most 1/4 keeps the seed search short */
+	for (nexact = 0, i = 0; i < n; i++)
+		if (cmds[i].match == AT_MATCH_EXACT) nexact++;
+	for (t->mask = 1; t->mask < (uint32_t)nexact * 4; t->mask <<= 1)
+		;
+	t->mask--;
+
+	if (find_seed(cmds, n, t->mask, &t->seed) < 0) {
+		fprintf(stderr, "no perfect hash seed found\n");
+		return -1;
+	}
+
+	t->slots = malloc((t->mask + 1) * sizeof(*t->slots));
+	nodes = calloc(ATTAB_MAX_NODES, sizeof(*nodes));
+	if (t->slots == NULL || nodes == NULL) {
+		fprintf(stderr, "out of memory\n");
+		free(nodes);
+		attab_free(t);
+		return -1;
+	}
+
+	for (i = 0; i <= (int)t->mask; i++)
+		t->slots[i] = -1;
+	nodes[0].cmd = -1;
+	nnodes = 1;
+
+	for (i = 0; i < n; i++) {
+		if (cmds[i].match == AT_MATCH_EXACT) {
+			j = at_hash(t->seed, cmds[i].pattern, strlen(cmds[i].pattern)) & t->mask;
+			t->slots[j] = i;
+		} else if (trie_insert(nodes, &nnodes, cmds[i].pattern, i) < 0) {
+			fprintf(stderr, "too many trie nodes\n");
+			free(nodes);
+			attab_free(t);
+			return -1;
+		}
+	}
+
+	/* flatten: the edges of a node are stored together, in node order */
+	for (e = 0, i = 0; i < nnodes; i++)
+		e += nodes[i].nchild;
+	t->trie = calloc(nnodes, sizeof(*t->trie));
+	t->edges = calloc(e ? e : 1, sizeof(*t->edges));
+	if (t->trie == NULL || t->edges == NULL) {
+		fprintf(stderr, "out of memory\n");
+		free(nodes);
+		attab_free(t);
+		return -1;
+	}
+	t->ntrie = nnodes;
+
+	for (e = 0, i = 0; i < nnodes; i++) {
+		t->trie[i].edge = e;
+		t->trie[i].nedges = nodes[i].nchild;
+		t->trie[i].cmd = nodes[i].cmd;
+		for (j = 0; j < nodes[i].nchild; j++, e++) {
+			t->edges[e].c = nodes[i].c[j];
+			t->edges[e].node = nodes[i].child[j];
+		}
+	}
+	t->nedges = e;
+
+	free(nodes);
+
+	return 0;
+}
+
+void attab_free(struct attab *t)
+{
+	free(t->slots);
+	free(t->trie);
+	free(t->edges);
+	t->slots = NULL;
+	t->trie = NULL;
+	t->edges = NULL;
+}
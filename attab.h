@@ -0,0 +1,34 @@
+#ifndef __ATTAB_H
+#define __ATTAB_H
+
+/*
+ * Construction of the AT dispatcher tables described in atdisp.h: a
+ * perfect hash over the exact commands and a trie over the prefix
+ * commands. Shared by atgen, which emits the built-in tables as C, and
+ * profc, which writes them into a profile image.
+ */
+
+#include "atdisp.h"
+
+#define ATTAB_MAX_NODES 4096
+
+struct attab_cmd {
+	int match;
+	const char *pattern;
+};
+
+struct attab {
+	uint32_t seed;
+	uint32_t mask;
+	int16_t *slots;			/* mask + 1 */
+	struct at_trie_node *trie;
+	int ntrie;
+	struct at_trie_edge *edges;
+	int nedges;
+};
+
+/* returns -1 after printing the reason if the tables cannot be built */
+int attab_build(struct attab *t, const struct attab_cmd *cmds, int n);
+void attab_free(struct attab *t);
+
+#endif /* __ATTAB_H */
@@ -0,0 +1,854 @@
+/*
+ * gustavd-bench: micro benchmarks of the daemon's hot paths and an
+ * end-to-end load generator.
+ *
+ * Usage: gustavd-bench <benchmark> [options]
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "atdisp.h"
+#include "ev.h"
+#include "pdu.h"
+#include "split.h"
+
+struct bench_cmd {
+	int match;
+	const char *pattern;
+};
+
+static const struct bench_cmd bench_cmds[] = {
+#define AT_CMD(match, pattern, handler) { AT_MATCH_##match, pattern },
+#define AT_RSP(match, pattern, line) { AT_MATCH_##match, pattern },
+#include "at_cmds.h"
+#undef AT_CMD
+#undef AT_RSP
+};
+
+#define NCMDS ((int)(sizeof(bench_cmds) / sizeof(bench_cmds[0])))
+
+static volatile int bench_sink;
+
+/*
+ * End-to-end load: gustavd is started as a child on pty pairs created here
+ * and every port runs one AT transaction at a time from the selected mix.
+ * With a target rate, transactions are scheduled at fixed intervals and
+ * latency is taken from the scheduled time, so a slow daemon cannot hide
+ * its queueing delay by slowing the generator down.
+ *
+ * A transaction may be a line of several commands; latency is that of the
+ * line, throughput and CPU time are per command.
+ */
+
+#define LOAD_MAX_PORTS 1024
+
+struct load_txn {
+	const char *req;	/* everything that is written, lines terminated */
+	int len;
+	int ncmds;		/* AT commands in it */
+};
+
+#define LOAD_TXN(s) { s, sizeof(s) - 1, 1 }
+#define LOAD_LINE(s, n) { s, sizeof(s) - 1, n }
+
+static const struct load_txn load_poll[] = {
+	LOAD_TXN("AT+CSQ\r"),
+	LOAD_TXN("AT+QENG=\"servingcell\"\r"),
+	{ NULL, 0 },
+};
+
+static const struct load_txn load_bulk[] = {
+	LOAD_TXN("AT+CMGL=4\r"),
+	{ NULL, 0 },
+};
+
+/*
+ * SMS-SUBMIT PDUs as a phone sends them: a concatenated UCS2 message of
+ * three parts with 8-bit references and a validity period, one in GSM 7
+ * bit with 16-bit references and a short one with extension characters.
+ */
+#define SUBMIT_UCS2_1_LEN "154"
+#define SUBMIT_UCS2_1 \
+	"0051000B919761214365F70008A78C0500033B03010423043204300436043004" \
+	"35043C044B0439002004300431043E043D0435043D0442002100200412043004" \
+	"48002004310430043B0430043D0441002000390039002E003200370020044004" \
+	"430431002E0020041F043E043F043E043B043D04380442044C00200441044704" \
+	"510442003A0020007000610079002E006D0065006700610066006F"
+#define SUBMIT_UCS2_2_LEN "154"
+#define SUBMIT_UCS2_2 \
+	"0051000B919761214365F70008A78C0500033B0302006E002E00720075002E00" \
+	"20041F043E0434043A043B044E04470438044204350020043004320442043E04" \
+	"3F043B043004420451043600200438002004370430043104430434044C044204" \
+	"350020043E0020043F043E043F043E043B043D0435043D043804380020044104" \
+	"4704510442043000200432044004430447043D0443044E00202014"
+#define SUBMIT_UCS2_3_LEN "112"
+#define SUBMIT_UCS2_3 \
+	"0051000B919761214365F70008A7620500033B03030020044D0442043E002004" \
+	"430434043E0431043D043E002004380020043D0430043404510436043D043E00" \
+	"2E00200421043F0430044104380431043E002C002004470442043E0020043204" \
+	"4B002004410020043D0430043C04380021"
+#define SUBMIT_GSM7_1_LEN "154"
+#define SUBMIT_GSM7_1 \
+	"0041000D91945111325476F80000A006080412340201D9775D0E8287E5E3321B" \
+	"44BBC5622D182E5603A5E72079394CCE83CC6F39089E1EAFEB7050980E62BFC7" \
+	"EBB21C348AC9401B5E339C7683A6F48D0F5477D3D36C500CE782D14032980E06" \
+	"73818CE532885C2FEB40B24D19B4418DC37334E82D078DC372F226E50249CB70" \
+	"761E34A53EA120FA1BF486D341EF3A7D078AD7CB737AFAED9EFF40"
+#define SUBMIT_GSM7_2_LEN "102"
+#define SUBMIT_GSM7_2 \
+	"0041000D91945111325476F800006406080412340202C3309B0D82E16030504C" \
+	"3603D16A36D05B0EB2A7E7693AA88C0FB7E1ECB26BFC6EBFE8F2F0780DDAF440" \
+	"7474D8BD06E5DF7590F92D078DD1EFF73CED3E83EA7316081DB6974161D0595E" \
+	"0ED341E4703E04"
+#define SUBMIT_GSM7_LEN "43"
+#define SUBMIT_GSM7 \
+	"0001000B919761214365F7000022C337B90CAAC97031D086670FB3D364500DD4" \
+	"4EBB373ED08612D950409B32"
+
+static const struct {
+	const char *pdu;
+	int tpdu_len;
+} bench_pdus[] = {
+	{ SUBMIT_UCS2_1, 154 },
+	{ SUBMIT_UCS2_2, 154 },
+	{ SUBMIT_UCS2_3, 112 },
+	{ SUBMIT_GSM7_1, 154 },
+	{ SUBMIT_GSM7_2, 102 },
+	{ SUBMIT_GSM7, 43 },
+};
+
+#define NPDUS ((int)(sizeof(bench_pdus) / sizeof(bench_pdus[0])))
+
+static const struct load_txn load_sms[] = {
+	LOAD_TXN("AT+CMGS=19\r"
+			"0011000B919761234567F80000AA05E8329BFD06\x1a\r"),
+	{ NULL, 0 },
+};
+
+static const struct load_txn load_multipart[] = {
+	LOAD_TXN("AT+CMGS=" SUBMIT_UCS2_1_LEN "\r" SUBMIT_UCS2_1 "\x1a\r"),
+	LOAD_TXN("AT+CMGS=" SUBMIT_UCS2_2_LEN "\r" SUBMIT_UCS2_2 "\x1a\r"),
+	LOAD_TXN("AT+CMGS=" SUBMIT_UCS2_3_LEN "\r" SUBMIT_UCS2_3 "\x1a\r"),
+	LOAD_TXN("AT+CMGS=" SUBMIT_GSM7_1_LEN "\r" SUBMIT_GSM7_1 "\x1a\r"),
+	LOAD_TXN("AT+CMGS=" SUBMIT_GSM7_2_LEN "\r" SUBMIT_GSM7_2 "\x1a\r"),
+	LOAD_TXN("AT+CMGS=" SUBMIT_GSM7_LEN "\r" SUBMIT_GSM7 "\x1a\r"),
+	{ NULL, 0 },
+};
+
+/* what a modem manager polls, one command per line and all on one line */
+static const struct load_txn load_queries[] = {
+	LOAD_TXN("AT+CSQ\r"),
+	LOAD_TXN("AT+CREG?\r"),
+	LOAD_TXN("AT+CEREG?\r"),
+	LOAD_TXN("AT+COPS?\r"),
+	{ NULL, 0 },
+};
+
+static const struct load_txn load_batch[] = {
+	LOAD_LINE("AT+CSQ;+CREG?;+CEREG?;+COPS?\r", 4),
+	{ NULL, 0 },
+};
+
+static const struct load_txn load_mixed[] = {
+	LOAD_TXN("AT+CSQ\r"),
+	LOAD_TXN("AT+QENG=\"servingcell\"\r"),
+	LOAD_TXN("AT+CSQ\r"),
+	LOAD_TXN("AT+QENG=\"servingcell\"\r"),
+	LOAD_TXN("AT+CMGL=4\r"),
+	LOAD_TXN("AT+CMGS=19\r"
+			"0011000B919761234567F80000AA05E8329BFD06\x1a\r"),
+	{ NULL, 0 },
+};
+
+static const struct {
+	const char *name;
+	const struct load_txn *txn;
+} load_mixes[] = {
+	{ "poll", load_poll },
+	{ "bulk", load_bulk },
+	{ "sms", load_sms },
+	{ "mixed", load_mixed },
+	{ "queries", load_queries },
+	{ "batch", load_batch },
+	{ "multipart", load_multipart },
+};
+
+struct load_port {
+	struct ev_io io;
+	struct ev_timer timer;
+	const struct load_txn *mix;
+	int next;		/* index of the next transaction in mix */
+	int busy;
+	uint64_t start;		/* scheduled (or sent) time of the transaction */
+	int ncmds;		/* in the transaction */
+	char tail[8];		/* last bytes received, to spot the final result */
+	int ntail;
+};
+
+static struct {
+	struct ev_loop loop;
+	struct load_port *ports;
+	int nports;
+	uint64_t interval;	/* ns between transactions of a port, 0 if closed loop */
+	int running;
+	uint64_t *lat;		/* ns */
+	size_t nlat, lat_sz;
+	uint64_t ncmds;
+	uint64_t errors;
+} load;
+
+static double now_ns(void);
+static int linear_lookup(const char *line);
+static int bench_dispatch(int argc, char *argv[]);
+static int bench_split_cb(struct splitter *sp, char *line, int len);
+static int bench_split(int argc, char *argv[]);
+static int bench_pdu(int argc, char *argv[]);
+static int load_cmp(const void *a, const void *b);
+static void load_send(struct load_port *lp, uint64_t now);
+static void load_next(struct load_port *lp, uint64_t now);
+static void load_timer_cb(struct ev_timer *t);
+static void load_done(struct load_port *lp, int ok);
+static void load_io_cb(struct ev_io *io);
+static void load_stop_cb(struct ev_timer *t);
+static uint64_t load_cpu_ns(pid_t pid);
+static uint64_t load_self_cpu_ns(void);
+static int64_t load_syscalls(const char *path);
+static int load_handshake(void);
+static int bench_load(int argc, char *argv[]);
+int main(int argc, char *argv[]);
+
+static double now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/* what at_read_line_cb() used to do: compare against every command in turn */
+static int linear_lookup(const char *line)
+{
+	int i;
+
+	for (i = 0; i < NCMDS; i++) {
+		if (bench_cmds[i].match == AT_MATCH_EXACT) {
+			if (!strcasecmp(line, bench_cmds[i].pattern)) return i;
+		} else {
+			if (!strncasecmp(line, bench_cmds[i].pattern,
+						strlen(bench_cmds[i].pattern)))
+				return i;
+		}
+	}
+
+	return -1;
+}
+
+static int bench_dispatch(int argc, char *argv[])
+{
+	char line[128];
+	double t, hash_ns, linear_ns, hash_min, hash_max;
+	int iters = 200000;
+	int i, k, id;
+
+	if (argc > 1) iters = atoi(argv[1]);
+	if (iters <= 0) iters = 1;
+
+	printf("%-4s %-36s %10s %10s\n", "id", "command", "hash ns", "linear ns");
+
+	hash_min = 1e9;
+	hash_max = 0;
+	for (i = 0; i <= NCMDS; i++) {
+		/* the last round is a command nobody knows, i.e. the ERROR path */
+		if (i == NCMDS)
+			snprintf(line, sizeof(line), "AT+NOSUCHCMD");
+		else
+			snprintf(line, sizeof(line), "%s%s", bench_cmds[i].pattern,
+					bench_cmds[i].match == AT_MATCH_PREFIX ? "1" : "");
+
+		id = at_lookup(line, strlen(line));
+		if (id != linear_lookup(line)) {
+			fprintf(stderr, "lookup mismatch for %s\n", line);
+			return EXIT_FAILURE;
+		}
+
+		t = now_ns();
+		for (k = 0; k < iters; k++)
+			bench_sink += at_lookup(line, strlen(line));
+		hash_ns = (now_ns() - t) / iters;
+
+		t = now_ns();
+		for (k = 0; k < iters; k++)
+			bench_sink += linear_lookup(line);
+		linear_ns = (now_ns() - t) / iters;
+
+		if (hash_ns < hash_min) hash_min = hash_ns;
+		if (hash_ns > hash_max) hash_max = hash_ns;
+
+		printf("%-4d %-36.36s %10.1f %10.1f\n", id, line, hash_ns, linear_ns);
+	}
+
+	printf("hash lookup: min %.1f ns, max %.1f ns over %d commands\n",
+			hash_min, hash_max, NCMDS + 1);
+
+	return EXIT_SUCCESS;
+}
+
+static long split_lines;
+
+static int bench_split_cb(struct splitter *sp, char *line, int len)
+{
+	split_lines++;
+	bench_sink += len;
+
+	return 0;
+}
+
+static int bench_split(int argc, char *argv[])
+{
+	static const char *impls[] = { "avx2", "sse2", "c" };
+	static const char hex[] = "0123456789ABCDEFabcdef";
+	struct splitter sp;
+	char *stream, *pdu;
+	size_t size, off, len;
+	double hex_sec;
+	double t, sec;
+	int mb = 64;
+	int i, n;
+
+	if (argc > 1) mb = atoi(argv[1]);
+	if (mb <= 0) mb = 1;
+	size = (size_t)mb << 20;
+
+	stream = malloc(size);
+	pdu = malloc(size);
+	if (stream == NULL || pdu == NULL) {
+		fprintf(stderr, "out of memory\n");
+		return EXIT_FAILURE;
+	}
+
+	/* the command table over and over, terminated like a host would */
+	for (off = 0, i = 0; off < size; i = (i + 1) % NCMDS) {
+		len = strlen(bench_cmds[i].pattern);
+		if (len + 1 > size - off) len = size - off - 1;
+		memcpy(stream + off, bench_cmds[i].pattern, len);
+		off += len;
+		stream[off++] = '\r';
+	}
+	/* and PDU hex digits, scanned like after the prompt of AT+CMGS */
+	for (off = 0; off < size; off++)
+		pdu[off] = hex[off % (sizeof(hex) - 1)];
+
+	printf("%-6s %10s %12s %12s %10s\n", "impl", "MB/s", "lines/s", "lines", "hex MB/s");
+	for (i = 0; i < (int)(sizeof(impls) / sizeof(impls[0])); i++) {
+		if (split_select(impls[i]) < 0) {
+			printf("%-6s %10s\n", impls[i], "n/a");
+			continue;
+		}
+
+		/* delimiters the splitter overwrites become NULs, which split the same */
+		memset(&sp, 0, sizeof(sp));
+		sp.cb = bench_split_cb;
+		split_lines = 0;
+
+		t = now_ns();
+		for (off = 0; off < size; off += n) {
+			n = (size - off < TTY_RD_BUF) ? size - off : TTY_RD_BUF;
+			split_feed(&sp, stream + off, n);
+		}
+		sec = (now_ns() - t) / 1e9;
+
+		t = now_ns();
+		for (off = 0; off < size; off += n) {
+			n = (size - off < TTY_RD_BUF) ? size - off : TTY_RD_BUF;
+			bench_sink += split_find_nonhex(pdu + off, pdu + off + n) - pdu;
+		}
+		hex_sec = (now_ns() - t) / 1e9;
+
+		printf("%-6s %10.1f %12.0f %12ld %10.1f\n", impls[i], mb / sec,
+				split_lines / sec, split_lines, mb / hex_sec);
+	}
+
+	free(pdu);
+	free(stream);
+
+	return EXIT_SUCCESS;
+}
+
+static int bench_pdu(int argc, char *argv[])
+{
+	struct pdu_submit m;
+	double t, sec;
+	size_t octets = 0;
+	unsigned n;
+	int iters = 200000;
+	int i, k;
+
+	if (argc > 1) iters = atoi(argv[1]);
+	if (iters <= 0) iters = 1;
+
+	printf("%-4s %5s %-5s %5s %-14s %6s  %s\n", "pdu", "tpdu", "alpha", "ref", "part", "bytes", "text");
+	for (i = 0; i < NPDUS; i++) {
+		if (pdu_submit_decode(&m, bench_pdus[i].pdu, strlen(bench_pdus[i].pdu)) !=
+				bench_pdus[i].tpdu_len) {
+			fprintf(stderr, "PDU %d does not decode\n", i);
+			return EXIT_FAILURE;
+		}
+		/* the start of the text, not cutting a character */
+		n = (m.text_len < 40) ? m.text_len : 40;
+		while (n < m.text_len && (m.text[n] & 0xc0) == 0x80)
+			n--;
+		printf("%-4d %5d %-5s %5u %3u/%-10u %6u  %.*s\n", i, bench_pdus[i].tpdu_len,
+				m.alphabet == PDU_UCS2 ? "ucs2" : m.alphabet == PDU_GSM7 ? "gsm7" : "8bit",
+				m.ref, m.part, m.parts, m.text_len, (int)n, m.text);
+		octets += strlen(bench_pdus[i].pdu) / 2;
+	}
+
+	t = now_ns();
+	for (k = 0; k < iters; k++)
+		for (i = 0; i < NPDUS; i++)
+			bench_sink += pdu_submit_decode(&m, bench_pdus[i].pdu,
+					strlen(bench_pdus[i].pdu));
+	sec = (now_ns() - t) / 1e9;
+
+	printf("%.0f PDUs/s, %.1f ns/PDU, %.1f MB/s of octets\n",
+			(double)iters * NPDUS / sec, sec * 1e9 / iters / NPDUS,
+			(double)iters * octets / sec / 1e6);
+
+	return EXIT_SUCCESS;
+}
+
+static int load_cmp(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+	return (x > y) - (x < y);
+}
+
+static void load_send(struct load_port *lp, uint64_t now)
+{
+	const struct load_txn *t = &lp->mix[lp->next];
+
+	if (write(lp->io.fd, t->req, t->len) != t->len) {
+		fprintf(stderr, "write to port failed: %s\n", strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+	if (!load.interval) lp->start = now;
+	lp->busy = 1;
+	lp->ntail = 0;
+	lp->ncmds = t->ncmds;
+
+	if (lp->mix[++lp->next].req == NULL) lp->next = 0;
+}
+
+/* schedule the next transaction of a port that just became idle */
+static void load_next(struct load_port *lp, uint64_t now)
+{
+	if (!load.running) return;
+
+	if (!load.interval) {
+		load_send(lp, now);
+		return;
+	}
+
+	lp->start += load.interval;
+	if (lp->start <= now)
+		load_send(lp, now);
+	else
+		ev_timer_start_at(&load.loop, &lp->timer, lp->start);
+}
+
+static void load_timer_cb(struct ev_timer *t)
+{
+	struct load_port *lp = container_of(t, struct load_port, timer);
+
+	load_send(lp, ev_now());
+}
+
+static void load_done(struct load_port *lp, int ok)
+{
+	uint64_t now = ev_now(), *lat;
+
+	if (!ok) load.errors++;
+
+	if (load.nlat == load.lat_sz) {
+		load.lat_sz = load.lat_sz ? load.lat_sz * 2 : 65536;
+		lat = realloc(load.lat, load.lat_sz * sizeof(*lat));
+		if (lat == NULL) {
+			fprintf(stderr, "out of memory\n");
+			exit(EXIT_FAILURE);
+		}
+		load.lat = lat;
+	}
+	load.lat[load.nlat++] = now - lp->start;
+	load.ncmds += lp->ncmds;
+
+	lp->busy = 0;
+	load_next(lp, now);
+}
+
+static void load_io_cb(struct ev_io *io)
+{
+	struct load_port *lp = container_of(io, struct load_port, io);
+	char buff[4096];
+	int n, k;
+
+	if (!(io->state & EV_READABLE)) return;
+
+	for (;;) {
+		n = read(io->fd, buff, sizeof(buff));
+		if (n < 0 && errno == EINTR) continue;
+		if (n <= 0) break;
+
+		/* one transaction at a time, so the final result ends the data */
+		k = (n < (int)sizeof(lp->tail)) ? n : (int)sizeof(lp->tail);
+		if (lp->ntail + k > (int)sizeof(lp->tail)) {
+			memmove(lp->tail, lp->tail + lp->ntail + k - sizeof(lp->tail),
+					sizeof(lp->tail) - k);
+			lp->ntail = sizeof(lp->tail) - k;
+		}
+		memcpy(lp->tail + lp->ntail, buff + n - k, k);
+		lp->ntail += k;
+
+		if (!lp->busy) continue;
+		if (lp->ntail >= 4 && !memcmp(lp->tail + lp->ntail - 4, "OK\n\r", 4))
+			load_done(lp, 1);
+		else if (lp->ntail >= 7 && !memcmp(lp->tail + lp->ntail - 7, "ERROR\n\r", 7))
+			load_done(lp, 0);
+	}
+	if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+		fprintf(stderr, "read from port failed: %s\n", strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+	io->state &= ~EV_READABLE;
+}
+
+static void load_stop_cb(struct ev_timer *t)
+{
+	load.running = 0;
+}
+
+/* utime + stime of a process, in ns */
+static uint64_t load_cpu_ns(pid_t pid)
+{
+	char path[64], buf[1024], *p;
+	unsigned long long ut, st;
+	int fd, n;
+
+	snprintf(path, sizeof(path), "/proc/%d/stat", (int)pid);
+	fd = open(path, O_RDONLY);
+	if (fd < 0) return 0;
+	n = read(fd, buf, sizeof(buf) - 1);
+	close(fd);
+	if (n <= 0) return 0;
+	buf[n] = '\0';
+
+	/* fields 14 and 15, counted after the parenthesized command name */
+	p = strrchr(buf, ')');
+	if (p == NULL || sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %llu %llu",
+				&ut, &st) != 2)
+		return 0;
+
+	return (ut + st) * (1000000000ULL / sysconf(_SC_CLK_TCK));
+}
+
+static uint64_t load_self_cpu_ns(void)
+{
+	struct rusage ru;
+
+	getrusage(RUSAGE_SELF, &ru);
+
+	return (ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000000000ULL +
+		(ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) * 1000ULL;
+}
+
+/* system calls gustavd has made so far, from its statistics socket */
+static int64_t load_syscalls(const char *path)
+{
+	struct sockaddr_un sa;
+	char buff[4096], *p;
+	size_t len = 0;
+	int fd, n;
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sun_family = AF_UNIX;
+	snprintf(sa.sun_path, sizeof(sa.sun_path), "%s", path);
+
+	fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0) return -1;
+	if (connect(fd, (struct sockaddr *)&sa, sizeof(sa)) < 0 ||
+			write(fd, "stats\n", 6) != 6) {
+		close(fd);
+		return -1;
+	}
+	while (len < sizeof(buff) - 1 && (n = read(fd, buff + len, sizeof(buff) - 1 - len)) > 0)
+		len += n;
+	close(fd);
+	buff[len] = '\0';
+
+	p = strstr(buff, "\nsyscalls ");
+	return p ? strtoll(p + 10, NULL, 10) : -1;
+}
+
+/* wait until gustavd answers on every port */
+static int load_handshake(void)
+{
+	char buff[256];
+	uint64_t deadline = ev_now() + 10000000000ULL;
+	int i, n, ready;
+
+	for (i = 0; i < load.nports; i++)
+		load.ports[i].busy = 0;
+
+	do {
+		for (ready = 0, i = 0; i < load.nports; i++) {
+			struct load_port *lp = &load.ports[i];
+
+			if (lp->busy == 2) {
+				ready++;
+				continue;
+			}
+			if (write(lp->io.fd, "AT\r", 3) != 3) return -1;
+		}
+		usleep(20000);
+		for (i = 0; i < load.nports; i++) {
+			struct load_port *lp = &load.ports[i];
+
+			while ((n = read(lp->io.fd, buff, sizeof(buff) - 1)) > 0) {
+				buff[n] = '\0';
+				if (strstr(buff, "OK")) lp->busy = 2;
+			}
+		}
+	} while (ready < load.nports && ev_now() < deadline);
+
+	/* drain answers to repeated handshakes */
+	usleep(50000);
+	for (i = 0; i < load.nports; i++) {
+		while (read(load.ports[i].io.fd, buff, sizeof(buff)) > 0)
+			;
+		load.ports[i].busy = 0;
+	}
+
+	return (ready == load.nports) ? 0 : -1;
+}
+
+static int bench_load(int argc, char *argv[])
+{
+	const struct load_txn *mix = load_poll;
+	const char *mix_name = "poll";
+	char exe[PATH_MAX], *gustavd = NULL, *threads = NULL, *backend = NULL, **args, *p;
+	char sock[64];
+	int paced = 0;
+	uint64_t t, cpu_child, cpu_self;
+	int64_t sys_child;
+	struct ev_timer stop;
+	double sec, rate = 0;
+	int duration = 5;
+	int c, i, n, status;
+	pid_t pid;
+
+	load.nports = 1;
+	optind = 1;
+	while ((c = getopt(argc, argv, "n:t:r:m:g:w:i:p")) != -1) {
+		switch (c) {
+			case 'n':
+				load.nports = atoi(optarg);
+				break;
+			case 't':
+				duration = atoi(optarg);
+				break;
+			case 'r':
+				rate = atof(optarg);
+				break;
+			case 'm':
+				for (i = 0; i < (int)(sizeof(load_mixes) / sizeof(load_mixes[0])); i++)
+					if (!strcmp(optarg, load_mixes[i].name)) break;
+				if (i == (int)(sizeof(load_mixes) / sizeof(load_mixes[0]))) {
+					fprintf(stderr, "unknown mix %s\n", optarg);
+					return EXIT_FAILURE;
+				}
+				mix = load_mixes[i].txn;
+				mix_name = load_mixes[i].name;
+				break;
+			case 'g':
+				gustavd = optarg;
+				break;
+			case 'w':
+				threads = optarg;
+				break;
+			case 'i':
+				backend = optarg;
+				break;
+			case 'p':
+				paced = 1;
+				break;
+			default:
+				return EXIT_FAILURE;
+		}
+	}
+	if (load.nports <= 0 || load.nports > LOAD_MAX_PORTS || duration <= 0 || rate < 0) {
+		fprintf(stderr, "invalid options\n");
+		return EXIT_FAILURE;
+	}
+
+	/* by default the daemon next to this executable */
+	if (gustavd == NULL) {
+		n = readlink("/proc/self/exe", exe, sizeof(exe) - sizeof("gustavd"));
+		if (n < 0) return EXIT_FAILURE;
+		exe[n] = '\0';
+		p = strrchr(exe, '/');
+		strcpy(p ? p + 1 : exe, "gustavd");
+		gustavd = exe;
+	}
+
+	if (ev_loop_init(&load.loop) < 0) return EXIT_FAILURE;
+	load.ports = calloc(load.nports, sizeof(*load.ports));
+	args = calloc(load.nports + 9, sizeof(*args));
+	if (load.ports == NULL || args == NULL) return EXIT_FAILURE;
+
+	n = 0;
+	args[n++] = gustavd;
+	if (threads) {
+		args[n++] = "-w";
+		args[n++] = threads;
+	}
+	if (backend) {
+		args[n++] = "-i";
+		args[n++] = backend;
+	}
+	/* system calls are counted by the daemon */
+	snprintf(sock, sizeof(sock), "/tmp/gustavd-bench.%d", (int)getpid());
+	args[n++] = "-s";
+	args[n++] = sock;
+	/* the daemon's own cost, not the baud rate, unless asked for */
+	if (!paced) args[n++] = "-u";
+	for (i = 0; i < load.nports; i++) {
+		struct load_port *lp = &load.ports[i];
+
+		lp->io.fd = posix_openpt(O_RDWR | O_NONBLOCK | O_NOCTTY | O_CLOEXEC);
+		if (lp->io.fd < 0 || grantpt(lp->io.fd) < 0 || unlockpt(lp->io.fd) < 0 ||
+				(args[n + i] = ptsname(lp->io.fd)) == NULL ||
+				(args[n + i] = strdup(args[n + i])) == NULL) {
+			fprintf(stderr, "cannot allocate a pty: %s\n", strerror(errno));
+			return EXIT_FAILURE;
+		}
+		lp->mix = mix;
+		lp->next = i % 2;	/* spread the mix over the ports */
+		if (mix[lp->next].req == NULL) lp->next = 0;
+		ev_timer_init(&lp->timer, load_timer_cb);
+	}
+
+	pid = fork();
+	if (pid < 0) return EXIT_FAILURE;
+	if (pid == 0) {
+		execv(gustavd, args);
+		fprintf(stderr, "cannot run %s: %s\n", gustavd, strerror(errno));
+		_exit(EXIT_FAILURE);
+	}
+
+	if (load_handshake() < 0) {
+		fprintf(stderr, "%s does not answer\n", gustavd);
+		kill(pid, SIGTERM);
+		return EXIT_FAILURE;
+	}
+
+	for (i = 0; i < load.nports; i++) {
+		if (ev_io_add(&load.loop, &load.ports[i].io, load.ports[i].io.fd, load_io_cb) < 0)
+			return EXIT_FAILURE;
+	}
+
+	ev_timer_init(&stop, load_stop_cb);
+	ev_timer_start(&load.loop, &stop, duration * 1000);
+	load.interval = rate ? 1e9 * load.nports / rate : 0;
+	load.running = 1;
+
+	t = ev_now();
+	cpu_child = load_cpu_ns(pid);
+	cpu_self = load_self_cpu_ns();
+	sys_child = load_syscalls(sock);
+	for (i = 0; i < load.nports; i++) {
+		/* stagger the ports over one interval */
+		load.ports[i].start = t + load.interval * i / load.nports - load.interval;
+		load_next(&load.ports[i], t);
+	}
+
+	while (load.running) {
+		if (ev_run_once(&load.loop) < 0) return EXIT_FAILURE;
+	}
+	sec = (ev_now() - t) / 1e9;
+	cpu_child = load_cpu_ns(pid) - cpu_child;
+	cpu_self = load_self_cpu_ns() - cpu_self;
+	sys_child = (sys_child < 0) ? -1 : load_syscalls(sock) - sys_child;
+
+	kill(pid, SIGTERM);
+	waitpid(pid, &status, 0);
+
+	if (!load.nlat) {
+		fprintf(stderr, "no transaction completed\n");
+		return EXIT_FAILURE;
+	}
+	qsort(load.lat, load.nlat, sizeof(*load.lat), load_cmp);
+
+	printf("mix %s, %d ports, %d s, target %s\n", mix_name, load.nports, duration,
+			rate ? "rate" : "closed loop");
+	if (rate) printf("target rate      %12.0f cmds/s\n", rate);
+	printf("commands         %12llu (%llu errors)\n", (unsigned long long)load.ncmds,
+			(unsigned long long)load.errors);
+	if (load.ncmds != load.nlat) printf("lines            %12zu\n", load.nlat);
+	printf("throughput       %12.0f cmds/s\n", load.ncmds / sec);
+	printf("latency p50      %12.1f us\n", load.lat[load.nlat / 2] / 1e3);
+	printf("latency p99      %12.1f us\n", load.lat[load.nlat * 99 / 100] / 1e3);
+	printf("latency p999     %12.1f us\n", load.lat[load.nlat * 999 / 1000] / 1e3);
+	printf("latency max      %12.1f us\n", load.lat[load.nlat - 1] / 1e3);
+	printf("gustavd cpu/cmd  %12.2f us\n", cpu_child / 1e3 / load.ncmds);
+	if (sys_child >= 0)
+		printf("gustavd sys/cmd  %12.2f syscalls\n", (double)sys_child / load.ncmds);
+	printf("bench cpu/cmd    %12.2f us\n", cpu_self / 1e3 / load.ncmds);
+
+	return EXIT_SUCCESS;
+}
+
+static const struct {
+	const char *name;
+	int (*fn)(int argc, char *argv[]);
+	const char *help;
+} benches[] = {
+	{ "dispatch", bench_dispatch, "[iterations]  AT command lookup, hash/trie vs. linear scan" },
+	{ "split", bench_split, "[megabytes]  tty line splitter and PDU hex scan throughput per implementation" },
+	{ "pdu", bench_pdu, "[iterations]  SMS-SUBMIT decoding of a multipart corpus" },
+	{ "load", bench_load, "[-n ports] [-t seconds] [-r cmds/s] [-m poll|bulk|sms|mixed|queries|batch|multipart] [-g gustavd]\n"
+		"        [-w threads] [-i epoll|uring] [-p]\n"
+		"        end-to-end AT transactions against gustavd on ptys, -p paced\n"
+		"        at the baud rate, -i its tty I/O backend" },
+};
+
+int main(int argc, char *argv[])
+{
+	int i;
+
+	if (argc > 1) {
+		for (i = 0; i < (int)(sizeof(benches) / sizeof(benches[0])); i++)
+			if (!strcmp(argv[1], benches[i].name))
+				return benches[i].fn(argc - 1, argv + 1);
+	}
+
+	printf("Usage: gustavd-bench <benchmark> [options]\n\n");
+	for (i = 0; i < (int)(sizeof(benches) / sizeof(benches[0])); i++)
+		printf("  %s %s\n", benches[i].name, benches[i].help);
+
+	return EXIT_FAILURE;
+}
@@ -0,0 +1,466 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+
+#include "main.h"
+#include "at.h"
+#include "cmux.h"
+#include "urc.h"
+
+#define CMUX_F		0xf9	/* flag */
+#define CMUX_EA		0x01	/* last octet of a field */
+#define CMUX_CR		0x02	/* command/response */
+#define CMUX_PF		0x10	/* poll/final */
+
+/* frame types, P/F clear */
+#define CMUX_SABM	0x2f
+#define CMUX_UA		0x63
+#define CMUX_DM		0x0f
+#define CMUX_DISC	0x43
+#define CMUX_UIH	0xef
+#define CMUX_UI		0x03
+
+/* control channel message types, C/R clear */
+#define CMUX_MSG_PN	0x81
+#define CMUX_MSG_PSC	0x41
+#define CMUX_MSG_CLD	0xc1
+#define CMUX_MSG_TEST	0x21
+#define CMUX_MSG_FCON	0xa1
+#define CMUX_MSG_FCOFF	0x61
+#define CMUX_MSG_MSC	0xe1
+#define CMUX_MSG_NSC	0x11
+#define CMUX_MSG_RPN	0x91
+#define CMUX_MSG_RLS	0x51
+#define CMUX_MSG_SNC	0xd1
+
+/* the port queue is filled up to this many frames */
+#define CMUX_Q_FRAMES	4
+#define CMUX_Q_LOW_MIN	1024
+
+enum {
+	CMUX_SYNC,	/* waiting for a flag */
+	CMUX_ADDR,
+	CMUX_CTRL,
+	CMUX_LEN,
+	CMUX_LEN2,
+	CMUX_INFO,
+	CMUX_FCS,
+	CMUX_END,
+};
+
+/* CRC-8 of TS 27.010 (x^8 + x^2 + x + 1, reflected), one lookup per octet */
+static const uint8_t cmux_crc[256] = {
+	0x00, 0x91, 0xe3, 0x72, 0x07, 0x96, 0xe4, 0x75,
+	0x0e, 0x9f, 0xed, 0x7c, 0x09, 0x98, 0xea, 0x7b,
+	0x1c, 0x8d, 0xff, 0x6e, 0x1b, 0x8a, 0xf8, 0x69,
+	0x12, 0x83, 0xf1, 0x60, 0x15, 0x84, 0xf6, 0x67,
+	0x38, 0xa9, 0xdb, 0x4a, 0x3f, 0xae, 0xdc, 0x4d,
+	0x36, 0xa7, 0xd5, 0x44, 0x31, 0xa0, 0xd2, 0x43,
+	0x24, 0xb5, 0xc7, 0x56, 0x23, 0xb2, 0xc0, 0x51,
+	0x2a, 0xbb, 0xc9, 0x58, 0x2d, 0xbc, 0xce, 0x5f,
+	0x70, 0xe1, 0x93, 0x02, 0x77, 0xe6, 0x94, 0x05,
+	0x7e, 0xef, 0x9d, 0x0c, 0x79, 0xe8, 0x9a, 0x0b,
+	0x6c, 0xfd, 0x8f, 0x1e, 0x6b, 0xfa, 0x88, 0x19,
+	0x62, 0xf3, 0x81, 0x10, 0x65, 0xf4, 0x86, 0x17,
+	0x48, 0xd9, 0xab, 0x3a, 0x4f, 0xde, 0xac, 0x3d,
+	0x46, 0xd7, 0xa5, 0x34, 0x41, 0xd0, 0xa2, 0x33,
+	0x54, 0xc5, 0xb7, 0x26, 0x53, 0xc2, 0xb0, 0x21,
+	0x5a, 0xcb, 0xb9, 0x28, 0x5d, 0xcc, 0xbe, 0x2f,
+	0xe0, 0x71, 0x03, 0x92, 0xe7, 0x76, 0x04, 0x95,
+	0xee, 0x7f, 0x0d, 0x9c, 0xe9, 0x78, 0x0a, 0x9b,
+	0xfc, 0x6d, 0x1f, 0x8e, 0xfb, 0x6a, 0x18, 0x89,
+	0xf2, 0x63, 0x11, 0x80, 0xf5, 0x64, 0x16, 0x87,
+	0xd8, 0x49, 0x3b, 0xaa, 0xdf, 0x4e, 0x3c, 0xad,
+	0xd6, 0x47, 0x35, 0xa4, 0xd1, 0x40, 0x32, 0xa3,
+	0xc4, 0x55, 0x27, 0xb6, 0xc3, 0x52, 0x20, 0xb1,
+	0xca, 0x5b, 0x29, 0xb8, 0xcd, 0x5c, 0x2e, 0xbf,
+	0x90, 0x01, 0x73, 0xe2, 0x97, 0x06, 0x74, 0xe5,
+	0x9e, 0x0f, 0x7d, 0xec, 0x99, 0x08, 0x7a, 0xeb,
+	0x8c, 0x1d, 0x6f, 0xfe, 0x8b, 0x1a, 0x68, 0xf9,
+	0x82, 0x13, 0x61, 0xf0, 0x85, 0x14, 0x66, 0xf7,
+	0xa8, 0x39, 0x4b, 0xda, 0xaf, 0x3e, 0x4c, 0xdd,
+	0xa6, 0x37, 0x45, 0xd4, 0xa1, 0x30, 0x42, 0xd3,
+	0xb4, 0x25, 0x57, 0xc6, 0xb3, 0x22, 0x50, 0xc1,
+	0xba, 0x2b, 0x59, 0xc8, 0xbd, 0x2c, 0x5e, 0xcf,
+};
+
+#define cmux_fcs_add(fcs, c) cmux_crc[(uint8_t)((fcs) ^ (c))]
+#define CMUX_FCS_INIT	0xff
+#define CMUX_FCS_GOOD	0xcf	/* remainder over a frame and its FCS */
+
+static void cmux_send(struct cmux *mux, int dlci, int cr, uint8_t ctrl,
+		const struct iovec *iov, int iovcnt);
+static void cmux_frame_in(struct cmux *mux);
+static void cmux_ctl(struct cmux *mux);
+static struct cmux_dlc *cmux_dlc_open(struct cmux *mux, int dlci);
+static void cmux_dlc_close(struct cmux *mux, int dlci);
+static int cmux_dlc_input(struct cmux_dlc *d, char *p, unsigned len);
+static void cmux_dlc_kick(struct session *s);
+static int cmux_line_cb(struct splitter *sp, char *line, int len);
+static void cmux_pump(struct cmux *mux);
+
+struct cmux *cmux_open(struct session *s, unsigned n1)
+{
+	struct cmux *mux;
+
+	mux = calloc(1, sizeof(*mux));
+	if (mux == NULL) return NULL;
+
+	mux->port = s;
+	mux->n1 = n1;
+	mux->low = CMUX_Q_FRAMES * (n1 + CMUX_HDR_MAX);
+	if (mux->low < CMUX_Q_LOW_MIN) mux->low = CMUX_Q_LOW_MIN;
+	mux->state = CMUX_SYNC;
+
+	/* the port carries frames only from now on */
+	urc_session_close(s);
+
+	return mux;
+}
+
+void cmux_close(struct cmux *mux)
+{
+	int i;
+
+	for (i = 1; i < CMUX_DLCS; i++)
+		if (mux->dlc[i]) cmux_dlc_close(mux, i);
+
+	urc_session_init(mux->port);
+	free(mux);
+}
+
+/* queue a frame to the port, the information field is gathered from iov */
+static void cmux_send(struct cmux *mux, int dlci, int cr, uint8_t ctrl,
+		const struct iovec *iov, int iovcnt)
+{
+	char frame[CMUX_HDR_MAX + CMUX_N1_MAX + 1];
+	unsigned len = 0, h, i;
+	uint8_t fcs;
+	int j;
+
+	for (j = 0; j < iovcnt; j++)
+		len += iov[j].iov_len;
+
+	frame[0] = CMUX_F;
+	frame[1] = dlci << 2 | (cr ? CMUX_CR : 0) | CMUX_EA;
+	frame[2] = ctrl;
+	if (len < 128) {
+		frame[3] = len << 1 | CMUX_EA;
+		h = 4;
+	} else {
+		frame[3] = (len & 0x7f) << 1;
+		frame[4] = len >> 7;
+		h = 5;
+	}
+
+	/* the FCS covers the header only, UI frames are never sent */
+	fcs = CMUX_FCS_INIT;
+	for (i = 1; i < h; i++)
+		fcs = cmux_fcs_add(fcs, frame[i]);
+
+	for (j = 0, i = h; j < iovcnt; j++) {
+		memcpy(frame + i, iov[j].iov_base, iov[j].iov_len);
+		i += iov[j].iov_len;
+	}
+	frame[i++] = 0xff - fcs;
+	frame[i++] = CMUX_F;
+
+	tty_write(mux->port, frame, i);
+}
+
+int cmux_feed(struct cmux *mux, char *p, int n)
+{
+	uint8_t c;
+	unsigned k;
+	int i;
+
+	for (i = 0; i < n && !mux->pending && !mux->closed; i++) {
+		c = p[i];
+		switch (mux->state) {
+		case CMUX_SYNC:
+			if (c == CMUX_F) mux->state = CMUX_ADDR;
+			break;
+		case CMUX_ADDR:
+			/* flags between frames */
+			if (c == CMUX_F) break;
+			mux->addr = c;
+			mux->fcs = cmux_fcs_add(CMUX_FCS_INIT, c);
+			mux->state = (c & CMUX_EA) ? CMUX_CTRL : CMUX_SYNC;
+			break;
+		case CMUX_CTRL:
+			mux->ctrl = c;
+			mux->fcs = cmux_fcs_add(mux->fcs, c);
+			mux->state = CMUX_LEN;
+			break;
+		case CMUX_LEN:
+		case CMUX_LEN2:
+			mux->fcs = cmux_fcs_add(mux->fcs, c);
+			if (mux->state == CMUX_LEN) mux->len = c >> 1;
+			else mux->len |= (unsigned)c << 7;
+			mux->got = 0;
+			if (mux->state == CMUX_LEN && !(c & CMUX_EA))
+				mux->state = CMUX_LEN2;
+			else if (mux->len > mux->n1)
+				mux->state = CMUX_SYNC;
+			else
+				mux->state = mux->len ? CMUX_INFO : CMUX_FCS;
+			break;
+		case CMUX_INFO:
+			/* the rest of the field at once */
+			k = mux->len - mux->got;
+			if (k > (unsigned)(n - i)) k = n - i;
+			memcpy(mux->info + mux->got, p + i, k);
+			mux->got += k;
+			i += k - 1;
+			if (mux->got == mux->len) mux->state = CMUX_FCS;
+			break;
+		case CMUX_FCS:
+			/* UI frames have their information checked as well */
+			if ((mux->ctrl & ~CMUX_PF) == CMUX_UI) {
+				for (k = 0; k < mux->len; k++)
+					mux->fcs = cmux_fcs_add(mux->fcs, mux->info[k]);
+			}
+			mux->state = (cmux_fcs_add(mux->fcs, c) == CMUX_FCS_GOOD) ?
+				CMUX_END : CMUX_SYNC;
+			break;
+		case CMUX_END:
+			if (c != CMUX_F) {
+				mux->state = CMUX_SYNC;
+				break;
+			}
+			/* the closing flag may open the next frame */
+			mux->state = CMUX_ADDR;
+			cmux_frame_in(mux);
+			break;
+		}
+	}
+
+	return i;
+}
+
+static void cmux_frame_in(struct cmux *mux)
+{
+	int dlci = mux->addr >> 2;
+	uint8_t pf = mux->ctrl & CMUX_PF;
+	struct cmux_dlc *d;
+
+	switch (mux->ctrl & ~CMUX_PF) {
+	case CMUX_SABM:
+		if (dlci && cmux_dlc_open(mux, dlci) == NULL) {
+			cmux_send(mux, dlci, 1, CMUX_DM | pf, NULL, 0);
+			break;
+		}
+		cmux_send(mux, dlci, 1, CMUX_UA | pf, NULL, 0);
+		break;
+	case CMUX_DISC:
+		if (!dlci) {
+			cmux_send(mux, 0, 1, CMUX_UA | pf, NULL, 0);
+			mux->closed = 1;
+		} else if (mux->dlc[dlci]) {
+			cmux_send(mux, dlci, 1, CMUX_UA | pf, NULL, 0);
+			cmux_dlc_close(mux, dlci);
+		} else {
+			cmux_send(mux, dlci, 1, CMUX_DM | pf, NULL, 0);
+		}
+		break;
+	case CMUX_UIH:
+	case CMUX_UI:
+		if (!dlci) {
+			cmux_ctl(mux);
+			break;
+		}
+		d = mux->dlc[dlci];
+		if (d == NULL) {
+			cmux_send(mux, dlci, 1, CMUX_DM, NULL, 0);
+			break;
+		}
+		if (cmux_dlc_input(d, mux->info, mux->len) < 0) mux->pending = 1;
+		break;
+	default:
+		/* responses to commands never sent */
+		break;
+	}
+}
+
+/* a message on the control channel */
+static void cmux_ctl(struct cmux *mux)
+{
+	uint8_t *p = (uint8_t *)mux->info;
+	uint8_t nsc[3];
+	struct iovec iov;
+
+	if (mux->len < 2 || !(p[0] & CMUX_CR)) return;
+
+	switch (p[0] & ~CMUX_CR) {
+	case CMUX_MSG_CLD:
+		mux->closed = 1;
+		/* fall through */
+	case CMUX_MSG_PN:
+	case CMUX_MSG_PSC:
+	case CMUX_MSG_TEST:
+	case CMUX_MSG_FCON:
+	case CMUX_MSG_FCOFF:
+	case CMUX_MSG_MSC:
+	case CMUX_MSG_RPN:
+	case CMUX_MSG_RLS:
+	case CMUX_MSG_SNC:
+		/* everything is taken as proposed, the response echoes the command */
+		p[0] &= ~CMUX_CR;
+		iov.iov_base = p;
+		iov.iov_len = mux->len;
+		break;
+	default:
+		nsc[0] = CMUX_MSG_NSC;
+		nsc[1] = 1 << 1 | CMUX_EA;
+		nsc[2] = p[0];
+		iov.iov_base = nsc;
+		iov.iov_len = sizeof(nsc);
+		break;
+	}
+
+	cmux_send(mux, 0, 0, CMUX_UIH, &iov, 1);
+}
+
+static struct cmux_dlc *cmux_dlc_open(struct cmux *mux, int dlci)
+{
+	struct session *port = mux->port;
+	struct cmux_dlc *d;
+
+	if (mux->dlc[dlci]) return mux->dlc[dlci];
+
+	d = calloc(1, sizeof(*d));
+	if (d == NULL) return NULL;
+
+	d->mux = mux;
+	d->dlci = dlci;
+	snprintf(d->name, sizeof(d->name), "%s.dlc%d", port->name, dlci);
+
+	at_session_init(&d->sess, port->loop);
+	d->sess.dlci = dlci;
+	d->sess.q.hwm = port->q.hwm;
+	d->sess.split.cb = cmux_line_cb;
+	d->sess.kick = cmux_dlc_kick;
+	d->sess.owner = d;
+	d->sess.name = d->name;
+
+	mux->dlc[dlci] = d;
+	mux->open |= 1ULL << dlci;
+
+	return d;
+}
+
+static void cmux_dlc_close(struct cmux *mux, int dlci)
+{
+	struct cmux_dlc *d = mux->dlc[dlci];
+
+	at_session_close(&d->sess);
+	stats_add(stats_self->queued, -(int64_t)outq_len(&d->sess.q));
+	outq_free(&d->sess.q);
+	free(d);
+
+	mux->dlc[dlci] = NULL;
+	mux->open &= ~(1ULL << dlci);
+	mux->kicked &= ~(1ULL << dlci);
+}
+
+/* hand information to the DLC or keep it aside, -1 if there is no room */
+static int cmux_dlc_input(struct cmux_dlc *d, char *p, unsigned len)
+{
+	struct session *s = &d->sess;
+	int c = 0;
+
+	if (s->rx_len || session_held(s)) {
+		if (len > sizeof(s->rx) - s->rx_len) return -1;
+	} else {
+		c = split_feed(&s->split, p, len);
+	}
+
+	memcpy(s->rx + s->rx_len, p + c, len - c);
+	s->rx_len += len - c;
+
+	return 0;
+}
+
+/* the DLC queued output or may take input again, the port goes on with both */
+static void cmux_dlc_kick(struct session *s)
+{
+	struct cmux_dlc *d = s->owner;
+
+	d->mux->kicked |= 1ULL << d->dlci;
+	d->mux->port->kick(d->mux->port);
+}
+
+static int cmux_line_cb(struct splitter *sp, char *line, int len)
+{
+	struct session *s = container_of(sp, struct session, split);
+
+	stats_line(s);
+	at_read_line_cb(s, line, len);
+	if (!session_busy(s)) stats_reply(s);
+
+	return session_held(s);
+}
+
+void cmux_run(struct cmux *mux)
+{
+	uint64_t kicked = mux->kicked;
+	struct session *s;
+	int dlci, n;
+
+	/* DLCs kicked meanwhile are seen in the next round */
+	mux->kicked = 0;
+	while (kicked) {
+		dlci = __builtin_ctzll(kicked);
+		kicked &= kicked - 1;
+		s = &mux->dlc[dlci]->sess;
+		if (s->rx_len && !session_held(s)) {
+			n = split_feed(&s->split, s->rx, s->rx_len);
+			memmove(s->rx, s->rx + n, s->rx_len - n);
+			s->rx_len -= n;
+		}
+	}
+
+	if (mux->pending && !cmux_dlc_input(mux->dlc[mux->addr >> 2], mux->info, mux->len))
+		mux->pending = 0;
+
+	cmux_pump(mux);
+}
+
+/* frame DLC output into the port queue, one frame per DLC in turn */
+static void cmux_pump(struct cmux *mux)
+{
+	struct iovec iov[16];
+	struct session *s;
+	size_t queued;
+	int i, dlci, iovcnt;
+	unsigned n;
+
+	while (outq_len(&mux->port->q) < mux->low) {
+		for (i = 0; i < CMUX_DLCS; i++) {
+			dlci = (mux->rr + i) % CMUX_DLCS;
+			if ((mux->open >> dlci & 1) && !outq_empty(&mux->dlc[dlci]->sess.q))
+				break;
+		}
+		if (i == CMUX_DLCS) return;
+		mux->rr = dlci + 1;
+
+		s = &mux->dlc[dlci]->sess;
+		iovcnt = outq_iov(&s->q, iov, sizeof(iov) / sizeof(iov[0]), mux->n1);
+		for (i = 0, n = 0; i < iovcnt; i++)
+			n += iov[i].iov_len;
+		if (!n) return;
+
+		cmux_send(mux, dlci, 0, CMUX_UIH, iov, iovcnt);
+
+		/* framed is sent as far as the DLC is concerned */
+		queued = outq_len(&s->q);
+		outq_consume(&s->q, n);
+		stats_add(stats_self->queued, outq_len(&s->q) - queued);
+		stats_written(s);
+		at_session_written(s);
+		/* input it held may go on now */
+		if (s->rx_len) mux->kicked |= 1ULL << dlci;
+	}
+}
@@ -0,0 +1,81 @@
+#ifndef __CMUX_H
+#define __CMUX_H
+
+#include <stdint.h>
+
+#include "session.h"
+
+/*
+ * 3GPP TS 27.010 multiplexer, basic option, entered with AT+CMUX=0.
+ *
+ * The port's own session is left alone once the multiplexer is up: every
+ * DLC opened with SABM gets a session of its own, with its own AT state,
+ * line splitter and output queue. Frames coming in are checked and their
+ * information handed to the DLC's splitter; what a DLC session queues is
+ * cut into UIH frames of at most N1 octets, taking one frame from every
+ * DLC with output in turn, and queued to the port. The port queue is only
+ * filled up to a low-water mark so a busy DLC cannot delay the others by
+ * more than a few frames.
+ *
+ * A frame for a DLC that is holding its input (deferred response, full
+ * queue) is kept until the DLC can take it; no further frame is read
+ * meanwhile, like a real modem stops the line with flow control.
+ *
+ * The latency of a DLC's responses is measured until they are framed.
+ */
+
+#define CMUX_DLCS	64	/* DLCI 0 is the control channel */
+#define CMUX_N1_DEF	31
+/* a whole frame must fit a DLC's input buffer */
+#define CMUX_N1_MAX	1540
+#define CMUX_HDR_MAX	6	/* flag, address, control, two length octets, FCS */
+
+struct cmux;
+
+struct cmux_dlc {
+	struct session sess;
+	struct cmux *mux;
+	int dlci;
+	char name[64];
+};
+
+struct cmux {
+	struct session *port;	/* frames are queued to its output */
+	unsigned n1;		/* longest information field */
+	size_t low;		/* port queue low-water mark */
+	int closed;		/* closed down, back to AT commands */
+
+	/* frame being received */
+	int state;
+	uint8_t addr;
+	uint8_t ctrl;
+	unsigned len;
+	unsigned got;
+	uint8_t fcs;
+	char info[CMUX_N1_MAX];
+	int pending;		/* complete frame a DLC could not take yet */
+
+	int ctl_open;		/* DLCI 0 was opened with SABM */
+	struct cmux_dlc *dlc[CMUX_DLCS];
+	uint64_t open;		/* DLCIs with a session */
+	uint64_t kicked;	/* DLCIs whose input may go on */
+	int rr;			/* DLCI to send from first */
+};
+
+/* multiplex the port session s, frames of up to n1 octets; NULL if out of memory */
+struct cmux *cmux_open(struct session *s, unsigned n1);
+/* close all DLCs and free mux, the port session takes AT commands again */
+void cmux_close(struct cmux *mux);
+
+/*
+ * take n received bytes, returns how many were used; less than n if a DLC
+ * holds its input or the multiplexer was closed down (mux->closed)
+ */
+int cmux_feed(struct cmux *mux, char *p, int n);
+/* input is waiting for a DLC to take it */
+#define cmux_held(mux) ((mux)->pending)
+
+/* go on with DLC input that was held and frame DLC output */
+void cmux_run(struct cmux *mux);
+
+#endif /* __CMUX_H */
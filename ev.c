@@ -0,0 +1,273 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "ev.h"
+
+static void ev_timer_cb(struct ev_io *io);
+static void heap_up(struct ev_loop *loop, int i);
+static void heap_down(struct ev_loop *loop, int i);
+static void heap_remove(struct ev_loop *loop, int i);
+static void timerfd_rearm(struct ev_loop *loop);
+
+int ev_loop_init(struct ev_loop *loop)
+{
+	int fd;
+
+	memset(loop, 0, sizeof(*loop));
+	loop->pending_tail = &loop->pending;
+
+	loop->epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (loop->epfd < 0) return -1;
+
+	fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (fd < 0 || ev_io_add(loop, &loop->tio, fd, ev_timer_cb) < 0) {
+		if (fd >= 0) close(fd);
+		close(loop->epfd);
+		loop->epfd = -1;
+		return -1;
+	}
+
+	return 0;
+}
+
+void ev_loop_close(struct ev_loop *loop)
+{
+	if (loop->tio.fd >= 0) close(loop->tio.fd);
+	if (loop->epfd >= 0) close(loop->epfd);
+	loop->tio.fd = -1;
+	loop->epfd = -1;
+	free(loop->heap);
+	loop->heap = NULL;
+	loop->nheap = loop->heap_sz = 0;
+}
+
+void ev_io_init(struct ev_io *io, int fd, void (*cb)(struct ev_io *io))
+{
+	io->fd = fd;
+	io->state = 0;
+	io->cb = cb;
+	io->next = NULL;
+}
+
+int ev_io_add(struct ev_loop *loop, struct ev_io *io, int fd,
+		void (*cb)(struct ev_io *io))
+{
+	struct epoll_event ev;
+
+	ev_io_init(io, fd, cb);
+
+	ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+	ev.data.ptr = io;
+
+	return epoll_ctl(loop->epfd, EPOLL_CTL_ADD, fd, &ev);
+}
+
+int ev_io_del(struct ev_loop *loop, struct ev_io *io)
+{
+	struct ev_io **pp;
+
+	if (io->state & EV_PENDING) {
+		for (pp = &loop->pending; *pp; pp = &(*pp)->next) {
+			if (*pp == io) {
+				*pp = io->next;
+				break;
+			}
+		}
+		if (loop->pending_tail == &io->next) loop->pending_tail = pp;
+	}
+	io->state = 0;
+	io->next = NULL;
+
+	return epoll_ctl(loop->epfd, EPOLL_CTL_DEL, io->fd, NULL);
+}
+
+void ev_io_kick(struct ev_loop *loop, struct ev_io *io)
+{
+	if (io->state & EV_PENDING) return;
+
+	io->state |= EV_PENDING;
+	io->next = NULL;
+	*loop->pending_tail = io;
+	loop->pending_tail = &io->next;
+}
+
+uint64_t ev_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void ev_timer_init(struct ev_timer *t, void (*cb)(struct ev_timer *t))
+{
+	t->expire = 0;
+	t->idx = -1;
+	t->cb = cb;
+}
+
+int ev_timer_start(struct ev_loop *loop, struct ev_timer *t, unsigned ms)
+{
+	return ev_timer_start_at(loop, t, ev_now() + (uint64_t)ms * 1000000ULL);
+}
+
+int ev_timer_start_at(struct ev_loop *loop, struct ev_timer *t, uint64_t expire)
+{
+	struct ev_timer **heap;
+
+	if (t->idx >= 0) heap_remove(loop, t->idx);
+
+	if (loop->nheap == loop->heap_sz) {
+		heap = realloc(loop->heap,
+				(loop->heap_sz ? loop->heap_sz * 2 : 64) * sizeof(*heap));
+		if (heap == NULL) return -1;
+		loop->heap = heap;
+		loop->heap_sz = loop->heap_sz ? loop->heap_sz * 2 : 64;
+	}
+
+	t->expire = expire;
+	t->idx = loop->nheap++;
+	loop->heap[t->idx] = t;
+	heap_up(loop, t->idx);
+
+	if (loop->heap[0] == t) timerfd_rearm(loop);
+
+	return 0;
+}
+
+void ev_timer_stop(struct ev_loop *loop, struct ev_timer *t)
+{
+	/* a stale timerfd wakeup is harmless, so it is not disarmed here */
+	if (t->idx >= 0) heap_remove(loop, t->idx);
+}
+
+static void heap_swap(struct ev_loop *loop, int i, int j)
+{
+	struct ev_timer *t = loop->heap[i];
+
+	loop->heap[i] = loop->heap[j];
+	loop->heap[j] = t;
+	loop->heap[i]->idx = i;
+	loop->heap[j]->idx = j;
+}
+
+static void heap_up(struct ev_loop *loop, int i)
+{
+	while (i > 0 && loop->heap[(i - 1) / 2]->expire > loop->heap[i]->expire) {
+		heap_swap(loop, i, (i - 1) / 2);
+		i = (i - 1) / 2;
+	}
+}
+
+static void heap_down(struct ev_loop *loop, int i)
+{
+	int c;
+
+	while ((c = 2 * i + 1) < loop->nheap) {
+		if (c + 1 < loop->nheap && loop->heap[c + 1]->expire < loop->heap[c]->expire)
+			c++;
+		if (loop->heap[i]->expire <= loop->heap[c]->expire) break;
+		heap_swap(loop, i, c);
+		i = c;
+	}
+}
+
+static void heap_remove(struct ev_loop *loop, int i)
+{
+	struct ev_timer *t = loop->heap[i];
+
+	loop->nheap--;
+	if (i != loop->nheap) {
+		loop->heap[i] = loop->heap[loop->nheap];
+		loop->heap[i]->idx = i;
+		heap_up(loop, i);
+		heap_down(loop, loop->heap[i]->idx);
+	}
+	t->idx = -1;
+}
+
+static void timerfd_rearm(struct ev_loop *loop)
+{
+	struct itimerspec its;
+	uint64_t expire;
+
+	memset(&its, 0, sizeof(its));
+	expire = loop->nheap ? loop->heap[0]->expire : 0;
+	if (expire == loop->tio_expire) return;
+
+	if (expire) {
+		its.it_value.tv_sec = expire / 1000000000ULL;
+		its.it_value.tv_nsec = expire % 1000000000ULL;
+	}
+	timerfd_settime(loop->tio.fd, TFD_TIMER_ABSTIME, &its, NULL);
+	loop->syscalls++;
+	loop->tio_expire = expire;
+}
+
+static void ev_timer_cb(struct ev_io *io)
+{
+	struct ev_loop *loop = container_of(io, struct ev_loop, tio);
+	struct ev_timer *t;
+	uint64_t ticks, now;
+
+	if (io->state & EV_READABLE) {
+		while (loop->syscalls++, read(io->fd, &ticks, sizeof(ticks)) > 0)
+			;
+		io->state &= ~EV_READABLE;
+	}
+
+	now = ev_now();
+	while (loop->nheap && loop->heap[0]->expire <= now) {
+		t = loop->heap[0];
+		heap_remove(loop, 0);
+		t->cb(t);
+	}
+
+	loop->tio_expire = 0;
+	timerfd_rearm(loop);
+}
+
+int ev_run_once(struct ev_loop *loop)
+{
+	struct epoll_event events[EV_MAX_EVENTS];
+	struct ev_io *io, *list;
+	int i, n;
+
+	if (loop->prepare) loop->prepare(loop);
+
+	loop->syscalls++;
+	n = epoll_wait(loop->epfd, events, EV_MAX_EVENTS, loop->pending ? 0 : -1);
+	if (n < 0) return (errno == EINTR) ? 0 : -1;
+
+	for (i = 0; i < n; i++) {
+		io = events[i].data.ptr;
+		/* errors and hangups are reported through read() */
+		if (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+			io->state |= EV_READABLE;
+		if (events[i].events & EPOLLOUT)
+			io->state |= EV_WRITABLE;
+		ev_io_kick(loop, io);
+	}
+
+	/* run only what is pending now, callbacks re-kick for another round */
+	list = loop->pending;
+	loop->pending = NULL;
+	loop->pending_tail = &loop->pending;
+
+	while (list) {
+		io = list;
+		list = io->next;
+		io->next = NULL;
+		io->state &= ~EV_PENDING;
+		io->cb(io);
+	}
+
+	return n;
+}
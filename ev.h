@@ -0,0 +1,86 @@
+#ifndef __EV_H
+#define __EV_H
+
+/*
+ * Edge-triggered epoll event engine.
+ *
+ * Every watched descriptor is described by an ev_io. epoll reports readiness
+ * edges only, so the engine latches them into ev_io.state and the owner
+ * clears a flag once the matching read()/write() returns EAGAIN. Descriptors
+ * that still have work to do (latched flag, data queued, ...) are put on the
+ * loop's pending list and their callback is invoked once per loop iteration,
+ * which keeps the cost per event O(1) regardless of how many ports are owned.
+ *
+ * Timers live in a binary min-heap; a single timerfd armed to the earliest
+ * deadline is watched like any other descriptor, so expiring timers are
+ * serviced from the same epoll_wait() as port I/O.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define container_of(ptr, type, member) \
+	((type *)((char *)(ptr) - offsetof(type, member)))
+
+#define EV_READABLE	0x01	/* read() will not block until it returns EAGAIN */
+#define EV_WRITABLE	0x02	/* write() will not block until it returns EAGAIN */
+#define EV_PENDING	0x04	/* queued on the loop's pending list */
+
+#define EV_MAX_EVENTS	256
+
+struct ev_io {
+	int fd;
+	unsigned state;
+	void (*cb)(struct ev_io *io);
+	struct ev_io *next;
+};
+
+struct ev_timer {
+	uint64_t expire;	/* CLOCK_MONOTONIC, ns */
+	int idx;		/* position in the heap, -1 when not armed */
+	void (*cb)(struct ev_timer *t);
+};
+
+struct ev_loop {
+	int epfd;
+	struct ev_io *pending;
+	struct ev_io **pending_tail;
+
+	struct ev_io tio;	/* timerfd */
+	uint64_t tio_expire;	/* deadline the timerfd is armed to, 0 if none */
+	struct ev_timer **heap;
+	int nheap;
+	int heap_sz;
+
+	/* called before waiting for events, e.g. to submit batched requests */
+	void (*prepare)(struct ev_loop *loop);
+	/* system calls made by the loop and its owners, for statistics */
+	uint64_t syscalls;
+};
+
+int ev_loop_init(struct ev_loop *loop);
+void ev_loop_close(struct ev_loop *loop);
+
+/* an io that is only ever kicked, its descriptor is not watched */
+void ev_io_init(struct ev_io *io, int fd, void (*cb)(struct ev_io *io));
+int ev_io_add(struct ev_loop *loop, struct ev_io *io, int fd,
+		void (*cb)(struct ev_io *io));
+int ev_io_del(struct ev_loop *loop, struct ev_io *io);
+
+/* schedule io's callback for the next loop iteration */
+void ev_io_kick(struct ev_loop *loop, struct ev_io *io);
+
+void ev_timer_init(struct ev_timer *t, void (*cb)(struct ev_timer *t));
+/* (re)arm t to fire after ms milliseconds */
+int ev_timer_start(struct ev_loop *loop, struct ev_timer *t, unsigned ms);
+/* (re)arm t to fire at ev_now() time expire */
+int ev_timer_start_at(struct ev_loop *loop, struct ev_timer *t, uint64_t expire);
+void ev_timer_stop(struct ev_loop *loop, struct ev_timer *t);
+#define ev_timer_active(t) ((t)->idx >= 0)
+
+uint64_t ev_now(void);
+
+/* wait for events once and run the callbacks of all ready descriptors */
+int ev_run_once(struct ev_loop *loop);
+
+#endif /* __EV_H */
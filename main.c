@@ -3,73 +3,218 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <getopt.h>
+#include <pthread.h>
+#include <sched.h>
 #include <signal.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/eventfd.h>
+#include <sys/resource.h>
+#include <sys/signalfd.h>
+#include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
+#include "ev.h"
 #include "fdio.h"
 #include "main.h"
 #include "term.h"
+#include "session.h"
+#include "split.h"
+#include "stats.h"
+#include "uring.h"
+#include "urc.h"
+#include "cmux.h"
 #include "at.h"
 
-static int fd_tty;
-
 #define STO STDOUT_FILENO
 #define STI STDIN_FILENO
 #define TTY_WRITE_SZ_DIV 10
 #define TTY_WRITE_SZ_MIN 8
+#define TTY_WRITE_IOV 64
+/* paced output may run ahead of the line by this much, like a UART FIFO */
+#define TTY_PACE_SLICE_NS 10000000ULL
+#define PTY_DIR "/run/gustavd"
+#define MAX_WORKERS 1024
+#define SMS_ME_SLOTS 200
+#define SMS_MAX_SLOTS 1000000
+/* -i uring: ring size and read buffers shared by a worker's ports */
+#define URING_ENTRIES 256
+#define URING_BUFS 256
+/* read buffers a port may hold before it stops reading */
+#define PORT_PARK 4
 
-struct tty_q {
-	int len;
-	char buff[TTY_Q_SZ];
-} tty_q;
+/*
+ * A thread with its own event loop serving a shard of the ports. Nothing
+ * on the AT path is shared between workers: sessions, output queue pools
+ * and statistics blocks are all per worker, so lines are processed without
+ * any lock. The main thread is worker 0 and also serves signals and the
+ * statistics socket.
+ */
+struct worker {
+	pthread_t tid;
+	struct ev_loop loop;
+	int idx;
+	int cpu;		/* pinned to, -1 if not */
+	int nports;
+	/* profile to switch to, handed over by profile_reload() */
+	struct at_profile *next_prof;
+	struct ev_io wake;	/* eventfd, next_prof was set */
+	/* -i uring, fd is -1 on epoll */
+	struct uring uring;
+	struct port_park *park;	/* by buffer id, see port_park() */
+	struct port *starved;	/* ports waiting for a read buffer */
+};
+
+/* a read buffer holding input a port has not taken yet */
+struct port_park {
+	int next;		/* buffer id, -1 at the end */
+	unsigned len;
+};
 
-int tty_write_sz;
-#define set_tty_write_sz(baud) \
+struct port {
+	struct ev_io io;
+	struct worker *w;
+	const char *name;
+	char *link;		/* symlink published for a pty, NULL otherwise */
+	int tty_fd;		/* pty slave, kept open so the master never hangs up */
+	int write_sz;
+	/* output pacing, see port_budget() */
+	unsigned baud;		/* 0 if not paced */
+	unsigned char_bits;	/* start, data, parity and stop bits */
+	uint64_t slice_ns;	/* line time the bucket holds, a character at least */
+	uint64_t line_free;	/* when the line is done with what was written, ns */
+	struct ev_timer pace;
+	struct session sess;
+	/* AT+CMUX was accepted, the port carries frames of these */
+	struct cmux *mux;
+	/*
+	 * -i uring: the port is never watched by epoll, reads and writes are
+	 * requests on the worker's ring and port_uring_cb() is kicked when
+	 * one completes
+	 */
+	struct uring_req rd;
+	struct uring_req wr;
+	int rd_armed;		/* a read is in flight */
+	int rd_cancel;		/* and is being cancelled */
+	int wr_busy;		/* a write is in flight */
+	uint64_t wr_now;	/* ev_now() when it was issued, if paced */
+	struct iovec wr_iov[TTY_WRITE_IOV];
+	int park_head;		/* received buffers, -1 if none */
+	int park_tail;
+	unsigned park_off;	/* taken from the first one */
+	int npark;
+	struct port *starved;	/* next on the worker's list */
+	int is_starved;
+};
+
+#define set_tty_write_sz(p, baud) \
 	do { \
-		tty_write_sz = (baud) / TTY_WRITE_SZ_DIV; \
-		if (tty_write_sz < TTY_WRITE_SZ_MIN) tty_write_sz = TTY_WRITE_SZ_MIN; \
+		(p)->write_sz = (baud) / TTY_WRITE_SZ_DIV; \
+		if ((p)->write_sz < TTY_WRITE_SZ_MIN) (p)->write_sz = TTY_WRITE_SZ_MIN; \
 	} while (0)
-struct tty_q tty_q;
+
+static struct worker *workers;
+static struct port *ports;
+/* SIGHUP, delivered through a signalfd */
+static struct ev_io sig_io = { .fd = -1 };
 
 int sig_exit = 0;
 
 static struct {
-	char port[128];
+	char **port;
+	int nports;
 	int baud;
 	enum flowcntrl_e flow;
 	enum parity_e parity;
 	int databits;
 	int stopbits;
 	int noreset;
+	int nopace;
+	int hwm;
+	int nptys;
+	char *pty_dir;
+	char *profile;
 	char *socket;
+	int nworkers;
+	int *cpus;
+	int ncpus;
+	unsigned sms_slots;
+	unsigned sms_fill;
+	char *sms_dir;
+	int uring;
 } opts = {
-	.port = "",
+	.port = NULL,
+	.nports = 0,
 	.baud = 115200,
 	.flow = FC_NONE,
 	.parity = P_NONE,
 	.databits = 8,
 	.stopbits = 1,
 	.noreset = 0,
-	.socket = NULL, /* the library fall back to default socket when it is NULL */
+	.nopace = 0,
+	.hwm = TTY_Q_HWM,
+	.nptys = 0,
+	.pty_dir = PTY_DIR,
+	.profile = NULL,
+	.socket = NULL, /* no statistics socket */
+	.nworkers = 1,
+	.cpus = NULL, /* not pinned */
+	.ncpus = 0,
+	.sms_slots = SMS_ME_SLOTS,
+	.sms_fill = 0,
+	.sms_dir = NULL, /* in memory */
+	.uring = 0, /* epoll */
 };
 
 static void show_usage(void);
+static int parse_cpus(const char *s);
 static void parse_args(int argc, char *argv[]);
 static void deadly_handler(int signum);
 static void register_signal_handlers(void);
-static void loop(void);
-static void tty_read_line_splitter(const int n, const char *buff_rd);
-static void tty_read_line_cb(const char *line);
+static void sig_open(void);
+static void sig_cb(struct ev_io *io);
+static void profile_reload(void);
+static void worker_init(struct worker *w, int idx);
+static void worker_prepare(struct ev_loop *loop);
+static void worker_pin(struct worker *w);
+static struct worker *worker_pick(void);
+static void worker_switch(struct worker *w);
+static void worker_wake_cb(struct ev_io *io);
+static void *worker_run(void *arg);
+static void loop(struct worker *w);
+static void port_open(struct port *p, const char *name);
+static void pty_open(struct port *p, int idx);
+static void port_setup(struct port *p, const char *name, int fd, int tty_fd);
+static void port_close(struct port *p);
+static void port_io_cb(struct ev_io *io);
+static int port_held(struct port *p);
+static int port_input(struct port *p, char *buf, int n);
+static void port_read(struct port *p);
+static void port_write(struct port *p);
+static void port_written(struct port *p, int n, uint64_t now);
+static void port_uring_cb(struct ev_io *io);
+static void port_rd_cb(struct uring_req *r, int res, unsigned flags);
+static void port_wr_cb(struct uring_req *r, int res, unsigned flags);
+static void port_park(struct port *p, unsigned flags, unsigned len);
+static void port_unpark(struct port *p);
+static void port_uring_read(struct port *p);
+static void port_uring_write(struct port *p);
+static void port_kick(struct session *s);
+static void port_pace_init(struct port *p);
+static size_t port_budget(struct port *p, uint64_t now);
+static void port_pace_wait(struct port *p, uint64_t now);
+static void port_pace_cb(struct ev_timer *t);
+static void tty_queued(struct session *s, size_t len, size_t over);
+static int tty_read_line_cb(struct splitter *sp, char *line, int len);
 int main(int argc, char *argv[]);
 
 static void show_usage()
 {
-	printf("Usage: gustavd [options] <TTY device>\n");
+	printf("Usage: gustavd [options] [<TTY device> ...]\n");
 	printf("\n");
 	printf("Options:\n");
 	printf("  -b <baudrate>\n");
@@ -78,6 +223,36 @@ static void show_usage()
 	printf("    default to 115200\n");
 	printf("  -f flow control s (=soft) | h (=hard) | n (=none)\n");
 	printf("    default to n\n");
+	printf("  -q <bytes>\n");
+	printf("    output queue high-water mark, AT commands are not processed\n");
+	printf("    while a port has more output pending, default to %d\n", TTY_Q_HWM);
+	printf("  -u\n");
+	printf("    write output as fast as the port takes it, do not pace it at\n");
+	printf("    the baud rate\n");
+	printf("  -n <count>\n");
+	printf("    also serve <count> pseudo terminals, published as <dir>/modem<N>\n");
+	printf("  -p <image>\n");
+	printf("    modem profile compiled by profc, reloaded on SIGHUP\n");
+	printf("  -s <path>\n");
+	printf("    serve statistics on a Unix socket, e.g. socat - UNIX:<path>\n");
+	printf("  -d <dir>\n");
+	printf("    directory of the pty links, default to %s\n", PTY_DIR);
+	printf("  -m <slots>[,<fill>]\n");
+	printf("    SMS ME storage of <slots> messages, default to %d, <fill> of them\n", SMS_ME_SLOTS);
+	printf("    filled with received messages\n");
+	printf("  -M <dir>\n");
+	printf("    keep the SMS storages in files in <dir> across restarts\n");
+	printf("  -w <count>\n");
+	printf("    serve the ports from <count> threads, default to 1\n");
+	printf("  -a <cpus>\n");
+	printf("    pin the threads to these CPUs in turn, e.g. 0-3,8\n");
+	printf("  -U <urc>,<rate>[,<pattern>[,<burst>]]\n");
+	printf("    send <urc> (ring, cmti, creg, cereg, qind) unsolicited <rate> times\n");
+	printf("    a second on every port; <pattern> is periodic (default), poisson or\n");
+	printf("    burst, bursts of <burst> URCs; may be given up to %d times\n", URC_MAX);
+	printf("  -i <backend>\n");
+	printf("    tty I/O through epoll (default) or uring, io_uring with batched\n");
+	printf("    submission and multishot reads; epoll if the kernel lacks it\n");
 	printf("\n");
 }
 
@@ -104,12 +279,37 @@ void fatal(const char *format, ...)
 	exit(EXIT_FAILURE);
 }
 
+/* a list of CPUs like 0-3,8 into opts.cpus */
+static int parse_cpus(const char *s)
+{
+	char *end;
+	long lo, hi;
+
+	do {
+		lo = hi = strtol(s, &end, 10);
+		if (end == s || lo < 0 || lo >= CPU_SETSIZE) return -1;
+		if (*end == '-') {
+			s = end + 1;
+			hi = strtol(s, &end, 10);
+			if (end == s || hi < lo || hi >= CPU_SETSIZE) return -1;
+		}
+		for (; lo <= hi; lo++) {
+			opts.cpus = realloc(opts.cpus, (opts.ncpus + 1) * sizeof(*opts.cpus));
+			if (opts.cpus == NULL) fatal("out of memory");
+			opts.cpus[opts.ncpus++] = lo;
+		}
+		s = end + 1;
+	} while (*end == ',');
+
+	return *end ? -1 : 0;
+}
+
 static void parse_args(int argc, char *argv[])
 {
 	int c;
 	int r = 0;
 
-	while ((c = getopt(argc, argv, "hf:b:s:")) != -1) {
+	while ((c = getopt(argc, argv, "hf:b:q:un:d:p:s:m:M:w:a:U:i:")) != -1) {
 		switch (c) {
 			case 'f':
 				switch (optarg[0]) {
@@ -138,9 +338,71 @@ static void parse_args(int argc, char *argv[])
 					r = -1;
 				}
 				break;
+			case 'q':
+				opts.hwm = atoi(optarg);
+				if (opts.hwm <= 0) {
+					DPRINTF("Invalid high-water mark: %s\n", optarg);
+					r = -1;
+				}
+				break;
+			case 'u':
+				opts.nopace = 1;
+				break;
+			case 'n':
+				opts.nptys = atoi(optarg);
+				if (opts.nptys <= 0) {
+					DPRINTF("Invalid pty count: %s\n", optarg);
+					r = -1;
+				}
+				break;
+			case 'd':
+				opts.pty_dir = optarg;
+				break;
+			case 'p':
+				opts.profile = optarg;
+				break;
 			case 's':
 				opts.socket = optarg;
 				break;
+			case 'm':
+				c = sscanf(optarg, "%u,%u", &opts.sms_slots, &opts.sms_fill);
+				if (c < 1 || !opts.sms_slots || opts.sms_slots > SMS_MAX_SLOTS) {
+					DPRINTF("Invalid SMS storage: %s\n", optarg);
+					r = -1;
+				}
+				break;
+			case 'M':
+				opts.sms_dir = optarg;
+				break;
+			case 'w':
+				opts.nworkers = atoi(optarg);
+				if (opts.nworkers <= 0 || opts.nworkers > MAX_WORKERS) {
+					DPRINTF("Invalid thread count: %s\n", optarg);
+					r = -1;
+				}
+				break;
+			case 'a':
+				if (parse_cpus(optarg) < 0) {
+					DPRINTF("Invalid CPU list: %s\n", optarg);
+					r = -1;
+				}
+				break;
+			case 'U':
+				if (urc_add(optarg) < 0) {
+					DPRINTF("Invalid URC stream: %s\n", optarg);
+					r = -1;
+				}
+				break;
+			case 'i':
+				if (!strcmp(optarg, "uring")) {
+					opts.uring = 1;
+				} else if (!strcmp(optarg, "epoll")) {
+					opts.uring = 0;
+				} else {
+					DPRINTF("Invalid I/O backend: %s\n", optarg);
+					r = -1;
+				}
+				break;
 			case 'h':
 				r = 1;
 				break;
@@ -155,27 +417,28 @@ static void parse_args(int argc, char *argv[])
 		exit((r > 0) ? EXIT_SUCCESS : EXIT_FAILURE);
 	}
 
-	if ((argc - optind) < 1) {
+	if ((argc - optind) < 1 && !opts.nptys) {
 		DPRINTF("No port given\n");
 		show_usage();
 		exit(EXIT_FAILURE);
 	}
 
-	strncpy(opts.port, argv[optind], sizeof(opts.port) - 1);
-	opts.port[sizeof(opts.port)-1] = '\0';
+	opts.port = argv + optind;
+	opts.nports = argc - optind;
 }
 
 static void deadly_handler(int signum)
 {
 	DPRINTF("gustavd is signaled with TERM\n");
 	if (!sig_exit) {
-		sig_exit = 1;
+		__atomic_store_n(&sig_exit, 1, __ATOMIC_RELAXED);
 	}
 }
 
 static void register_signal_handlers(void)
 {
 	struct sigaction exit_action, ign_action;
+	sigset_t mask;
 
 	/* Set up the structure to specify the exit action. */
 	exit_action.sa_handler = deadly_handler;
@@ -190,132 +453,258 @@ static void register_signal_handlers(void)
 	sigaction(SIGTERM, &exit_action, NULL);
 
 	sigaction(SIGALRM, &ign_action, NULL);
-	sigaction(SIGHUP, &ign_action, NULL);
 	//sigaction(SIGINT, &ign_action, NULL);
 	sigaction(SIGPIPE, &ign_action, NULL);
 	sigaction(SIGQUIT, &ign_action, NULL);
 	sigaction(SIGUSR1, &ign_action, NULL);
 	sigaction(SIGUSR2, &ign_action, NULL);
+
+	/* SIGHUP reloads the profile, it is read from the event loop */
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGHUP);
+	sigprocmask(SIG_BLOCK, &mask, NULL);
 }
 
-static void loop(void)
+static void sig_open(void)
 {
-	fd_set rdset, wrset;
-	int r;
-	int n;
-	char buff_rd[TTY_RD_SZ];
-	int write_sz;
-	int max_fd;
-
-	max_fd = fd_tty;
-	tty_q.len = 0;
+	sigset_t mask;
+	int fd;
 
-	while (!sig_exit) {
-		FD_ZERO(&rdset);
-		FD_ZERO(&wrset);
-		FD_SET(fd_tty, &rdset);
-
-		if (tty_q.len) FD_SET(fd_tty, &wrset);
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGHUP);
+	fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+	if (fd < 0 || ev_io_add(&workers[0].loop, &sig_io, fd, sig_cb) < 0)
+		fatal("cannot watch signals: %s", strerror(errno));
+}
 
-		r = select(max_fd + 1, &rdset, &wrset, NULL, NULL);
-		if (r < 0)  {
-			if (errno == EINTR) continue;
-			else fatal("select failed: %d : %s", errno, strerror(errno));
-		}
+static void sig_cb(struct ev_io *io)
+{
+	struct signalfd_siginfo si;
+	int n, hup = 0;
 
-		if (FD_ISSET(fd_tty, &rdset)) {
-			/* read from port */
-			do {
-				n = read(fd_tty, &buff_rd, sizeof(buff_rd));
-			} while (n < 0 && errno == EINTR);
-			if (n == 0) {
-				fatal("term closed");
-			} else if (n < 0) {
-				if (errno != EAGAIN && errno != EWOULDBLOCK)
-					fatal("read from term failed: %s", strerror(errno));
-			} else {
-				tty_read_line_splitter(n, buff_rd);
-			}
-		}
+	if (!(io->state & EV_READABLE)) return;
 
-		if (FD_ISSET(fd_tty, &wrset)) {
-			/* write to port */
-			write_sz = (tty_q.len < tty_write_sz) ? tty_q.len : tty_write_sz;
-			do {
-				n = write(fd_tty, tty_q.buff, write_sz);
-			} while (n < 0 && errno == EINTR);
-			if (n <= 0) fatal("write to term failed: %s", strerror(errno));
-			memmove(tty_q.buff, tty_q.buff + n, tty_q.len - n);
-			tty_q.len -= n;
-		}
+	for (;;) {
+		n = read(io->fd, &si, sizeof(si));
+		if (n < 0 && errno == EINTR) continue;
+		if (n != sizeof(si)) break;
+		if (si.ssi_signo == SIGHUP) hup = 1;
 	}
+	io->state &= ~EV_READABLE;
+
+	/* a burst of SIGHUPs is one reload */
+	if (hup) profile_reload();
 }
 
-static void tty_read_line_splitter(const int n, const char *buff_rd)
+/*
+ * Swap in the profile given with -p again, e.g. after profc replaced it.
+ * Every worker switches over in its own loop. Sessions keep running:
+ * whatever they have queued or deferred still refers to the old profile,
+ * which is unmapped once all of them are done.
+ */
+static void profile_reload(void)
 {
-	static char buff[TTY_RD_SZ+1] = "";
-	static int buff_len = 0;
-	const char *p;
+	struct at_profile *p, *old;
+	uint64_t one = 1;
+	int i;
 
-	p = buff_rd;
+	if (opts.profile == NULL) {
+		DPRINTF("SIGHUP: no profile to reload\n");
+		return;
+	}
 
-	while (p - buff_rd < n) {
-			if (buff_len == sizeof(buff) - 1) {
-				tty_read_line_cb(buff);
-				*buff = '\0';
-				buff_len = 0;
-			}
-			if (*p && *p != '\r' && *p != '\n') {
-				buff[buff_len] = *p;
-				buff[++buff_len] = '\0';
-			} else if ((!*p || *p == '\n' || *p == '\r') && buff_len > 0) {
-				tty_read_line_cb(buff);
-				*buff = '\0';
-				buff_len = 0;
-			}
+	p = at_profile_open(opts.profile);
+	if (p == NULL) {
+		DPRINTF("cannot reload profile %s: %s, keeping the old one\n",
+				opts.profile, strerror(errno));
+		return;
+	}
+	DPRINTF("profile %s reloaded\n", opts.profile);
 
-			p++;
+	for (i = 0; i < opts.nworkers; i++) {
+		at_profile_hold(p);
+		/* a worker that has not picked up the last one skips it */
+		old = __atomic_exchange_n(&workers[i].next_prof, p, __ATOMIC_ACQ_REL);
+		if (old) at_profile_put(old);
+		if (i && write(workers[i].wake.fd, &one, sizeof(one)) < 0)
+			DPRINTF("cannot wake worker %d: %s\n", i, strerror(errno));
 	}
+	at_profile_put(p);
+
+	worker_switch(&workers[0]);
 }
 
-void tty_write_line(const char *line)
+static void worker_init(struct worker *w, int idx)
 {
-	if( line == NULL )
-	{
+	int fd;
+
+	w->idx = idx;
+	w->cpu = opts.ncpus ? opts.cpus[idx % opts.ncpus] : -1;
+	w->nports = 0;
+	w->next_prof = NULL;
+
+	if (ev_loop_init(&w->loop) < 0)
+		fatal("epoll_create failed: %s", strerror(errno));
+
+	fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (fd < 0 || ev_io_add(&w->loop, &w->wake, fd, worker_wake_cb) < 0)
+		fatal("cannot create worker %d: %s", idx, strerror(errno));
+
+	w->uring.fd = -1;
+	w->starved = NULL;
+	if (!opts.uring) return;
+
+	w->park = malloc(URING_BUFS * sizeof(*w->park));
+	if (w->park == NULL) fatal("out of memory");
+	if (uring_open(&w->uring, &w->loop, URING_ENTRIES, URING_BUFS, TTY_RD_BUF) < 0) {
+		DPRINTF("io_uring unavailable (%s), using epoll\n", strerror(errno));
+		free(w->park);
+		w->park = NULL;
+		opts.uring = 0;
 		return;
 	}
+	w->loop.prepare = worker_prepare;
+	if (!idx && !w->uring.multishot)
+		DPRINTF("no multishot reads, one io_uring read per buffer\n");
+}
 
-	const int len = strlen(line);
+/* requests queued by this round's callbacks go in with one system call */
+static void worker_prepare(struct ev_loop *loop)
+{
+	struct worker *w = container_of(loop, struct worker, loop);
 
-	if (tty_q.len + len < TTY_Q_SZ) {
-		memmove(tty_q.buff + tty_q.len, line, len);
-		tty_q.len += len;
-		tty_q.buff[tty_q.len] = '\n';
-		++tty_q.len;
-		tty_q.buff[tty_q.len] = '\r';
-		++tty_q.len;
-	}
+	uring_submit(&w->uring);
 }
 
-static void tty_read_line_cb(const char *line)
+static void worker_pin(struct worker *w)
 {
-	at_read_line_cb(line);
+	cpu_set_t set;
+	int r;
+
+	if (w->cpu < 0) return;
+
+	CPU_ZERO(&set);
+	CPU_SET(w->cpu, &set);
+	r = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+	if (r) DPRINTF("cannot pin worker %d to CPU %d: %s\n", w->idx, w->cpu, strerror(r));
 }
 
-int main(int argc, char *argv[])
+/* ports never move, the worker with the fewest ports is the least loaded */
+static struct worker *worker_pick(void)
+{
+	struct worker *w = &workers[0];
+	int i;
+
+	for (i = 1; i < opts.nworkers; i++)
+		if (workers[i].nports < w->nports) w = &workers[i];
+
+	return w;
+}
+
+/* take over the profile handed to the worker, if any */
+static void worker_switch(struct worker *w)
+{
+	struct at_profile *p;
+	int i;
+
+	p = __atomic_exchange_n(&w->next_prof, NULL, __ATOMIC_ACQ_REL);
+	if (p == NULL) return;
+
+	at_profile_use(p);
+
+	for (i = 0; i < opts.nports + opts.nptys; i++)
+		if (ports[i].w == w) at_session_release(&ports[i].sess);
+}
+
+static void worker_wake_cb(struct ev_io *io)
+{
+	struct worker *w = container_of(io, struct worker, wake);
+	uint64_t n;
+
+	if (!(io->state & EV_READABLE)) return;
+
+	while (read(io->fd, &n, sizeof(n)) < 0 && errno == EINTR)
+		;
+	io->state &= ~EV_READABLE;
+
+	worker_switch(w);
+}
+
+static void *worker_run(void *arg)
+{
+	struct worker *w = arg;
+
+	worker_pin(w);
+	if (stats_thread_init() < 0) fatal("out of memory");
+	worker_switch(w);
+
+	loop(w);
+
+	return NULL;
+}
+
+static void loop(struct worker *w)
 {
 	int r;
 
-	parse_args(argc, argv);
-	register_signal_handlers();
+	while (!__atomic_load_n(&sig_exit, __ATOMIC_RELAXED)) {
+		r = ev_run_once(&w->loop);
+		if (r < 0) fatal("epoll failed: %d : %s", errno, strerror(errno));
+		__atomic_store_n(&stats_self->syscalls, w->loop.syscalls, __ATOMIC_RELAXED);
+	}
+}
 
-	r = term_lib_init();
-	if (r < 0) fatal("term_init failed: %s", term_strerror(term_errno, errno));
+static void port_open(struct port *p, const char *name)
+{
+	int fd;
+
+	fd = open(name, O_RDWR | O_NONBLOCK | O_NOCTTY);
+	if (fd < 0) fatal("cannot open %s: %s", name, strerror(errno));
 
-	fd_tty = open(opts.port, O_RDWR | O_NONBLOCK | O_NOCTTY);
-	if (fd_tty < 0) fatal("cannot open %s: %s", opts.port, strerror(errno));
+	port_setup(p, name, fd, fd);
+}
+
+static void pty_open(struct port *p, int idx)
+{
+	char name[64];
+	int fd, tty_fd;
+
+	fd = posix_openpt(O_RDWR | O_NONBLOCK | O_NOCTTY | O_CLOEXEC);
+	if (fd < 0) fatal("cannot allocate a pty: %s", strerror(errno));
+
+	if (grantpt(fd) < 0 || unlockpt(fd) < 0 || ptsname_r(fd, name, sizeof(name)))
+		fatal("cannot unlock pty: %s", strerror(errno));
+
+	tty_fd = open(name, O_RDWR | O_NONBLOCK | O_NOCTTY | O_CLOEXEC);
+	if (tty_fd < 0) fatal("cannot open %s: %s", name, strerror(errno));
+
+	if (asprintf(&p->link, "%s/modem%d", opts.pty_dir, idx) < 0)
+		fatal("out of memory");
+	unlink(p->link);
+	if (symlink(name, p->link) < 0)
+		fatal("cannot link %s: %s", p->link, strerror(errno));
+
+	/* the line settings live in the slave, clients see them there */
+	port_setup(p, p->link, fd, tty_fd);
+}
 
-	r = term_set(fd_tty,
+static void port_setup(struct port *p, const char *name, int fd, int tty_fd)
+{
+	int r;
+
+	p->name = name;
+	p->tty_fd = tty_fd;
+	p->w = worker_pick();
+	p->w->nports++;
+	at_session_init(&p->sess, &p->w->loop);
+	p->sess.q.hwm = opts.hwm;
+	p->sess.split.cb = tty_read_line_cb;
+	p->sess.kick = port_kick;
+	p->sess.owner = p;
+	p->sess.name = name;
+	p->mux = NULL;
+
+	r = term_set(tty_fd,
 			1,              /* raw mode. */
 			opts.baud,      /* baud rate. */
 			opts.parity,    /* parity. */
@@ -326,18 +715,540 @@ int main(int argc, char *argv[])
 			!opts.noreset); /* hup-on-close. */
 	if (r < 0) {
 		fatal("failed to add device %s: %s",
-				opts.port, term_strerror(term_errno, errno));
+				name, term_strerror(term_errno, errno));
 	}
 
-	r = term_apply(fd_tty, 0);
+	r = term_apply(tty_fd, 0);
 	if (r < 0) {
 		fatal("failed to config device %s: %s",
-				opts.port, term_strerror(term_errno, errno));
+				name, term_strerror(term_errno, errno));
+	}
+
+	set_tty_write_sz(p, term_get_baudrate(tty_fd, NULL));
+	port_pace_init(p);
+
+	if (p->w->uring.fd >= 0) {
+		p->rd.cb = port_rd_cb;
+		p->wr.cb = port_wr_cb;
+		p->park_head = -1;
+		/* the first round arms the read */
+		ev_io_init(&p->io, fd, port_uring_cb);
+		ev_io_kick(&p->w->loop, &p->io);
+		return;
+	}
+
+	r = ev_io_add(&p->w->loop, &p->io, fd, port_io_cb);
+	if (r < 0) fatal("cannot watch %s: %s", name, strerror(errno));
+}
+
+static void port_close(struct port *p)
+{
+	if (p->sess.q.over) {
+		DPRINTF("%s: %zu bytes queued beyond %d\n",
+				p->name, p->sess.q.over, TTY_Q_SZ);
+	}
+
+	if (p->link) {
+		unlink(p->link);
+		free(p->link);
+		p->link = NULL;
+	}
+
+	if (p->mux) {
+		cmux_close(p->mux);
+		p->mux = NULL;
+	}
+	at_session_close(&p->sess);
+}
+
+static void port_io_cb(struct ev_io *io)
+{
+	struct port *p = container_of(io, struct port, io);
+	struct session *s = &p->sess;
+	int n;
+
+	/* DLCs go on first, they may take held input */
+	if (p->mux) cmux_run(p->mux);
+
+	/* input held back by a deferred response or a full queue goes first */
+	if (s->rx_len && !port_held(p)) {
+		n = port_input(p, s->rx, s->rx_len);
+		memmove(s->rx, s->rx + n, s->rx_len - n);
+		s->rx_len -= n;
+	}
+
+	/* one read and one write per round keeps the ports fair to each other */
+	if ((io->state & EV_READABLE) && !s->rx_len && !port_held(p))
+		port_read(p);
+	/* frame what the DLCs answered */
+	if (p->mux) cmux_run(p->mux);
+	if ((io->state & EV_WRITABLE) && !outq_empty(&s->q)) port_write(p);
+
+	/* paced output waits for its timer */
+	if ((((io->state & EV_READABLE) || s->rx_len) && !port_held(p)) ||
+			((io->state & EV_WRITABLE) && !outq_empty(&s->q) && !ev_timer_active(&p->pace)))
+		ev_io_kick(&p->w->loop, io);
+}
+
+/* no more input may be taken for now */
+static int port_held(struct port *p)
+{
+	return p->mux ? cmux_held(p->mux) : session_held(&p->sess);
+}
+
+/* hand input to the AT layer or the multiplexer, returns the bytes taken */
+static int port_input(struct port *p, char *buf, int n)
+{
+	struct session *s = &p->sess;
+	int c = 0;
+
+	if (p->mux == NULL) {
+		c = split_feed(&s->split, buf, n);
+		if (!s->cmux_n1) return c;
+
+		/* AT+CMUX was accepted, what follows is framed */
+		p->mux = cmux_open(s, s->cmux_n1);
+		if (p->mux == NULL) fatal("out of memory");
 	}
 
-	set_tty_write_sz(term_get_baudrate(fd_tty, NULL));
+	c += cmux_feed(p->mux, buf + c, n - c);
+	if (p->mux->closed) {
+		cmux_close(p->mux);
+		p->mux = NULL;
+		s->cmux_n1 = 0;
+		c += port_input(p, buf + c, n - c);
+	}
+
+	return c;
+}
+
+static void port_kick(struct session *s)
+{
+	struct port *p = s->owner;
+
+	ev_io_kick(&p->w->loop, &p->io);
+}
+
+static void port_pace_init(struct port *p)
+{
+	int baud, databits, stopbits;
+
+	ev_timer_init(&p->pace, port_pace_cb);
+	p->line_free = 0;
+	p->baud = 0;
+
+	baud = term_get_baudrate(p->tty_fd, NULL);
+	databits = term_get_databits(p->tty_fd);
+	stopbits = term_get_stopbits(p->tty_fd);
+	if (opts.nopace || baud <= 0 || databits <= 0 || stopbits <= 0) return;
+
+	p->baud = baud;
+	p->char_bits = 1 + databits + (term_get_parity(p->tty_fd) != P_NONE) + stopbits;
+	/* at slow rates a slice is shorter than a character, which would never fit */
+	p->slice_ns = ((uint64_t)p->char_bits * 1000000000ULL + baud - 1) / baud;
+	if (p->slice_ns < TTY_PACE_SLICE_NS) p->slice_ns = TTY_PACE_SLICE_NS;
+}
+
+/*
+ * Bytes that may be written now. Paced output is a token bucket holding
+ * one slice of line time, or one character's if that is longer: like a
+ * UART FIFO it takes what the line sends within a slice, and refills at
+ * the baud rate.
+ */
+static size_t port_budget(struct port *p, uint64_t now)
+{
+	uint64_t busy;
+
+	if (!p->baud) return p->write_sz;
+
+	busy = (p->line_free > now) ? p->line_free - now : 0;
+	if (busy >= p->slice_ns) return 0;
+
+	return (p->slice_ns - busy) * p->baud / (p->char_bits * 1000000000ULL);
+}
+
+/* come back once the bucket holds half a slice or what is queued */
+static void port_pace_wait(struct port *p, uint64_t now)
+{
+	uint64_t want, at;
+
+	if (ev_timer_active(&p->pace)) return;
+
+	want = p->slice_ns * p->baud / (p->char_bits * 1000000000ULL) / 2;
+	if (!p->sess.q.nsrc && want > outq_len(&p->sess.q)) want = outq_len(&p->sess.q);
+	if (want < 1) want = 1;
+
+	at = p->line_free - p->slice_ns +
+		(want * p->char_bits * 1000000000ULL + p->baud - 1) / p->baud;
+	ev_timer_start_at(&p->w->loop, &p->pace, (at > now) ? at : now);
+}
+
+static void port_pace_cb(struct ev_timer *t)
+{
+	struct port *p = container_of(t, struct port, pace);
+
+	ev_io_kick(&p->w->loop, &p->io);
+}
+
+static void port_read(struct port *p)
+{
+	char buff_rd[TTY_RD_BUF];
+	int n, c;
+
+	do {
+		p->w->loop.syscalls++;
+		n = read(p->io.fd, &buff_rd, sizeof(buff_rd));
+	} while (n < 0 && errno == EINTR);
+	if (n == 0) {
+		fatal("term %s closed", p->name);
+	} else if (n < 0) {
+		if (errno != EAGAIN && errno != EWOULDBLOCK)
+			fatal("read from term %s failed: %s", p->name, strerror(errno));
+		p->io.state &= ~EV_READABLE;
+	} else {
+		stats_add(stats_self->bytes_in, n);
+		c = port_input(p, buff_rd, n);
+		memcpy(p->sess.rx, buff_rd + c, n - c);
+		p->sess.rx_len = n - c;
+	}
+}
+
+static void port_write(struct port *p)
+{
+	struct iovec iov[TTY_WRITE_IOV];
+	uint64_t now = 0;
+	size_t max;
+	int iovcnt;
+	int n;
+
+	if (p->baud) now = ev_now();
+	max = port_budget(p, now);
+	if (!max) {
+		port_pace_wait(p, now);
+		return;
+	}
+
+	iovcnt = outq_iov(&p->sess.q, iov, TTY_WRITE_IOV, max);
+	do {
+		p->w->loop.syscalls++;
+		n = writev(p->io.fd, iov, iovcnt);
+	} while (n < 0 && errno == EINTR);
+	if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+		p->io.state &= ~EV_WRITABLE;
+		return;
+	}
+	if (n <= 0) fatal("write to term %s failed: %s", p->name, strerror(errno));
+	port_written(p, n, now);
+}
+
+/* n bytes of the queue were written at now */
+static void port_written(struct port *p, int n, uint64_t now)
+{
+	size_t queued = outq_len(&p->sess.q);
+
+	outq_consume(&p->sess.q, n);
+	if (p->baud) {
+		/* the line sends it after what it still has to send */
+		if (p->line_free < now) p->line_free = now;
+		p->line_free += ((uint64_t)n * p->char_bits * 1000000000ULL + p->baud - 1) / p->baud;
+		if (!outq_empty(&p->sess.q)) port_pace_wait(p, now);
+	}
+	stats_add(stats_self->bytes_out, n);
+	/* what came from a source was never counted as queued */
+	stats_add(stats_self->queued, outq_len(&p->sess.q) - queued);
+	stats_written(&p->sess);
+	at_session_written(&p->sess);
+}
+
+/*
+ * A round of a port on io_uring, kicked when a request completed or output
+ * was queued. Like port_io_cb(), it takes one buffer of input and issues
+ * at most one write, so a busy port cannot starve the others of the worker.
+ */
+static void port_uring_cb(struct ev_io *io)
+{
+	struct port *p = container_of(io, struct port, io);
+
+	if (p->mux) cmux_run(p->mux);
+
+	if (p->npark && !port_held(p)) port_unpark(p);
+	port_uring_read(p);
+
+	if (p->mux) cmux_run(p->mux);
+	port_uring_write(p);
+
+	if (p->npark && !port_held(p)) ev_io_kick(&p->w->loop, io);
+}
+
+/* keep reading while the port takes input, stop while it holds it */
+static void port_uring_read(struct port *p)
+{
+	struct worker *w = p->w;
+	int want = !port_held(p) && p->npark < PORT_PARK;
+
+	if (want && !p->rd_armed && !p->is_starved) {
+		uring_read(&w->uring, &p->rd, p->io.fd);
+		p->rd_armed = 1;
+	} else if (!want && p->rd_armed && !p->rd_cancel && w->uring.multishot) {
+		/* what completes meanwhile is parked */
+		uring_cancel(&w->uring, &p->rd);
+		p->rd_cancel = 1;
+	}
+}
+
+static void port_rd_cb(struct uring_req *r, int res, unsigned flags)
+{
+	struct port *p = container_of(r, struct port, rd);
+	struct worker *w = p->w;
+
+	if (!(flags & IORING_CQE_F_MORE)) p->rd_armed = p->rd_cancel = 0;
+
+	if (res > 0) {
+		stats_add(stats_self->bytes_in, res);
+		port_park(p, flags, res);
+	} else if (res == -ENOBUFS) {
+		/* all buffers are parked, read again once one comes back */
+		if (!p->is_starved) {
+			p->is_starved = 1;
+			p->starved = w->starved;
+			w->starved = p;
+		}
+		return;
+	} else if (res == 0) {
+		fatal("term %s closed", p->name);
+	} else if (res != -ECANCELED && res != -EAGAIN && res != -EINTR) {
+		fatal("read from term %s failed: %s", p->name, strerror(-res));
+	}
+
+	ev_io_kick(&w->loop, &p->io);
+}
+
+/* queue a received buffer behind the input the port has not taken yet */
+static void port_park(struct port *p, unsigned flags, unsigned len)
+{
+	struct port_park *park = p->w->park;
+	int bid = flags >> IORING_CQE_BUFFER_SHIFT;
+
+	park[bid].next = -1;
+	park[bid].len = len;
+	if (p->park_head < 0) {
+		p->park_head = bid;
+		p->park_off = 0;
+	} else {
+		park[p->park_tail].next = bid;
+	}
+	p->park_tail = bid;
+	p->npark++;
+}
+
+/* hand the first parked buffer to the port, give it back once taken */
+static void port_unpark(struct port *p)
+{
+	struct worker *w = p->w;
+	struct port_park *b = &w->park[p->park_head];
+	struct port *q;
+	unsigned flags = (unsigned)p->park_head << IORING_CQE_BUFFER_SHIFT;
+
+	p->park_off += port_input(p, uring_buf(&w->uring, flags) + p->park_off,
+			b->len - p->park_off);
+	if (p->park_off < b->len) return;
+
+	p->park_head = b->next;
+	p->park_off = 0;
+	p->npark--;
+	uring_buf_put(&w->uring, flags);
+
+	/* ports that ran out of buffers read again */
+	while ((q = w->starved) != NULL) {
+		w->starved = q->starved;
+		q->is_starved = 0;
+		ev_io_kick(&w->loop, &q->io);
+	}
+}
+
+/* one gathered write in flight at a time keeps the output in order */
+static void port_uring_write(struct port *p)
+{
+	struct io_uring_sqe *sqe;
+	uint64_t now = 0;
+	size_t max;
+	int iovcnt;
+
+	if (p->wr_busy || outq_empty(&p->sess.q)) return;
+
+	if (p->baud) now = ev_now();
+	max = port_budget(p, now);
+	if (!max) {
+		port_pace_wait(p, now);
+		return;
+	}
+
+	/* the queue keeps what it gave until port_written() consumes it */
+	iovcnt = outq_iov(&p->sess.q, p->wr_iov, TTY_WRITE_IOV, max);
+	sqe = uring_sqe(&p->w->uring, &p->wr);
+	sqe->opcode = IORING_OP_WRITEV;
+	sqe->fd = p->io.fd;
+	sqe->addr = (uintptr_t)p->wr_iov;
+	sqe->len = iovcnt;
+	sqe->off = -1;
+	p->wr_busy = 1;
+	p->wr_now = now;
+}
+
+static void port_wr_cb(struct uring_req *r, int res, unsigned flags)
+{
+	struct port *p = container_of(r, struct port, wr);
+
+	p->wr_busy = 0;
+	if (res > 0) {
+		port_written(p, res, p->wr_now);
+	} else if (res != -EAGAIN && res != -EINTR) {
+		fatal("write to term %s failed: %s", p->name, strerror(res ? -res : EIO));
+	}
+
+	ev_io_kick(&p->w->loop, &p->io);
+}
+
+static void tty_queued(struct session *s, size_t len, size_t over)
+{
+	stats_add(stats_self->queued, len);
+	if (s->q.over != over) stats_add(stats_self->drops, s->q.over - over);
+}
+
+void tty_write(struct session *s, const char *p, size_t len)
+{
+	size_t over = s->q.over;
+
+	if (outq_put(&s->q, p, len) < 0)
+		fatal("out of memory");
+	tty_queued(s, len, over);
+}
+
+void tty_write_ref(struct session *s, const char *p, size_t len)
+{
+	size_t over = s->q.over;
+
+	if (outq_put_ref(&s->q, p, len) < 0)
+		fatal("out of memory");
+	tty_queued(s, len, over);
+}
+
+void tty_write_src(struct session *s, struct outq_src *src)
+{
+	if (outq_put_src(&s->q, src) < 0)
+		fatal("out of memory");
+}
+
+void tty_write_line(struct session *s, const char *line, size_t len)
+{
+	size_t over = s->q.over;
+
+	if (outq_put(&s->q, line, len) < 0 || outq_put(&s->q, "\n\r", 2) < 0)
+		fatal("out of memory");
+	tty_queued(s, len + 2, over);
+}
+
+static int tty_read_line_cb(struct splitter *sp, char *line, int len)
+{
+	struct session *s = container_of(sp, struct session, split);
+
+	stats_line(s);
+	at_read_line_cb(s, line, len);
+	if (!session_busy(s)) stats_reply(s);
+
+	/* after AT+CMUX, the rest of the input is for the multiplexer */
+	return session_held(s) || s->cmux_n1;
+}
+
+int main(int argc, char *argv[])
+{
+	struct at_profile *prof;
+	struct rlimit rl;
+	sigset_t mask, omask;
+	uint64_t t;
+	int r;
+	int i;
+
+	parse_args(argc, argv);
+	register_signal_handlers();
+	split_init();
+
+	r = term_lib_init();
+	if (r < 0) fatal("term_init failed: %s", term_strerror(term_errno, errno));
+
+	workers = calloc(opts.nworkers, sizeof(*workers));
+	if (workers == NULL) fatal("out of memory");
+	for (i = 0; i < opts.nworkers; i++)
+		worker_init(&workers[i], i);
+
+	if (opts.profile) {
+		prof = at_profile_open(opts.profile);
+		if (prof == NULL)
+			fatal("cannot load profile %s: %s", opts.profile, strerror(errno));
+		for (i = 0; i < opts.nworkers; i++) {
+			at_profile_hold(prof);
+			workers[i].next_prof = prof;
+		}
+		at_profile_put(prof);
+	}
+	sig_open();
+
+	if (opts.sms_dir && mkdir(opts.sms_dir, 0755) < 0 && errno != EEXIST)
+		fatal("cannot create %s: %s", opts.sms_dir, strerror(errno));
+	at_sms_setup(opts.sms_slots, opts.sms_fill, opts.sms_dir);
+
+	if (stats_thread_init() < 0) fatal("out of memory");
+	if (opts.socket && stats_server_open(&workers[0].loop, opts.socket) < 0)
+		fatal("cannot serve %s: %s", opts.socket, strerror(errno));
+
+	ports = calloc(opts.nports + opts.nptys, sizeof(*ports));
+	if (ports == NULL) fatal("out of memory");
+
+	for (i = 0; i < opts.nports; i++)
+		port_open(&ports[i], opts.port[i]);
+
+	if (opts.nptys) {
+		/* every pty costs two descriptors */
+		if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max) {
+			rl.rlim_cur = rl.rlim_max;
+			setrlimit(RLIMIT_NOFILE, &rl);
+		}
+		if (mkdir(opts.pty_dir, 0755) < 0 && errno != EEXIST)
+			fatal("cannot create %s: %s", opts.pty_dir, strerror(errno));
+
+		t = ev_now();
+		for (i = 0; i < opts.nptys; i++)
+			pty_open(&ports[opts.nports + i], i);
+		DPRINTF("%d ptys ready in %.1f ms\n", opts.nptys, (ev_now() - t) / 1e6);
+	}
+
+	/* signals are taken by the main thread only */
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGTERM);
+	pthread_sigmask(SIG_BLOCK, &mask, &omask);
+	for (i = 1; i < opts.nworkers; i++) {
+		r = pthread_create(&workers[i].tid, NULL, worker_run, &workers[i]);
+		if (r) fatal("cannot start worker %d: %s", i, strerror(r));
+	}
+	pthread_sigmask(SIG_SETMASK, &omask, NULL);
+	if (opts.nworkers > 1)
+		DPRINTF("%d ports served by %d threads\n", opts.nports + opts.nptys, opts.nworkers);
+
+	workers[0].tid = pthread_self();
+	worker_pin(&workers[0]);
+	worker_switch(&workers[0]);
+	loop(&workers[0]);
+
+	/* wake the other workers so they see sig_exit */
+	for (i = 1; i < opts.nworkers; i++) {
+		t = 1;
+		if (write(workers[i].wake.fd, &t, sizeof(t)) == sizeof(t))
+			pthread_join(workers[i].tid, NULL);
+	}
 
-	loop();
+	for (i = 0; i < opts.nports + opts.nptys; i++)
+		port_close(&ports[i]);
+	stats_server_close();
 
 	return EXIT_SUCCESS;
 }
@@ -3,14 +3,39 @@
 
 #define DPRINTF(format, ...) fprintf(stderr, "%s(%d): " format, __func__, __LINE__, ## __VA_ARGS__)
 
+/* size of the former fixed output queue, see outq.over */
 #ifndef TTY_Q_SZ
 #define TTY_Q_SZ 8192
 #endif
 
+/* default output queue high-water mark */
+#ifndef TTY_Q_HWM
+#define TTY_Q_HWM (64 * 1024)
+#endif
+
+/* longest AT line, longer ones are split */
 #define TTY_RD_SZ 512
+/* bytes read from a tty at once */
+#define TTY_RD_BUF 4096
 
 void fatal(const char *format, ...);
 
-extern void tty_write_line(const char *line);
+#include <stddef.h>
+
+struct session;
+
+/* a string literal with the line terminator appended, and its length */
+#define TTY_STR(lit) lit "\n\r", sizeof(lit "\n\r") - 1
+#define tty_write_str(s, lit) tty_write((s), TTY_STR(lit))
+
+/* queue len bytes of already terminated output */
+extern void tty_write(struct session *s, const char *p, size_t len);
+/* same without copying, for output in memory that is never freed */
+extern void tty_write_ref(struct session *s, const char *p, size_t len);
+/* queue a line and terminate it */
+extern void tty_write_line(struct session *s, const char *line, size_t len);
+/* queue output produced as it is sent, see outq.h */
+struct outq_src;
+extern void tty_write_src(struct session *s, struct outq_src *src);
 
 #endif /* __MAIN_H */
@@ -0,0 +1,192 @@
+#include <string.h>
+
+#include "main.h"
+#include "outq.h"
+#include "pool.h"
+
+static __thread struct pool chunk_pool;
+static __thread struct pool ref_pool;	/* chunk headers without data */
+
+static struct outq_chunk *chunk_get(void);
+static void chunk_put(struct outq_chunk *c);
+static void outq_append(struct outq *q, struct outq_chunk *c);
+static void outq_account(struct outq *q, size_t n);
+
+static struct outq_chunk *chunk_get(void)
+{
+	struct outq_chunk *c;
+
+	if (!chunk_pool.obj_sz) pool_init(&chunk_pool, sizeof(struct outq_chunk));
+
+	c = pool_get(&chunk_pool);
+	if (c) {
+		c->next = NULL;
+		c->src = NULL;
+		c->buf = c->data;
+		c->rd = c->wr = 0;
+	}
+
+	return c;
+}
+
+static void chunk_put(struct outq_chunk *c)
+{
+	pool_put(outq_chunk_is_ref(c) ? &ref_pool : &chunk_pool, c);
+}
+
+static void outq_append(struct outq *q, struct outq_chunk *c)
+{
+	if (q->tail) q->tail->next = c;
+	else q->head = c;
+	q->tail = c;
+}
+
+static void outq_account(struct outq *q, size_t n)
+{
+	if (q->len + n > TTY_Q_SZ)
+		q->over += (q->len >= TTY_Q_SZ) ? n : q->len + n - TTY_Q_SZ;
+}
+
+void outq_init(struct outq *q, size_t hwm)
+{
+	q->head = q->tail = NULL;
+	q->len = 0;
+	q->nsrc = 0;
+	q->hwm = hwm;
+	q->over = 0;
+	q->sent = 0;
+}
+
+void outq_free(struct outq *q)
+{
+	struct outq_chunk *c;
+
+	while ((c = q->head)) {
+		q->head = c->next;
+		chunk_put(c);
+	}
+	q->tail = NULL;
+	q->len = 0;
+	q->nsrc = 0;
+}
+
+int outq_put(struct outq *q, const void *p, size_t n)
+{
+	struct outq_chunk *c;
+	size_t room;
+
+	outq_account(q, n);
+
+	while (n) {
+		c = q->tail;
+		if (c == NULL || outq_chunk_is_ref(c) || c->wr == sizeof(c->data)) {
+			c = chunk_get();
+			if (c == NULL) return -1;
+			outq_append(q, c);
+		}
+
+		room = sizeof(c->data) - c->wr;
+		if (room > n) room = n;
+		memcpy(c->data + c->wr, p, room);
+		c->wr += room;
+		q->len += room;
+		p = (const char *)p + room;
+		n -= room;
+	}
+
+	return 0;
+}
+
+int outq_put_ref(struct outq *q, const void *p, size_t n)
+{
+	struct outq_chunk *c;
+
+	if (!n) return 0;
+
+	if (!ref_pool.obj_sz) pool_init(&ref_pool, offsetof(struct outq_chunk, data));
+
+	c = pool_get(&ref_pool);
+	if (c == NULL) return -1;
+
+	outq_account(q, n);
+
+	c->next = NULL;
+	c->src = NULL;
+	c->buf = p;
+	c->rd = 0;
+	c->wr = n;
+	outq_append(q, c);
+	q->len += n;
+
+	return 0;
+}
+
+int outq_put_src(struct outq *q, struct outq_src *src)
+{
+	struct outq_chunk *c;
+
+	if (!ref_pool.obj_sz) pool_init(&ref_pool, offsetof(struct outq_chunk, data));
+
+	c = pool_get(&ref_pool);
+	if (c == NULL) return -1;
+
+	c->next = NULL;
+	c->src = src;
+	c->buf = NULL;
+	c->rd = c->wr = 0;
+	outq_append(q, c);
+	q->nsrc++;
+
+	return 0;
+}
+
+int outq_iov(const struct outq *q, struct iovec *iov, int iovcnt, size_t max)
+{
+	const struct outq_chunk *c;
+	size_t len;
+	int i;
+
+	for (i = 0, c = q->head; c && i < iovcnt && max; c = c->next) {
+		/* what follows a source waits for it */
+		if (c->src) return i + c->src->iov(c->src, iov + i, iovcnt - i, max);
+
+		len = c->wr - c->rd;
+		if (!len) continue;
+		if (len > max) len = max;
+		iov[i].iov_base = (char *)c->buf + c->rd;
+		iov[i].iov_len = len;
+		max -= len;
+		i++;
+	}
+
+	return i;
+}
+
+void outq_consume(struct outq *q, size_t n)
+{
+	struct outq_chunk *c;
+	size_t len;
+
+	q->sent += n;
+
+	while (n && (c = q->head)) {
+		if (c->src) {
+			/* outq_iov() stops at a source, the rest was its */
+			if (!c->src->consume(c->src, n)) return;
+			n = 0;
+			q->nsrc--;
+		} else {
+			len = c->wr - c->rd;
+			if (len > n) {
+				c->rd += n;
+				q->len -= n;
+				return;
+			}
+			n -= len;
+			q->len -= len;
+		}
+		q->head = c->next;
+		if (q->head == NULL) q->tail = NULL;
+		chunk_put(c);
+	}
+}
@@ -0,0 +1,74 @@
+#ifndef __OUTQ_H
+#define __OUTQ_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/uio.h>
+
+/*
+ * Output queue: a list of fixed-size chunks taken from a per-thread pool.
+ * Appending never moves queued data and the queue grows as needed, so
+ * responses are never dropped. Producers are expected to stop generating
+ * output (i.e. stop processing AT lines) once outq_full() says the
+ * high-water mark has been reached.
+ *
+ * Data that outlives the queue (static responses) can be queued by
+ * reference instead; such a chunk is only a header pointing at the caller's
+ * memory and is handed to writev() as is.
+ *
+ * Output too large to queue at all (long listings) is queued as a source:
+ * the writer asks it to describe its next bytes, typically references into
+ * memory it has mapped, and tells it how many were sent. A source takes no
+ * queue capacity and does not count in outq_len(); data queued behind it
+ * is sent once it is exhausted.
+ */
+
+struct outq_src {
+	/* describe up to max bytes from the current position */
+	int (*iov)(struct outq_src *src, struct iovec *iov, int iovcnt, size_t max);
+	/* n of them were sent, returns 1 once all has been sent */
+	int (*consume)(struct outq_src *src, size_t n);
+};
+
+#define OUTQ_CHUNK_SZ 4096
+
+struct outq_chunk {
+	struct outq_chunk *next;
+	struct outq_src *src;	/* if not NULL, the chunk holds no data */
+	const char *buf;	/* data, or the memory a reference points to */
+	unsigned rd;		/* first unsent byte */
+	unsigned wr;		/* first free byte */
+	char data[OUTQ_CHUNK_SZ - 3 * sizeof(void *) - 2 * sizeof(unsigned)];
+};
+
+#define outq_chunk_is_ref(c) ((c)->buf != (c)->data)
+
+struct outq {
+	struct outq_chunk *head;
+	struct outq_chunk *tail;
+	size_t len;		/* sources not included */
+	unsigned nsrc;		/* sources queued */
+	size_t hwm;		/* high-water mark */
+	size_t over;		/* bytes queued beyond the old fixed TTY_Q_SZ */
+	uint64_t sent;		/* bytes consumed so far */
+};
+
+#define outq_len(q) ((q)->len)
+#define outq_full(q) ((q)->len >= (q)->hwm)
+#define outq_empty(q) (!(q)->len && !(q)->nsrc)
+
+void outq_init(struct outq *q, size_t hwm);
+void outq_free(struct outq *q);
+
+/* returns -1 if memory for the data could not be allocated */
+int outq_put(struct outq *q, const void *p, size_t n);
+/* queue n bytes at p without copying them, p must stay valid until sent */
+int outq_put_ref(struct outq *q, const void *p, size_t n);
+/* queue a source with something to send, it must stay valid until exhausted */
+int outq_put_src(struct outq *q, struct outq_src *src);
+
+/* describe up to max bytes of queued data, returns the number of iovecs */
+int outq_iov(const struct outq *q, struct iovec *iov, int iovcnt, size_t max);
+void outq_consume(struct outq *q, size_t n);
+
+#endif /* __OUTQ_H */
@@ -0,0 +1,359 @@
+#include <string.h>
+
+#include "pdu.h"
+#include "sms.h"
+
+#define PDU_MTI_SUBMIT		0x01
+#define PDU_MTI_STATUS_REPORT	0x02
+#define PDU_MMS			0x04	/* no more messages are waiting */
+#define PDU_UDHI		0x40
+#define PDU_VPF(fo)		(((fo) >> 3) & 3)
+
+#define PDU_IEI_CONCAT8		0x00
+#define PDU_IEI_CONCAT16	0x08
+
+/* TS 23.038 GSM 7 bit default alphabet */
+static const uint16_t pdu_gsm7[128] = {
+	0x0040, 0x00a3, 0x0024, 0x00a5, 0x00e8, 0x00e9, 0x00f9, 0x00ec,
+	0x00f2, 0x00c7, 0x000a, 0x00d8, 0x00f8, 0x000d, 0x00c5, 0x00e5,
+	0x0394, 0x005f, 0x03a6, 0x0393, 0x039b, 0x03a9, 0x03a0, 0x03a8,
+	0x03a3, 0x0398, 0x039e, 0x00a0, 0x00c6, 0x00e6, 0x00df, 0x00c9,
+	0x0020, 0x0021, 0x0022, 0x0023, 0x00a4, 0x0025, 0x0026, 0x0027,
+	0x0028, 0x0029, 0x002a, 0x002b, 0x002c, 0x002d, 0x002e, 0x002f,
+	0x0030, 0x0031, 0x0032, 0x0033, 0x0034, 0x0035, 0x0036, 0x0037,
+	0x0038, 0x0039, 0x003a, 0x003b, 0x003c, 0x003d, 0x003e, 0x003f,
+	0x00a1, 0x0041, 0x0042, 0x0043, 0x0044, 0x0045, 0x0046, 0x0047,
+	0x0048, 0x0049, 0x004a, 0x004b, 0x004c, 0x004d, 0x004e, 0x004f,
+	0x0050, 0x0051, 0x0052, 0x0053, 0x0054, 0x0055, 0x0056, 0x0057,
+	0x0058, 0x0059, 0x005a, 0x00c4, 0x00d6, 0x00d1, 0x00dc, 0x00a7,
+	0x00bf, 0x0061, 0x0062, 0x0063, 0x0064, 0x0065, 0x0066, 0x0067,
+	0x0068, 0x0069, 0x006a, 0x006b, 0x006c, 0x006d, 0x006e, 0x006f,
+	0x0070, 0x0071, 0x0072, 0x0073, 0x0074, 0x0075, 0x0076, 0x0077,
+	0x0078, 0x0079, 0x007a, 0x00e4, 0x00f6, 0x00f1, 0x00fc, 0x00e0,
+};
+
+/* its extension table, after an escape; what is not in it reads as the default */
+static const uint16_t pdu_gsm7_ext[128] = {
+	[0x0a] = 0x000c,
+	[0x14] = '^',
+	[0x28] = '{',
+	[0x29] = '}',
+	[0x2f] = '\\',
+	[0x3c] = '[',
+	[0x3d] = '~',
+	[0x3e] = ']',
+	[0x40] = '|',
+	[0x65] = 0x20ac,
+};
+
+static int pdu_nibble(char c);
+static int pdu_hex(uint8_t *o, const char *hex, size_t len);
+static char *pdu_utf8(char *p, unsigned c);
+static char *pdu_gsm7_text(char *p, const uint8_t *ud, unsigned from, unsigned to);
+static char *pdu_ucs2_text(char *p, const uint8_t *ud, unsigned n);
+static int pdu_addr(struct pdu_addr *a, unsigned len, const uint8_t *o, const uint8_t *end);
+static int pdu_udh(struct pdu_submit *m, const uint8_t *h, unsigned n);
+static enum pdu_alphabet pdu_alphabet(uint8_t dcs);
+static char *pdu_put_oct(char *p, unsigned v);
+static char *pdu_put_time(char *p, const struct tm *tm);
+
+static int pdu_nibble(char c)
+{
+	if (c >= '0' && c <= '9') return c - '0';
+	c |= 0x20;
+	if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+
+	return -1;
+}
+
+static int pdu_hex(uint8_t *o, const char *hex, size_t len)
+{
+	int hi, lo;
+	size_t i;
+
+	for (i = 0; i < len; i += 2) {
+		hi = pdu_nibble(hex[i]);
+		lo = pdu_nibble(hex[i + 1]);
+		if ((hi | lo) < 0) return -1;
+		*o++ = hi << 4 | lo;
+	}
+
+	return 0;
+}
+
+static char *pdu_utf8(char *p, unsigned c)
+{
+	if (c < 0x80) {
+		*p++ = c;
+	} else if (c < 0x800) {
+		*p++ = 0xc0 | c >> 6;
+		*p++ = 0x80 | (c & 0x3f);
+	} else if (c < 0x10000) {
+		*p++ = 0xe0 | c >> 12;
+		*p++ = 0x80 | (c >> 6 & 0x3f);
+		*p++ = 0x80 | (c & 0x3f);
+	} else {
+		*p++ = 0xf0 | c >> 18;
+		*p++ = 0x80 | (c >> 12 & 0x3f);
+		*p++ = 0x80 | (c >> 6 & 0x3f);
+		*p++ = 0x80 | (c & 0x3f);
+	}
+
+	return p;
+}
+
+/* septets [from, to) of the packed user data ud, a header included in from */
+static char *pdu_gsm7_text(char *p, const uint8_t *ud, unsigned from, unsigned to)
+{
+	unsigned k, pos, c;
+	int esc = 0;
+
+	for (k = from; k < to; k++) {
+		pos = k * 7;
+		c = ud[pos / 8] >> (pos % 8);
+		if (pos % 8 > 1) c |= ud[pos / 8 + 1] << (8 - pos % 8);
+		c &= 0x7f;
+
+		if (esc) {
+			p = pdu_utf8(p, pdu_gsm7_ext[c] ? pdu_gsm7_ext[c] : pdu_gsm7[c]);
+			esc = 0;
+		} else if (c == 0x1b) {
+			esc = 1;
+		} else {
+			p = pdu_utf8(p, pdu_gsm7[c]);
+		}
+	}
+
+	return p;
+}
+
+/* n octets of UTF-16, a stray surrogate becomes U+FFFD */
+static char *pdu_ucs2_text(char *p, const uint8_t *ud, unsigned n)
+{
+	unsigned i, c, lo;
+
+	for (i = 0; i + 1 < n; i += 2) {
+		c = ud[i] << 8 | ud[i + 1];
+		if (c >= 0xd800 && c < 0xdc00 && i + 3 < n) {
+			lo = ud[i + 2] << 8 | ud[i + 3];
+			if (lo >= 0xdc00 && lo < 0xe000) {
+				c = 0x10000 + ((c - 0xd800) << 10) + (lo - 0xdc00);
+				i += 2;
+			}
+		}
+		if (c >= 0xd800 && c < 0xe000) c = 0xfffd;
+		p = pdu_utf8(p, c);
+	}
+
+	return p;
+}
+
+/* address of len semi-octets, type octet at o; returns the octets it takes or -1 */
+static int pdu_addr(struct pdu_addr *a, unsigned len, const uint8_t *o, const uint8_t *end)
+{
+	unsigned n = (len + 1) / 2, i, d;
+	char *p = a->text;
+
+	if (len > PDU_ADDR_MAX || end - o < 1 + (int)n) return -1;
+
+	a->len = len;
+	a->type = o[0];
+	memcpy(a->oct, o + 1, n);
+
+	if ((a->type & 0x70) == 0x50) {
+		/* alphanumeric, in septets */
+		p = pdu_gsm7_text(p, a->oct, 0, len * 4 / 7);
+	} else {
+		for (i = 0; i < len; i++) {
+			d = a->oct[i / 2] >> (i % 2 * 4) & 0xf;
+			if (d == 0xf) break;
+			*p++ = "0123456789*#abc"[d];
+		}
+	}
+	*p = '\0';
+
+	return 1 + n;
+}
+
+/* the n octets of the user data header at h; concatenation is all that is used */
+static int pdu_udh(struct pdu_submit *m, const uint8_t *h, unsigned n)
+{
+	const uint8_t *end = h + n;
+	unsigned iei, iel;
+
+	while (h < end) {
+		if (end - h < 2 || end - h - 2 < h[1]) return -1;
+		iei = h[0];
+		iel = h[1];
+		h += 2;
+
+		/* a part numbered out of range is ignored, as if it was not there */
+		if (iei == PDU_IEI_CONCAT8 && iel == 3 && h[1] && h[2] && h[2] <= h[1]) {
+			m->ref = h[0];
+			m->parts = h[1];
+			m->part = h[2];
+		} else if (iei == PDU_IEI_CONCAT16 && iel == 4 && h[2] && h[3] && h[3] <= h[2]) {
+			m->ref = h[0] << 8 | h[1];
+			m->parts = h[2];
+			m->part = h[3];
+		}
+		h += iel;
+	}
+
+	return 0;
+}
+
+static enum pdu_alphabet pdu_alphabet(uint8_t dcs)
+{
+	if (!(dcs & 0x80)) {
+		/* general data coding, compressed text is left as it is */
+		if (dcs & 0x20) return PDU_8BIT;
+		switch (dcs >> 2 & 3) {
+		case 1: return PDU_8BIT;
+		case 2: return PDU_UCS2;
+		default: return PDU_GSM7;
+		}
+	}
+
+	switch (dcs >> 4) {
+	case 0xc:
+	case 0xd:
+		return PDU_GSM7;	/* message waiting indication */
+	case 0xe:
+		return PDU_UCS2;
+	case 0xf:
+		return (dcs & 0x04) ? PDU_8BIT : PDU_GSM7;
+	default:
+		return PDU_8BIT;	/* reserved */
+	}
+}
+
+int pdu_submit_decode(struct pdu_submit *m, const char *hex, size_t len)
+{
+	uint8_t buf[SMS_PDU_MAX];
+	const uint8_t *o = buf, *end, *tpdu, *ud;
+	unsigned n, udhl = 0, octets;
+	char *p;
+	int r;
+
+	if (!len || len % 2 || len > sizeof(buf) * 2 || pdu_hex(buf, hex, len) < 0)
+		return -1;
+	end = buf + len / 2;
+
+	/* SMSC address, its length in octets with the type */
+	n = *o++;
+	m->smsc.len = 0;
+	m->smsc.text[0] = '\0';
+	if (n && pdu_addr(&m->smsc, (n - 1) * 2, o, end) != (int)n) return -1;
+	o += n;
+	tpdu = o;
+
+	if (end - o < 3) return -1;
+	m->fo = *o++;
+	if ((m->fo & 3) != PDU_MTI_SUBMIT) return -1;
+	m->mr = *o++;
+
+	/* destination address, its length in digits */
+	n = *o++;
+	r = pdu_addr(&m->da, n, o, end);
+	if (r < 0) return -1;
+	o += r;
+
+	switch (PDU_VPF(m->fo)) {
+	case 0: m->vp_len = 0; break;
+	case 2: m->vp_len = 1; break;
+	default: m->vp_len = 7; break;	/* enhanced or absolute */
+	}
+	if (end - o < 3 + m->vp_len) return -1;
+	m->pid = *o++;
+	m->dcs = *o++;
+	memcpy(m->vp, o, m->vp_len);
+	o += m->vp_len;
+	m->udl = *o++;
+	ud = o;
+
+	m->alphabet = pdu_alphabet(m->dcs);
+	if (m->alphabet == PDU_GSM7) {
+		if (m->udl > 160) return -1;
+		octets = (m->udl * 7 + 7) / 8;
+	} else {
+		if (m->udl > 140) return -1;
+		octets = m->udl;
+	}
+	if (end - ud != octets) return -1;
+
+	m->ref = m->parts = m->part = 0;
+	if (m->fo & PDU_UDHI) {
+		if (!octets || ud[0] + 1u > octets || pdu_udh(m, ud + 1, ud[0]) < 0)
+			return -1;
+		udhl = ud[0] + 1;
+	}
+
+	p = m->text;
+	switch (m->alphabet) {
+	case PDU_GSM7:
+		/* the header is padded to a septet boundary */
+		n = (udhl * 8 + 6) / 7;
+		if (n > m->udl) return -1;
+		p = pdu_gsm7_text(p, ud, n, m->udl);
+		break;
+	case PDU_UCS2:
+		if ((octets - udhl) % 2) return -1;
+		p = pdu_ucs2_text(p, ud + udhl, octets - udhl);
+		break;
+	default:
+		memcpy(p, ud + udhl, octets - udhl);
+		p += octets - udhl;
+		break;
+	}
+	m->text_len = p - m->text;
+
+	return end - tpdu;
+}
+
+static char *pdu_put_oct(char *p, unsigned v)
+{
+	*p++ = "0123456789ABCDEF"[v >> 4 & 0xf];
+	*p++ = "0123456789ABCDEF"[v & 0xf];
+
+	return p;
+}
+
+/* semi-octets, UTC */
+static char *pdu_put_time(char *p, const struct tm *tm)
+{
+	const int v[7] = {
+		tm->tm_year % 100, tm->tm_mon + 1, tm->tm_mday,
+		tm->tm_hour, tm->tm_min, tm->tm_sec, 0
+	};
+	int i;
+
+	for (i = 0; i < 7; i++)
+		p = pdu_put_oct(p, (v[i] % 10) << 4 | v[i] / 10);
+
+	return p;
+}
+
+unsigned pdu_status_report(char *hex, const struct pdu_submit *m, unsigned mr, time_t t)
+{
+	struct tm tm;
+	char *p = hex;
+	unsigned i;
+
+	gmtime_r(&t, &tm);
+
+	p = pdu_put_oct(p, 0);		/* no SMSC address */
+	p = pdu_put_oct(p, PDU_MTI_STATUS_REPORT | PDU_MMS);
+	p = pdu_put_oct(p, mr);
+	/* the recipient, as it was given */
+	p = pdu_put_oct(p, m->da.len);
+	p = pdu_put_oct(p, m->da.type);
+	for (i = 0; i < (m->da.len + 1u) / 2; i++)
+		p = pdu_put_oct(p, m->da.oct[i]);
+	p = pdu_put_time(p, &tm);	/* service centre time stamp */
+	p = pdu_put_time(p, &tm);	/* discharge time */
+	p = pdu_put_oct(p, 0);		/* received by the SME */
+	*p = '\0';
+
+	return (p - hex) / 2 - 1;
+}
@@ -0,0 +1,70 @@
+#ifndef __PDU_H
+#define __PDU_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+/*
+ * SMS-SUBMIT decoding (3GPP TS 23.040, alphabets of TS 23.038) for the PDU
+ * taken by AT+CMGS, and the SMS-STATUS-REPORT reporting its delivery.
+ *
+ * Everything is decoded into the caller's struct pdu_submit, which holds
+ * the longest message there can be, so sending costs no allocation.
+ */
+
+#define PDU_ADDR_MAX	20	/* semi-octets of an address */
+#define PDU_TEXT_MAX	480	/* 160 septets in UTF-8 */
+
+enum pdu_alphabet {
+	PDU_GSM7,
+	PDU_8BIT,
+	PDU_UCS2,
+};
+
+struct pdu_addr {
+	uint8_t len;		/* semi-octets */
+	uint8_t type;		/* type of number and numbering plan */
+	uint8_t oct[PDU_ADDR_MAX / 2];	/* as received */
+	char text[PDU_ADDR_MAX * 2];	/* digits, or the name if alphanumeric; terminated */
+};
+
+struct pdu_submit {
+	struct pdu_addr smsc;	/* len 0 if the default one is to be used */
+	uint8_t fo;		/* first octet: MTI, RD, VPF, SRR, UDHI, RP */
+	uint8_t mr;
+	struct pdu_addr da;
+	uint8_t pid;
+	uint8_t dcs;
+	uint8_t vp_len;		/* 0, 1 or 7 octets */
+	uint8_t vp[7];
+	enum pdu_alphabet alphabet;
+	/* part of a concatenated message, all 0 if it is not */
+	uint16_t ref;
+	uint8_t parts;
+	uint8_t part;
+	unsigned udl;		/* septets or octets, header included */
+	/* user data without the header, UTF-8 unless 8-bit data */
+	unsigned text_len;
+	char text[PDU_TEXT_MAX];
+};
+
+/* a status report is requested */
+#define pdu_srr(m) ((m)->fo & 0x20)
+
+/*
+ * decode len hex digits, an SMSC address followed by an SMS-SUBMIT TPDU;
+ * returns the octets of the TPDU or -1 if it is malformed
+ */
+int pdu_submit_decode(struct pdu_submit *m, const char *hex, size_t len);
+
+/* SMSC address (left out), TPDU and terminating NUL */
+#define PDU_REPORT_HEX	((1 + 2 + 2 + PDU_ADDR_MAX / 2 + 7 + 7 + 1) * 2 + 1)
+
+/*
+ * SMS-STATUS-REPORT in hex that message mr, submitted as m, reached its
+ * recipient at t; returns the octets of the TPDU
+ */
+unsigned pdu_status_report(char *hex, const struct pdu_submit *m, unsigned mr, time_t t);
+
+#endif /* __PDU_H */
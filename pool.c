@@ -0,0 +1,61 @@
+#include <stdlib.h>
+
+#include "pool.h"
+
+/* keeps the objects carved out of a slab aligned */
+#define SLAB_HDR sizeof(void *) * 2
+
+void pool_init(struct pool *p, size_t obj_sz)
+{
+	if (obj_sz < sizeof(void *)) obj_sz = sizeof(void *);
+	p->obj_sz = (obj_sz + sizeof(void *) - 1) & ~(sizeof(void *) - 1);
+	p->free = NULL;
+	p->slabs = NULL;
+	p->nobjs = 0;
+}
+
+void pool_destroy(struct pool *p)
+{
+	void *slab;
+
+	while (p->slabs) {
+		slab = p->slabs;
+		p->slabs = *(void **)slab;
+		free(slab);
+	}
+	p->free = NULL;
+	p->nobjs = 0;
+}
+
+void *pool_get(struct pool *p)
+{
+	char *slab, *obj;
+	size_t n;
+	void *o;
+
+	if (p->free == NULL) {
+		n = (POOL_SLAB_SZ - SLAB_HDR) / p->obj_sz;
+		if (n == 0) n = 1;
+		slab = malloc(SLAB_HDR + n * p->obj_sz);
+		if (slab == NULL) return NULL;
+		*(void **)slab = p->slabs;
+		p->slabs = slab;
+		for (obj = slab + SLAB_HDR; n--; obj += p->obj_sz) {
+			*(void **)obj = p->free;
+			p->free = obj;
+		}
+	}
+
+	o = p->free;
+	p->free = *(void **)o;
+	p->nobjs++;
+
+	return o;
+}
+
+void pool_put(struct pool *p, void *obj)
+{
+	*(void **)obj = p->free;
+	p->free = obj;
+	p->nobjs--;
+}
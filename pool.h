@@ -0,0 +1,27 @@
+#ifndef __POOL_H
+#define __POOL_H
+
+#include <stddef.h>
+
+/*
+ * Fixed-size object allocator. Objects are carved out of slabs of
+ * POOL_SLAB_SZ bytes and recycled through a free list; slabs are only
+ * released by pool_destroy(). A pool is not thread safe, give every thread
+ * its own.
+ */
+
+#define POOL_SLAB_SZ (64 * 1024)
+
+struct pool {
+	size_t obj_sz;
+	void *free;		/* free list, linked through the objects */
+	void *slabs;		/* slab list, linked through the first word */
+	size_t nobjs;		/* objects handed out */
+};
+
+void pool_init(struct pool *p, size_t obj_sz);
+void pool_destroy(struct pool *p);
+void *pool_get(struct pool *p);
+void pool_put(struct pool *p, void *obj);
+
+#endif /* __POOL_H */
@@ -0,0 +1,502 @@
+/*
+ * profc: modem profile compiler.
+ *
+ * Usage: profc <profile> <image>
+ *
+ * A profile is a text file of directives, one per line, starting in the
+ * first column; indented lines are reply text:
+ *
+ *   # comment
+ *   profile <name>
+ *   define <NAME> <value>     ${NAME} is replaced in everything below
+ *   exact <pattern>           a command matching the whole line
+ *   prefix <pattern>          a command matching the start of the line
+ *   handler <name>            the command runs a built-in handler of at.c
+ *   state [net_mode=auto|nr|lte|umts] [cpms=sm|me]
+ *                             the reply below is for these states only
+ *   delay <ms>                the lines below follow after ms milliseconds
+ *       <reply line>
+ *
+ * Replies carry their final result ("OK", "ERROR", ...) like any other
+ * line. For every state the most specific reply is used. Commands of a
+ * profile take precedence over the built-in ones, which remain available.
+ */
+
+#include <errno.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "attab.h"
+#include "profile.h"
+
+#define PROFC_LINE_SZ 4096
+
+struct buf {
+	char *p;
+	size_t len;
+	size_t sz;
+};
+
+struct pstep {
+	unsigned delay_ms;
+	struct buf text;
+};
+
+struct preply {
+	int net_mode;		/* -1 for any */
+	int cpms;		/* -1 for any */
+	struct pstep *step;
+	int nsteps;
+	uint32_t off;		/* in the replies section */
+};
+
+struct pcmd {
+	int match;
+	char *pattern;
+	char *handler;
+	struct preply *reply;
+	int nreplies;
+	int line;
+};
+
+struct define {
+	char *name;
+	char *value;
+};
+
+static const char * const handlers[] = {
+#define AT_CMD(match, pattern, handler) #handler,
+#define AT_RSP(match, pattern, line)
+#include "at_cmds.h"
+#undef AT_CMD
+#undef AT_RSP
+};
+
+static const char * const net_modes[PROFILE_NET_MODES] = { "auto", "nr", "lte", "umts" };
+static const char * const cpms_names[PROFILE_CPMS] = { "sm", "me" };
+
+static const char *src;
+static int lineno;
+static char *name;
+static struct pcmd *cmds;
+static int ncmds;
+static struct define *defines;
+static int ndefines;
+
+static void die(const char *fmt, ...);
+static void *xrealloc(void *p, size_t n);
+static char *xstrdup(const char *s);
+static void buf_add(struct buf *b, const void *p, size_t n);
+static uint32_t buf_align(struct buf *b, size_t align);
+static char *expand(const char *s);
+static struct preply *reply_new(struct pcmd *c);
+static struct pstep *step_cur(struct pcmd *c);
+static void parse_state(struct preply *r, char *args);
+static void parse(FILE *f);
+static const struct preply *resolve(const struct pcmd *c, int net_mode, int cpms);
+static void emit(const char *path);
+int main(int argc, char *argv[]);
+
+static void die(const char *fmt, ...)
+{
+	va_list ap;
+
+	if (lineno) fprintf(stderr, "%s:%d: ", src, lineno);
+	else fprintf(stderr, "profc: ");
+	va_start(ap, fmt);
+	vfprintf(stderr, fmt, ap);
+	va_end(ap);
+	fputc('\n', stderr);
+
+	exit(EXIT_FAILURE);
+}
+
+static void *xrealloc(void *p, size_t n)
+{
+	p = realloc(p, n);
+	if (p == NULL && n) die("out of memory");
+
+	return p;
+}
+
+static char *xstrdup(const char *s)
+{
+	char *d = strdup(s);
+
+	if (d == NULL) die("out of memory");
+
+	return d;
+}
+
+static void buf_add(struct buf *b, const void *p, size_t n)
+{
+	/* b->p may still be NULL, which memcpy() must not get even for 0 bytes */
+	if (n == 0) return;
+
+	if (b->len + n > b->sz) {
+		while (b->len + n > b->sz)
+			b->sz = b->sz ? b->sz * 2 : 256;
+		b->p = xrealloc(b->p, b->sz);
+	}
+	memcpy(b->p + b->len, p, n);
+	b->len += n;
+}
+
+/* pad b with zeros to a multiple of align, returns the new length */
+static uint32_t buf_align(struct buf *b, size_t align)
+{
+	static const char zero[8];
+
+	buf_add(b, zero, (align - b->len % align) % align);
+
+	return b->len;
+}
+
+static char *expand(const char *s)
+{
+	struct buf b = { 0 };
+	const char *end;
+	int i;
+
+	while (*s) {
+		if (s[0] != '$' || s[1] != '{') {
+			buf_add(&b, s++, 1);
+			continue;
+		}
+
+		end = strchr(s, '}');
+		if (end == NULL) die("unterminated ${");
+		for (i = 0; i < ndefines; i++) {
+			if (strlen(defines[i].name) == (size_t)(end - s - 2) &&
+					!strncmp(defines[i].name, s + 2, end - s - 2))
+				break;
+		}
+		if (i == ndefines) die("undefined %.*s", (int)(end - s - 2), s + 2);
+		buf_add(&b, defines[i].value, strlen(defines[i].value));
+		s = end + 1;
+	}
+	buf_add(&b, "", 1);
+
+	return b.p;
+}
+
+static struct preply *reply_new(struct pcmd *c)
+{
+	struct preply *r;
+
+	if (c->handler) die("a command with a handler has no replies");
+
+	c->reply = xrealloc(c->reply, (c->nreplies + 1) * sizeof(*c->reply));
+	r = &c->reply[c->nreplies++];
+	memset(r, 0, sizeof(*r));
+	r->net_mode = r->cpms = -1;
+
+	return r;
+}
+
+/* the step reply text goes to, a reply and a step are started if needed */
+static struct pstep *step_cur(struct pcmd *c)
+{
+	struct preply *r;
+
+	r = c->nreplies ? &c->reply[c->nreplies - 1] : reply_new(c);
+	if (!r->nsteps) {
+		r->step = xrealloc(r->step, sizeof(*r->step));
+		memset(r->step, 0, sizeof(*r->step));
+		r->nsteps = 1;
+	}
+
+	return &r->step[r->nsteps - 1];
+}
+
+static void parse_state(struct preply *r, char *args)
+{
+	char *tok, *val;
+	int i;
+
+	for (tok = strtok(args, " \t"); tok; tok = strtok(NULL, " \t")) {
+		val = strchr(tok, '=');
+		if (val == NULL) die("expected key=value, got %s", tok);
+		*val++ = '\0';
+
+		if (!strcmp(tok, "net_mode")) {
+			for (i = 0; i < PROFILE_NET_MODES; i++)
+				if (!strcasecmp(val, net_modes[i])) break;
+			if (i == PROFILE_NET_MODES) die("unknown net_mode %s", val);
+			r->net_mode = i;
+		} else if (!strcmp(tok, "cpms")) {
+			for (i = 0; i < PROFILE_CPMS; i++)
+				if (!strcasecmp(val, cpms_names[i])) break;
+			if (i == PROFILE_CPMS) die("unknown cpms %s", val);
+			r->cpms = i;
+		} else {
+			die("unknown state %s", tok);
+		}
+	}
+}
+
+static void parse(FILE *f)
+{
+	char line[PROFC_LINE_SZ], *p, *arg, *text;
+	struct pcmd *c = NULL;
+	struct pstep *st;
+	struct preply *r;
+	size_t n;
+	int i;
+
+	lineno = 0;
+	while (fgets(line, sizeof(line), f)) {
+		lineno++;
+		n = strlen(line);
+		if (n && line[n - 1] != '\n' && !feof(f)) die("line too long");
+		while (n && (line[n - 1] == '\n' || line[n - 1] == '\r'))
+			line[--n] = '\0';
+
+		/* reply text */
+		if (line[0] == ' ' || line[0] == '\t') {
+			for (p = line; *p == ' ' || *p == '\t'; p++)
+				;
+			if (!*p) continue;
+			if (c == NULL) die("reply text outside of a command");
+			st = step_cur(c);
+			text = expand(p);
+			buf_add(&st->text, text, strlen(text));
+			buf_add(&st->text, "\n\r", 2);
+			free(text);
+			continue;
+		}
+
+		if (!line[0] || line[0] == '#') continue;
+
+		arg = line + strcspn(line, " \t");
+		if (*arg) *arg++ = '\0';
+		arg += strspn(arg, " \t");
+
+		if (!strcmp(line, "profile")) {
+			free(name);
+			name = expand(arg);
+		} else if (!strcmp(line, "define")) {
+			p = arg + strcspn(arg, " \t");
+			if (*p) *p++ = '\0';
+			p += strspn(p, " \t");
+			if (!*arg) die("define without a name");
+			defines = xrealloc(defines, (ndefines + 1) * sizeof(*defines));
+			defines[ndefines].value = expand(p);
+			defines[ndefines].name = xstrdup(arg);
+			ndefines++;
+		} else if (!strcmp(line, "exact") || !strcmp(line, "prefix")) {
+			if (!*arg) die("%s without a pattern", line);
+			cmds = xrealloc(cmds, (ncmds + 1) * sizeof(*cmds));
+			c = &cmds[ncmds++];
+			memset(c, 0, sizeof(*c));
+			c->match = !strcmp(line, "exact") ? AT_MATCH_EXACT : AT_MATCH_PREFIX;
+			c->pattern = expand(arg);
+			c->line = lineno;
+			if (strlen(c->pattern) > UINT16_MAX) die("pattern too long");
+		} else if (!strcmp(line, "handler")) {
+			if (c == NULL) die("handler outside of a command");
+			if (c->nreplies) die("a command with replies has no handler");
+			for (i = 0; i < (int)(sizeof(handlers) / sizeof(handlers[0])); i++)
+				if (!strcmp(arg, handlers[i])) break;
+			if (i == (int)(sizeof(handlers) / sizeof(handlers[0])))
+				die("unknown handler %s", arg);
+			c->handler = xstrdup(arg);
+		} else if (!strcmp(line, "state")) {
+			if (c == NULL) die("state outside of a command");
+			r = reply_new(c);
+			parse_state(r, arg);
+		} else if (!strcmp(line, "delay")) {
+			if (c == NULL) die("delay outside of a command");
+			step_cur(c);
+			r = &c->reply[c->nreplies - 1];
+			/* a delay before any text delays the first step */
+			if (r->nsteps > 1 || r->step[0].text.len || r->step[0].delay_ms) {
+				r->step = xrealloc(r->step, (r->nsteps + 1) * sizeof(*r->step));
+				memset(&r->step[r->nsteps], 0, sizeof(*r->step));
+				r->nsteps++;
+			}
+			r->step[r->nsteps - 1].delay_ms = strtoul(arg, &p, 10);
+			if (p == arg || *p) die("invalid delay %s", arg);
+		} else {
+			die("unknown directive %s", line);
+		}
+	}
+	lineno = 0;
+}
+
+static const struct preply *resolve(const struct pcmd *c, int net_mode, int cpms)
+{
+	const struct preply *best = NULL;
+	int i, spec, best_spec = -1;
+
+	for (i = 0; i < c->nreplies; i++) {
+		const struct preply *r = &c->reply[i];
+
+		if ((r->net_mode >= 0 && r->net_mode != net_mode) ||
+				(r->cpms >= 0 && r->cpms != cpms))
+			continue;
+		spec = (r->net_mode >= 0) + (r->cpms >= 0);
+		if (spec == best_spec) {
+			lineno = c->line;
+			die("%s: two replies for net_mode=%s cpms=%s", c->pattern,
+					net_modes[net_mode], cpms_names[cpms]);
+		}
+		if (spec > best_spec) {
+			best = r;
+			best_spec = spec;
+		}
+	}
+
+	if (best == NULL) {
+		lineno = c->line;
+		die("%s: no reply for net_mode=%s cpms=%s", c->pattern,
+				net_modes[net_mode], cpms_names[cpms]);
+	}
+
+	return best;
+}
+
+static void emit(const char *path)
+{
+	struct buf img = { 0 }, strings = { 0 }, replies = { 0 };
+	struct profile_hdr h;
+	struct profile_cmd *pc;
+	struct attab_cmd *ac;
+	struct attab t;
+	uint32_t *pattern_off, step[3];
+	uint16_t *pattern_len;
+	uint32_t replies_at;
+	char *tmp;
+	FILE *f;
+	int i, j, k;
+
+	ac = xrealloc(NULL, (ncmds ? ncmds : 1) * sizeof(*ac));
+	for (i = 0; i < ncmds; i++) {
+		ac[i].match = cmds[i].match;
+		ac[i].pattern = cmds[i].pattern;
+	}
+	if (attab_build(&t, ac, ncmds) < 0) die("cannot build the dispatcher tables");
+
+	memset(&h, 0, sizeof(h));
+	h.magic = PROFILE_MAGIC;
+	h.version = PROFILE_VERSION;
+	h.ncmds = ncmds;
+	h.seed = t.seed;
+	h.mask = t.mask;
+	h.ntrie = t.ntrie;
+	h.nedges = t.nedges;
+
+	/* offset 0 of strings is the empty string, "none" for handlers */
+	buf_add(&strings, "", 1);
+	h.name = strings.len;
+	buf_add(&strings, name ? name : "", strlen(name ? name : "") + 1);
+
+	pc = xrealloc(NULL, (ncmds ? ncmds : 1) * sizeof(*pc));
+	pattern_off = xrealloc(NULL, (ncmds ? ncmds : 1) * sizeof(*pattern_off));
+	pattern_len = xrealloc(NULL, (ncmds ? ncmds : 1) * sizeof(*pattern_len));
+	memset(pc, 0, (ncmds ? ncmds : 1) * sizeof(*pc));
+
+	for (i = 0; i < ncmds; i++) {
+		struct pcmd *c = &cmds[i];
+
+		pattern_off[i] = strings.len;
+		pattern_len[i] = strlen(c->pattern);
+		buf_add(&strings, c->pattern, pattern_len[i] + 1);
+
+		if (c->handler) {
+			pc[i].handler = strings.len;
+			buf_add(&strings, c->handler, strlen(c->handler) + 1);
+			continue;
+		}
+
+		for (j = 0; j < c->nreplies; j++) {
+			struct preply *r = &c->reply[j];
+
+			r->off = buf_align(&replies, 4);
+			step[0] = r->nsteps;
+			buf_add(&replies, step, sizeof(step[0]));
+			for (k = 0; k < r->nsteps; k++) {
+				step[0] = r->step[k].delay_ms;
+				step[1] = strings.len;
+				step[2] = r->step[k].text.len;
+				buf_add(&strings, r->step[k].text.p, r->step[k].text.len);
+				buf_add(&strings, "", 1);
+				buf_add(&replies, step, sizeof(step));
+			}
+		}
+	}
+
+	/* header, fixed size tables, replies, strings */
+	buf_add(&img, &h, sizeof(h));
+	h.cmds = buf_align(&img, 4);
+	buf_add(&img, pc, ncmds * sizeof(*pc));
+	h.pattern_off = buf_align(&img, 4);
+	buf_add(&img, pattern_off, ncmds * sizeof(*pattern_off));
+	h.pattern_len = buf_align(&img, 4);
+	buf_add(&img, pattern_len, ncmds * sizeof(*pattern_len));
+	h.slots = buf_align(&img, 4);
+	buf_add(&img, t.slots, (t.mask + 1) * sizeof(*t.slots));
+	h.trie = buf_align(&img, 4);
+	buf_add(&img, t.trie, t.ntrie * sizeof(*t.trie));
+	h.edges = buf_align(&img, 4);
+	buf_add(&img, t.edges, t.nedges * sizeof(*t.edges));
+	replies_at = buf_align(&img, 4);
+	buf_add(&img, replies.p, replies.len);
+	h.strings = buf_align(&img, 4);
+	h.strings_sz = strings.len;
+	buf_add(&img, strings.p, strings.len);
+	h.size = buf_align(&img, 4);
+
+	/* now that the layout is known, point the commands at their replies */
+	pc = (struct profile_cmd *)(img.p + h.cmds);
+	for (i = 0; i < ncmds; i++) {
+		if (cmds[i].handler) continue;
+		for (j = 0; j < PROFILE_NET_MODES; j++) {
+			for (k = 0; k < PROFILE_CPMS; k++) {
+				pc[i].reply[profile_state(j, k)] =
+					replies_at + resolve(&cmds[i], j, k)->off;
+			}
+		}
+	}
+	memcpy(img.p, &h, sizeof(h));
+
+	/*
+	 * gustavd maps the image shared: never write into the file it may
+	 * be using, replace it with a new one so a reload picks that up.
+	 */
+	tmp = xrealloc(NULL, strlen(path) + sizeof(".tmp"));
+	sprintf(tmp, "%s.tmp", path);
+	f = fopen(tmp, "wb");
+	if (f == NULL) die("%s: %s", tmp, strerror(errno));
+	if (fwrite(img.p, 1, img.len, f) != img.len || fclose(f) != 0 ||
+			rename(tmp, path) != 0) {
+		remove(tmp);
+		die("%s: %s", path, strerror(errno));
+	}
+	free(tmp);
+
+	attab_free(&t);
+}
+
+int main(int argc, char *argv[])
+{
+	FILE *f;
+
+	if (argc != 3) {
+		fprintf(stderr, "Usage: profc <profile> <image>\n");
+		return EXIT_FAILURE;
+	}
+
+	src = argv[1];
+	f = fopen(src, "r");
+	if (f == NULL) die("%s: %s", src, strerror(errno));
+	parse(f);
+	fclose(f);
+
+	emit(argv[2]);
+
+	return EXIT_SUCCESS;
+}
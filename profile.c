@@ -0,0 +1,155 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "profile.h"
+
+static int profile_range(const struct profile *p, uint32_t off, size_t n, size_t align);
+static int profile_string(const struct profile *p, uint32_t off, uint32_t len);
+static int profile_cstr(const struct profile *p, uint32_t off);
+static int profile_check(struct profile *p);
+
+/* n bytes at off lie inside the image and off is aligned */
+static int profile_range(const struct profile *p, uint32_t off, size_t n, size_t align)
+{
+	return off % align == 0 && off <= p->size && n <= p->size - off;
+}
+
+/* len bytes at off in strings, followed by a NUL */
+static int profile_string(const struct profile *p, uint32_t off, uint32_t len)
+{
+	const struct profile_hdr *h = p->hdr;
+
+	return off < h->strings_sz && len < h->strings_sz - off &&
+		profile_str(p, off)[len] == '\0';
+}
+
+/* a string at off in strings, which are known to end with a NUL */
+static int profile_cstr(const struct profile *p, uint32_t off)
+{
+	return off < p->hdr->strings_sz;
+}
+
+static int profile_check(struct profile *p)
+{
+	const struct profile_hdr *h = p->hdr;
+	const struct profile_reply *r;
+	const uint32_t *off;
+	const uint16_t *len;
+	const int16_t *slots;
+	uint32_t i, j, k;
+
+	if (!profile_range(p, 0, sizeof(*h), 4) || h->magic != PROFILE_MAGIC ||
+			h->version != PROFILE_VERSION || h->size != p->size)
+		return -1;
+
+	if (h->ncmds > INT16_MAX || h->mask >= 0x10000 || (h->mask & (h->mask + 1)) ||
+			h->ntrie == 0 || h->ntrie > 0x10000 || h->nedges > 0x10000 ||
+			!profile_range(p, h->strings, h->strings_sz, 1) || !h->strings_sz ||
+			p->base[h->strings + h->strings_sz - 1] != '\0' ||
+			!profile_range(p, h->cmds, h->ncmds * sizeof(*p->cmds), 4) ||
+			!profile_range(p, h->pattern_off, h->ncmds * sizeof(uint32_t), 4) ||
+			!profile_range(p, h->pattern_len, h->ncmds * sizeof(uint16_t), 2) ||
+			!profile_range(p, h->slots, (h->mask + 1) * sizeof(int16_t), 2) ||
+			!profile_range(p, h->trie, h->ntrie * sizeof(struct at_trie_node), 2) ||
+			!profile_range(p, h->edges, h->nedges * sizeof(struct at_trie_edge), 2) ||
+			!profile_cstr(p, h->name))
+		return -1;
+
+	p->cmds = (const struct profile_cmd *)(p->base + h->cmds);
+	off = (const uint32_t *)(p->base + h->pattern_off);
+	len = (const uint16_t *)(p->base + h->pattern_len);
+	slots = (const int16_t *)(p->base + h->slots);
+
+	p->tab.seed = h->seed;
+	p->tab.mask = h->mask;
+	p->tab.strings = p->base + h->strings;
+	p->tab.pattern_off = off;
+	p->tab.pattern_len = len;
+	p->tab.slots = slots;
+	p->tab.trie = (const struct at_trie_node *)(p->base + h->trie);
+	p->tab.edges = (const struct at_trie_edge *)(p->base + h->edges);
+
+	/* every index the lookup follows must stay inside its table */
+	for (i = 0; i <= h->mask; i++)
+		if (slots[i] < -1 || slots[i] >= (int)h->ncmds) return -1;
+	for (i = 0; i < h->ntrie; i++) {
+		if (p->tab.trie[i].edge + p->tab.trie[i].nedges > h->nedges ||
+				p->tab.trie[i].cmd < -1 || p->tab.trie[i].cmd >= (int)h->ncmds)
+			return -1;
+	}
+	for (i = 0; i < h->nedges; i++)
+		if (p->tab.edges[i].node >= h->ntrie) return -1;
+
+	for (i = 0; i < h->ncmds; i++) {
+		if (!profile_string(p, off[i], len[i])) return -1;
+		if (p->cmds[i].handler) {
+			if (!profile_cstr(p, p->cmds[i].handler)) return -1;
+			continue;
+		}
+		for (j = 0; j < PROFILE_STATES; j++) {
+			if (!profile_range(p, p->cmds[i].reply[j], sizeof(*r), 4)) return -1;
+			r = profile_reply(p, p->cmds[i].reply[j]);
+			if (!r->nsteps || !profile_range(p, p->cmds[i].reply[j],
+						sizeof(*r) + (size_t)r->nsteps * sizeof(r->step[0]), 4))
+				return -1;
+			for (k = 0; k < r->nsteps; k++)
+				if (!profile_string(p, r->step[k].text, r->step[k].len)) return -1;
+		}
+	}
+
+	return 0;
+}
+
+int profile_open(struct profile *p, const char *path)
+{
+	struct stat st;
+	void *base;
+	int fd, err;
+
+	memset(p, 0, sizeof(*p));
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) return -1;
+
+	if (fstat(fd, &st) < 0) {
+		err = errno;
+		close(fd);
+		errno = err;
+		return -1;
+	}
+	if (st.st_size < (off_t)sizeof(struct profile_hdr) || st.st_size > UINT32_MAX) {
+		close(fd);
+		errno = EINVAL;
+		return -1;
+	}
+
+	base = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	err = errno;
+	close(fd);
+	if (base == MAP_FAILED) {
+		errno = err;
+		return -1;
+	}
+
+	p->base = base;
+	p->size = st.st_size;
+	p->hdr = base;
+
+	if (profile_check(p) < 0) {
+		profile_close(p);
+		errno = EINVAL;
+		return -1;
+	}
+
+	return 0;
+}
+
+void profile_close(struct profile *p)
+{
+	if (p->base) munmap((void *)p->base, p->size);
+	memset(p, 0, sizeof(*p));
+}
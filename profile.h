@@ -0,0 +1,87 @@
+#ifndef __PROFILE_H
+#define __PROFILE_H
+
+/*
+ * Compiled modem profile.
+ *
+ * profc turns a text profile (see profiles/) into an image that gustavd
+ * maps read-only with -p, and maps again on SIGHUP: the image holds
+ * dispatcher tables in the layout of atdisp.h and, for every command, one
+ * reply per session state, so the daemon uses it in place without parsing
+ * anything. Processes mapping the same image share its pages. profc
+ * replaces an image rather than rewriting it, mappings of the old one stay
+ * valid.
+ *
+ * All offsets are relative to the start of the image, numbers are in the
+ * byte order of the host profc ran on; an image of the other byte order
+ * is rejected by its magic.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "atdisp.h"
+
+#define PROFILE_MAGIC	0x46525047	/* "GPRF" read as little-endian */
+#define PROFILE_VERSION	1
+
+/* replies are kept per (net_mode, cpms), see session.h */
+#define PROFILE_NET_MODES	4
+#define PROFILE_CPMS		2
+#define PROFILE_STATES		(PROFILE_NET_MODES * PROFILE_CPMS)
+#define profile_state(net_mode, cpms) ((net_mode) * PROFILE_CPMS + (cpms))
+
+struct profile_hdr {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t size;		/* of the whole image */
+	uint32_t name;		/* profile name, in strings */
+
+	uint32_t ncmds;
+	uint32_t seed;
+	uint32_t mask;
+	uint32_t ntrie;
+	uint32_t nedges;
+
+	uint32_t cmds;		/* struct profile_cmd[ncmds] */
+	uint32_t pattern_off;	/* uint32_t[ncmds], relative to strings */
+	uint32_t pattern_len;	/* uint16_t[ncmds] */
+	uint32_t slots;		/* int16_t[mask + 1] */
+	uint32_t trie;		/* struct at_trie_node[ntrie] */
+	uint32_t edges;		/* struct at_trie_edge[nedges] */
+	uint32_t strings;	/* NUL terminated strings */
+	uint32_t strings_sz;
+};
+
+struct profile_step {
+	uint32_t delay_ms;	/* after the previous step */
+	uint32_t text;		/* terminated lines, in strings */
+	uint32_t len;
+};
+
+struct profile_reply {
+	uint32_t nsteps;
+	struct profile_step step[];
+};
+
+struct profile_cmd {
+	uint32_t handler;	/* name of a built-in handler in strings, 0 if none */
+	uint32_t reply[PROFILE_STATES];	/* struct profile_reply, 0 with a handler */
+};
+
+struct profile {
+	const char *base;
+	size_t size;
+	const struct profile_hdr *hdr;
+	const struct profile_cmd *cmds;
+	struct at_table tab;	/* lookup in the image */
+};
+
+#define profile_str(p, off) ((p)->base + (p)->hdr->strings + (off))
+#define profile_reply(p, off) ((const struct profile_reply *)((p)->base + (off)))
+
+/* map and check an image, returns -1 with errno set (EINVAL if malformed) */
+int profile_open(struct profile *p, const char *path);
+void profile_close(struct profile *p);
+
+#endif /* __PROFILE_H */
@@ -0,0 +1,62 @@
+# SIMCOM A7909E: the identity of the module, everything else is built in.
+#
+# Compile with: profc a7909e.profile a7909e.prof
+# and run:      gustavd -p a7909e.prof ...
+
+profile a7909e
+
+define MANUFACTURER SIMCOM BY GUSTAV
+define MODEL A7909E
+define SUBEDITION B03V01
+define FW_VERSION 1.5.4
+define IMEI 352812192643726
+define IMSI 262076983126791
+define ICCID 89262070872643044636
+
+exact ATI
+	Manufacturer: ${MANUFACTURER}
+	Model: ${MODEL}
+	Revision: V1.0.009
+	IMEI: ${IMEI}
+	OK
+
+exact AT+SIMCOMATI
+	Manufacturer: ${MANUFACTURER}
+	Model: ${MODEL}
+	Revision: ${FW_VERSION}
+	IMEI: ${IMEI}
+	OK
+
+exact ATI;+CSUB
+	${MANUFACTURER}
+	${MODEL}
+	Revision: ${FW_VERSION}
+	SubEdition: ${SUBEDITION}
+	OK
+
+exact AT+CSUB
+	+CSUB: ${SUBEDITION}
+	OK
+
+exact AT+GSN
+	${IMEI}
+	OK
+
+exact AT+CGMR
+	+CGMR: ${FW_VERSION}
+	OK
+
+exact AT+CICCID
+	+ICCID: ${ICCID}
+	OK
+
+exact AT+CIMI
+	${IMSI}
+	OK
+
+# the module has no Quectel commands
+exact AT+QGMR
+	ERROR
+
+exact AT+QCCID
+	ERROR
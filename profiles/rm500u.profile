@@ -0,0 +1,60 @@
+# Quectel RM500U, the identity gustavd is built with, spelt out as a
+# profile; an example of replies that depend on the session state and of
+# replies that take their time.
+
+profile rm500u
+
+define MANUFACTURER QUECTEL BY GUSTAV
+define MODEL RM500U
+define SUBEDITION V05
+define FW_VERSION 1.5.4
+define IMEI 352812192643726
+define ICCID 89262070872643044636
+define MCCMNC 26203
+
+exact ATI
+	Manufacturer: ${MANUFACTURER}
+	Model: ${MODEL}
+	Revision: V1.0.009
+	IMEI: ${IMEI}
+	OK
+
+exact AT+CSUB
+	+CSUB: ${SUBEDITION}
+	OK
+
+exact AT+QGMR
+	${FW_VERSION}
+	OK
+
+exact AT+QCCID
+	+QCCID: ${ICCID}
+	OK
+
+# one reply per network mode, selected with AT+QNWPREFCFG="mode_pref"
+exact AT+QNWINFO
+state net_mode=auto
+	+QNWINFO: "FDD LTE",${MCCMNC},"LTE BAND 1",300
+	+QNWINFO: "NR5G-NSA",${MCCMNC},"NR N41",529950
+	OK
+state net_mode=nr
+	+QNWINFO: "NR5G-SA",${MCCMNC},"NR N41",529950
+	OK
+state net_mode=lte
+	+QNWINFO: "FDD LTE",26202,"LTE BAND 7",2850
+	OK
+state net_mode=umts
+	+QNWINFO: "HSPA+",25002,"WCDMA 2100",10687
+	OK
+
+# registration takes a while
+exact AT+COPS=0
+	+XACTIVATE: 1
+delay 1
+	+XACTIVATE: 2
+delay 2000
+	OK
+
+# handled by the built-in code
+exact AT+CPSI?
+handler at_cpsi_get
@@ -0,0 +1,112 @@
+#ifndef __SESSION_H
+#define __SESSION_H
+
+#include "ev.h"
+#include "main.h"
+#include "outq.h"
+#include "sms.h"
+#include "split.h"
+#include "stats.h"
+#include "urc.h"
+
+enum cpms_t
+{
+	CPMS_SM,
+	CPMS_ME,
+	CPMS_MAX
+};
+
+enum network_mode_t
+{
+	NET_MODE_AUTO,
+	NET_MODE_NR,
+	NET_MODE_LTE,
+	NET_MODE_UMTS,
+	NET_MODE_MAX
+};
+
+struct at_step;
+struct at_profile;
+struct sms_store;
+
+/* +CMGL entries a listing describes to the writer at a time */
+#define SESSION_CMGL_WIN 32
+
+/*
+ * One emulated modem: AT layer state, the input line being assembled and
+ * the output queue. Nothing in here is shared between sessions, so any
+ * number of them can be served from one event loop.
+ */
+struct session {
+	enum cpms_t cpms;
+	enum network_mode_t net_mode;
+	int echo;
+	int enqueueUssd;
+	int waitPdu;
+	unsigned pdu_len;	/* <length> of AT+CMGS */
+	/* PDU entered after the prompt, taken from the input as it comes */
+	char pdu[SMS_PDU_MAX * 2];
+	unsigned pdu_n;		/* hex digits, may run past the buffer */
+	int pdu_bad;		/* something other than hex digits came */
+	uint8_t mr;		/* TP-MR the next message sent gets */
+	unsigned dlci;		/* CMUX channel, 0 if the session is the port's */
+	unsigned cmux_n1;	/* AT+CMUX accepted, frames of this size follow */
+
+	/* SMS storages, opened on first use */
+	struct sms_store *sms[CPMS_MAX];
+	/*
+	 * AT+CMGL in progress, input is held until it completes. The listing
+	 * is queued as a source: a window of entries, each a formatted header
+	 * and a reference to the PDU in the store.
+	 */
+	struct {
+		struct outq_src src;
+		struct sms_store *st;
+		int stat;
+		int done;		/* all sent, OK may follow */
+		unsigned next;		/* slot to go on from */
+		unsigned first, n;	/* entries in the window */
+		size_t off;		/* bytes of the first one sent */
+		struct {
+			unsigned idx;
+			unsigned hdr_len;
+			char hdr[24];
+		} win[SESSION_CMGL_WIN];
+	} cmgl;
+
+	/* deferred response in progress, input is held until it completes */
+	const struct at_step *step;
+	struct ev_timer timer;
+	/* profile the queued output or deferred response may refer to */
+	struct at_profile *prof;
+
+	struct splitter split;
+	/*
+	 * Rest of a line of several commands (V.250 concatenation), without
+	 * the AT and blanks; cl_pos is where the next command starts.
+	 */
+	char cl[TTY_RD_SZ];
+	unsigned cl_pos, cl_len;
+
+	/* input received while held, not split into lines yet */
+	char rx[TTY_RD_BUF];
+	int rx_len;
+
+	struct outq q;
+	struct stats_marks lat;
+	/* unsolicited result codes, see urc.h */
+	struct urc_state urc;
+
+	struct ev_loop *loop;
+	/* called when output was queued or input processing may resume */
+	void (*kick)(struct session *s);
+	/* owner of the session, e.g. the port it is served on */
+	void *owner;
+	const char *name;	/* of the port, names files kept per session */
+};
+
+#define session_busy(s) ((s)->step != NULL || (s)->cmgl.st != NULL)
+/* no more AT lines may be processed for now */
+#define session_held(s) (session_busy(s) || outq_full(&(s)->q))
+
+#endif /* __SESSION_H */
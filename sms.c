@@ -0,0 +1,228 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "sms.h"
+
+#define SMS_MAGIC	0x534d5347	/* "GSMS" read as little-endian */
+#define SMS_VERSION	1
+
+struct sms_file_hdr {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t nslots;
+	uint32_t slot_size;
+};
+
+#define SMS_WORDS(n) (((n) + 63) / 64)
+#define sms_bit_set(map, i) ((map)[(i) / 64] |= 1ULL << ((i) % 64))
+#define sms_bit_clr(map, i) ((map)[(i) / 64] &= ~(1ULL << ((i) % 64)))
+
+static int sms_file_open(struct sms_store *st, const char *path);
+static void sms_index(struct sms_store *st, unsigned idx);
+static void sms_unindex(struct sms_store *st, unsigned idx);
+
+/* map the file at path, returns 1 if it had to be started afresh */
+static int sms_file_open(struct sms_store *st, const char *path)
+{
+	struct sms_file_hdr hdr;
+	struct stat sb;
+	int fd, err, fresh = 0;
+
+	st->size = sizeof(hdr) + (size_t)st->nslots * sizeof(struct sms);
+
+	fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+	if (fd < 0) return -1;
+
+	if (fstat(fd, &sb) < 0) goto fail;
+	if ((size_t)sb.st_size != st->size ||
+			pread(fd, &hdr, sizeof(hdr), 0) != sizeof(hdr) ||
+			hdr.magic != SMS_MAGIC || hdr.version != SMS_VERSION ||
+			hdr.nslots != st->nslots || hdr.slot_size != sizeof(struct sms)) {
+		hdr.magic = SMS_MAGIC;
+		hdr.version = SMS_VERSION;
+		hdr.nslots = st->nslots;
+		hdr.slot_size = sizeof(struct sms);
+		if (ftruncate(fd, 0) < 0 || ftruncate(fd, st->size) < 0 ||
+				pwrite(fd, &hdr, sizeof(hdr), 0) != sizeof(hdr))
+			goto fail;
+		fresh = 1;
+	}
+
+	st->base = mmap(NULL, st->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (st->base == MAP_FAILED) {
+		st->base = NULL;
+		goto fail;
+	}
+	close(fd);
+	st->slot = (struct sms *)((char *)st->base + sizeof(hdr));
+
+	return fresh;
+
+fail:
+	err = errno;
+	close(fd);
+	errno = err;
+	return -1;
+}
+
+int sms_store_open(struct sms_store *st, unsigned nslots, const char *path)
+{
+	uint64_t *maps;
+	unsigned i;
+	int r = 1;
+
+	memset(st, 0, sizeof(*st));
+	st->nslots = nslots;
+
+	maps = calloc((size_t)SMS_WORDS(nslots) * (SMS_STAT_MAX + 1), sizeof(*maps));
+	if (maps == NULL) return -1;
+	for (i = 0; i <= SMS_STAT_MAX; i++)
+		st->map[i] = maps + (size_t)i * SMS_WORDS(nslots);
+
+	if (path) {
+		r = sms_file_open(st, path);
+	} else {
+		st->slot = calloc(nslots, sizeof(*st->slot));
+		if (st->slot == NULL) r = -1;
+	}
+	if (r < 0) {
+		free(maps);
+		st->map[0] = NULL;
+		return -1;
+	}
+
+	/* rebuild the index, anything that does not look like a message is dropped */
+	for (i = 0; i < nslots; i++) {
+		struct sms *m = &st->slot[i];
+
+		if (!m->stat) continue;
+		if (m->stat > SMS_STAT_MAX || m->len < 2 || m->len > sizeof(m->pdu)) {
+			memset(m, 0, sizeof(*m));
+			continue;
+		}
+		sms_index(st, i);
+	}
+
+	return r;
+}
+
+void sms_store_close(struct sms_store *st)
+{
+	if (st->base)
+		munmap(st->base, st->size);
+	else
+		free(st->slot);
+	free(st->map[0]);
+	memset(st, 0, sizeof(*st));
+}
+
+static void sms_index(struct sms_store *st, unsigned idx)
+{
+	enum sms_stat stat = sms_stat(&st->slot[idx]);
+
+	sms_bit_set(st->map[stat], idx);
+	sms_bit_set(st->map[SMS_ALL], idx);
+	st->count[stat]++;
+	st->used++;
+}
+
+static void sms_unindex(struct sms_store *st, unsigned idx)
+{
+	enum sms_stat stat = sms_stat(&st->slot[idx]);
+
+	sms_bit_clr(st->map[stat], idx);
+	sms_bit_clr(st->map[SMS_ALL], idx);
+	st->count[stat]--;
+	st->used--;
+	if (idx < st->free_hint) st->free_hint = idx;
+}
+
+int sms_put_at(struct sms_store *st, unsigned idx, enum sms_stat stat,
+		unsigned tpdu_len, const char *hex, size_t len)
+{
+	struct sms *m;
+
+	if (idx >= st->nslots || stat >= SMS_STAT_MAX || len > sizeof(m->pdu) - 2) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	m = &st->slot[idx];
+	if (m->stat) sms_unindex(st, idx);
+
+	memcpy(m->pdu, hex, len);
+	memcpy(m->pdu + len, "\n\r", 2);
+	m->len = len + 2;
+	m->tpdu_len = tpdu_len;
+	m->stat = stat + 1;
+	sms_index(st, idx);
+
+	return idx;
+}
+
+int sms_put(struct sms_store *st, enum sms_stat stat, unsigned tpdu_len,
+		const char *hex, size_t len)
+{
+	const uint64_t *used = st->map[SMS_ALL];
+	unsigned w, idx;
+
+	for (w = st->free_hint / 64; w < SMS_WORDS(st->nslots); w++)
+		if (~used[w]) break;
+	idx = w * 64 + (w < SMS_WORDS(st->nslots) ? __builtin_ctzll(~used[w]) : 0);
+	if (idx >= st->nslots) {
+		st->free_hint = st->nslots;
+		errno = ENOSPC;
+		return -1;
+	}
+	st->free_hint = idx + 1;
+
+	return sms_put_at(st, idx, stat, tpdu_len, hex, len);
+}
+
+const struct sms *sms_get(const struct sms_store *st, unsigned idx)
+{
+	if (idx >= st->nslots || !st->slot[idx].stat) return NULL;
+
+	return &st->slot[idx];
+}
+
+void sms_set_stat(struct sms_store *st, unsigned idx, enum sms_stat stat)
+{
+	if (idx >= st->nslots || !st->slot[idx].stat || stat >= SMS_STAT_MAX) return;
+
+	sms_unindex(st, idx);
+	st->slot[idx].stat = stat + 1;
+	sms_index(st, idx);
+}
+
+int sms_del(struct sms_store *st, unsigned idx)
+{
+	if (idx >= st->nslots || !st->slot[idx].stat) return -1;
+
+	sms_unindex(st, idx);
+	st->slot[idx].stat = 0;
+
+	return 0;
+}
+
+int sms_next(const struct sms_store *st, enum sms_stat stat, unsigned idx)
+{
+	const uint64_t *map = st->map[stat];
+	unsigned w = idx / 64;
+	uint64_t bits;
+
+	if (idx >= st->nslots) return -1;
+
+	bits = map[w] & (~0ULL << (idx % 64));
+	while (!bits) {
+		if (++w >= SMS_WORDS(st->nslots)) return -1;
+		bits = map[w];
+	}
+
+	return w * 64 + __builtin_ctzll(bits);
+}
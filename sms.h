@@ -0,0 +1,73 @@
+#ifndef __SMS_H
+#define __SMS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * SMS storage of one memory (SM, ME) of a session.
+ *
+ * Messages live in fixed-size slots indexed by their <index>, so reading,
+ * writing and deleting one is O(1). Every status has a bitmap of the slots
+ * holding messages of that status; listing skips 64 empty or non-matching
+ * slots per word and finding a free slot for a new message likewise.
+ *
+ * A store is either plain memory or a file mapped shared, in which case
+ * the messages survive a restart. The file holds a header and the slots
+ * only, the bitmaps are rebuilt when it is opened.
+ */
+
+#define SMS_PDU_MAX	176	/* octets, SMSC address included */
+
+enum sms_stat {
+	SMS_REC_UNREAD,
+	SMS_REC_READ,
+	SMS_STO_UNSENT,
+	SMS_STO_SENT,
+	SMS_STAT_MAX,
+	SMS_ALL = SMS_STAT_MAX	/* AT+CMGL=4 */
+};
+
+struct sms {
+	uint8_t stat;		/* enum sms_stat + 1, 0 if the slot is free */
+	uint8_t pad;
+	uint16_t tpdu_len;	/* <length> of +CMGR and +CMGL */
+	uint16_t len;		/* of pdu, "\n\r" included */
+	char pdu[SMS_PDU_MAX * 2 + 2];	/* hex, terminated */
+};
+
+struct sms_store {
+	struct sms *slot;
+	unsigned nslots;
+	unsigned used;
+	unsigned count[SMS_STAT_MAX];
+	uint64_t *map[SMS_STAT_MAX + 1];	/* per status, the last one all used slots */
+	unsigned free_hint;	/* no free slot below */
+	void *base;		/* file mapping, NULL if in memory */
+	size_t size;
+};
+
+#define sms_stat(m) ((enum sms_stat)((m)->stat - 1))
+
+/*
+ * nslots empty slots in memory, or in the file at path if not NULL; a
+ * file of another size or format is started afresh. Returns 1 if the
+ * store is new, 0 if messages were loaded, -1 with errno set.
+ */
+int sms_store_open(struct sms_store *st, unsigned nslots, const char *path);
+void sms_store_close(struct sms_store *st);
+
+/* store a message in the lowest free slot, returns the slot or -1 if full */
+int sms_put(struct sms_store *st, enum sms_stat stat, unsigned tpdu_len,
+		const char *hex, size_t len);
+/* store a message in slot idx, replacing what was there */
+int sms_put_at(struct sms_store *st, unsigned idx, enum sms_stat stat,
+		unsigned tpdu_len, const char *hex, size_t len);
+/* the message in slot idx, NULL if there is none */
+const struct sms *sms_get(const struct sms_store *st, unsigned idx);
+void sms_set_stat(struct sms_store *st, unsigned idx, enum sms_stat stat);
+int sms_del(struct sms_store *st, unsigned idx);
+/* first slot from idx on with a message of stat (or SMS_ALL), -1 if none */
+int sms_next(const struct sms_store *st, enum sms_stat stat, unsigned idx);
+
+#endif /* __SMS_H */
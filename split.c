@@ -0,0 +1,291 @@
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define SPLIT_X86
+#include <immintrin.h>
+#endif
+
+#include "split.h"
+
+static const char *find_eol_c(const char *p, const char *end);
+static const char *find_nonhex_c(const char *p, const char *end);
+#ifdef SPLIT_X86
+static const char *find_eol_sse2(const char *p, const char *end);
+static const char *find_eol_avx2(const char *p, const char *end);
+static const char *find_nonhex_sse2(const char *p, const char *end);
+static const char *find_nonhex_avx2(const char *p, const char *end);
+static int have_sse2(void);
+static int have_avx2(void);
+#endif
+static int have_c(void);
+static int split_append(struct splitter *sp, const char *p, int n, int *stop);
+
+static const struct {
+	const char *name;
+	split_eol_fn fn;
+	split_eol_fn nonhex;
+	int (*supported)(void);
+} impls[] = {
+	/* best first */
+#ifdef SPLIT_X86
+	{ "avx2", find_eol_avx2, find_nonhex_avx2, have_avx2 },
+	{ "sse2", find_eol_sse2, find_nonhex_sse2, have_sse2 },
+#endif
+	{ "c", find_eol_c, find_nonhex_c, have_c },
+};
+
+#define NIMPLS ((int)(sizeof(impls) / sizeof(impls[0])))
+
+split_eol_fn split_find_eol = find_eol_c;
+split_eol_fn split_find_nonhex = find_nonhex_c;
+static const char *impl_name = "c";
+
+static int have_c(void)
+{
+	return 1;
+}
+
+static const char *find_eol_c(const char *p, const char *end)
+{
+	while (p < end && *p && *p != '\r' && *p != '\n')
+		p++;
+
+	return p;
+}
+
+static const char *find_nonhex_c(const char *p, const char *end)
+{
+	unsigned char c;
+
+	for (; p < end; p++) {
+		c = *p;
+		if ((unsigned char)(c - '0') > 9 && (unsigned char)((c | 0x20) - 'a') > 5)
+			break;
+	}
+
+	return p;
+}
+
+#ifdef SPLIT_X86
+
+static int have_sse2(void)
+{
+	return __builtin_cpu_supports("sse2");
+}
+
+static int have_avx2(void)
+{
+	return __builtin_cpu_supports("avx2");
+}
+
+__attribute__((target("sse2")))
+static const char *find_eol_sse2(const char *p, const char *end)
+{
+	const __m128i cr = _mm_set1_epi8('\r');
+	const __m128i lf = _mm_set1_epi8('\n');
+	const __m128i nul = _mm_setzero_si128();
+	__m128i v, m;
+	int mask;
+
+	while (end - p >= 16) {
+		v = _mm_loadu_si128((const __m128i *)p);
+		m = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, cr),
+					_mm_cmpeq_epi8(v, lf)), _mm_cmpeq_epi8(v, nul));
+		mask = _mm_movemask_epi8(m);
+		if (mask) return p + __builtin_ctz(mask);
+		p += 16;
+	}
+
+	return find_eol_c(p, end);
+}
+
+__attribute__((target("avx2")))
+static const char *find_eol_avx2(const char *p, const char *end)
+{
+	const __m256i cr = _mm256_set1_epi8('\r');
+	const __m256i lf = _mm256_set1_epi8('\n');
+	const __m256i nul = _mm256_setzero_si256();
+	__m256i v, m;
+	unsigned mask;
+
+	while (end - p >= 32) {
+		v = _mm256_loadu_si256((const __m256i *)p);
+		m = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(v, cr),
+					_mm256_cmpeq_epi8(v, lf)), _mm256_cmpeq_epi8(v, nul));
+		mask = _mm256_movemask_epi8(m);
+		if (mask) return p + __builtin_ctz(mask);
+		p += 32;
+	}
+
+	return find_eol_sse2(p, end);
+}
+
+/*
+ * Unsigned range checks: x - lo is at most n exactly when min(x - lo, n)
+ * equals it. Letters are folded to lower case first.
+ */
+__attribute__((target("sse2")))
+static const char *find_nonhex_sse2(const char *p, const char *end)
+{
+	const __m128i zero = _mm_set1_epi8('0'), nine = _mm_set1_epi8(9);
+	const __m128i a = _mm_set1_epi8('a'), five = _mm_set1_epi8(5);
+	const __m128i fold = _mm_set1_epi8(0x20);
+	__m128i v, d, l;
+	int mask;
+
+	while (end - p >= 16) {
+		v = _mm_loadu_si128((const __m128i *)p);
+		d = _mm_sub_epi8(v, zero);
+		l = _mm_sub_epi8(_mm_or_si128(v, fold), a);
+		d = _mm_cmpeq_epi8(_mm_min_epu8(d, nine), d);
+		l = _mm_cmpeq_epi8(_mm_min_epu8(l, five), l);
+		mask = ~_mm_movemask_epi8(_mm_or_si128(d, l)) & 0xffff;
+		if (mask) return p + __builtin_ctz(mask);
+		p += 16;
+	}
+
+	return find_nonhex_c(p, end);
+}
+
+__attribute__((target("avx2")))
+static const char *find_nonhex_avx2(const char *p, const char *end)
+{
+	const __m256i zero = _mm256_set1_epi8('0'), nine = _mm256_set1_epi8(9);
+	const __m256i a = _mm256_set1_epi8('a'), five = _mm256_set1_epi8(5);
+	const __m256i fold = _mm256_set1_epi8(0x20);
+	__m256i v, d, l;
+	unsigned mask;
+
+	while (end - p >= 32) {
+		v = _mm256_loadu_si256((const __m256i *)p);
+		d = _mm256_sub_epi8(v, zero);
+		l = _mm256_sub_epi8(_mm256_or_si256(v, fold), a);
+		d = _mm256_cmpeq_epi8(_mm256_min_epu8(d, nine), d);
+		l = _mm256_cmpeq_epi8(_mm256_min_epu8(l, five), l);
+		mask = ~(unsigned)_mm256_movemask_epi8(_mm256_or_si256(d, l));
+		if (mask) return p + __builtin_ctz(mask);
+		p += 32;
+	}
+
+	return find_nonhex_sse2(p, end);
+}
+
+#endif /* SPLIT_X86 */
+
+void split_init(void)
+{
+	int i;
+
+#ifdef SPLIT_X86
+	__builtin_cpu_init();
+#endif
+
+	for (i = 0; i < NIMPLS; i++) {
+		if (impls[i].supported()) {
+			split_find_eol = impls[i].fn;
+			split_find_nonhex = impls[i].nonhex;
+			impl_name = impls[i].name;
+			return;
+		}
+	}
+}
+
+int split_select(const char *name)
+{
+	int i;
+
+#ifdef SPLIT_X86
+	__builtin_cpu_init();
+#endif
+
+	for (i = 0; i < NIMPLS; i++) {
+		if (!strcmp(impls[i].name, name) && impls[i].supported()) {
+			split_find_eol = impls[i].fn;
+			split_find_nonhex = impls[i].nonhex;
+			impl_name = impls[i].name;
+			return 0;
+		}
+	}
+
+	return -1;
+}
+
+const char *split_impl_name(void)
+{
+	return impl_name;
+}
+
+/*
+ * Add n bytes to the line being assembled, handing out TTY_RD_SZ pieces;
+ * returns the bytes taken, fewer than n if cb asked to stop (*stop set).
+ */
+static int split_append(struct splitter *sp, const char *p, int n, int *stop)
+{
+	int room, done = 0;
+
+	*stop = 0;
+	while (done < n) {
+		if (sp->len == TTY_RD_SZ) {
+			sp->line[sp->len] = '\0';
+			sp->len = 0;
+			if (sp->cb(sp, sp->line, TTY_RD_SZ)) {
+				*stop = 1;
+				break;
+			}
+		}
+		room = TTY_RD_SZ - sp->len;
+		if (room > n - done) room = n - done;
+		memcpy(sp->line + sp->len, p + done, room);
+		sp->len += room;
+		done += room;
+	}
+
+	return done;
+}
+
+int split_feed(struct splitter *sp, char *buff, int n)
+{
+	char *p, *end, *eol;
+	int len, k, stop;
+
+	p = buff;
+	end = buff + n;
+
+	while (p < end) {
+		if (sp->raw) {
+			p += sp->raw(sp, p, end - p);
+			if (sp->raw) break;
+			continue;
+		}
+
+		eol = (char *)split_find_eol(p, end);
+		if (eol == end) {
+			/* the rest of the line comes with the next read */
+			p += split_append(sp, p, end - p, &stop);
+			return p - buff;
+		}
+
+		len = eol - p;
+		if (sp->len || len > TTY_RD_SZ) {
+			/* the rest is kept by the caller if a piece stopped us */
+			k = split_append(sp, p, len, &stop);
+			if (stop) return p + k - buff;
+			if (sp->len) {
+				len = sp->len;
+				sp->line[len] = '\0';
+				sp->len = 0;
+				stop |= sp->cb(sp, sp->line, len);
+			}
+		} else if (len) {
+			*eol = '\0';
+			stop = sp->cb(sp, p, len);
+		} else {
+			stop = 0;
+		}
+
+		p = eol + 1;
+		if (stop) break;
+	}
+
+	return p - buff;
+}
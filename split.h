@@ -0,0 +1,52 @@
+#ifndef __SPLIT_H
+#define __SPLIT_H
+
+#include "main.h"
+
+/*
+ * End-of-line search for the tty line splitter: returns the first CR, LF or
+ * NUL in [p, end), or end. The implementation (AVX2, SSE2 or plain C) is
+ * picked by split_init() according to what the CPU supports.
+ */
+
+typedef const char *(*split_eol_fn)(const char *p, const char *end);
+
+extern split_eol_fn split_find_eol;
+
+/*
+ * The first byte in [p, end) that is not a hex digit, or end. Used for the
+ * PDU following the prompt of AT+CMGS; picked along with split_find_eol.
+ */
+extern split_eol_fn split_find_nonhex;
+
+void split_init(void);
+
+/* force an implementation by name, returns -1 if the CPU lacks it */
+int split_select(const char *name);
+
+/* name of the implementation in use */
+const char *split_impl_name(void);
+
+/*
+ * Line splitter. Lines wholly inside a buffer are handed out in place, with
+ * the delimiter overwritten by a NUL; only a line cut by the end of a read
+ * is copied aside until the rest of it arrives. Lines longer than
+ * TTY_RD_SZ are handed out in TTY_RD_SZ pieces, empty lines are skipped.
+ */
+struct splitter {
+	char line[TTY_RD_SZ+1];
+	int len;
+	/* called for every line, returns non-zero to stop splitting */
+	int (*cb)(struct splitter *sp, char *line, int len);
+	/*
+	 * While set, input goes to raw as it arrives instead of being split
+	 * into lines. Returns the bytes it used; clearing raw switches back to
+	 * lines, the rest of the input included.
+	 */
+	int (*raw)(struct splitter *sp, char *p, int n);
+};
+
+/* returns the number of bytes consumed, less than n if cb or raw asked to stop */
+int split_feed(struct splitter *sp, char *buff, int n);
+
+#endif /* __SPLIT_H */
@@ -0,0 +1,402 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "atdisp.h"
+#include "ev.h"
+#include "main.h"
+#include "session.h"
+#include "stats.h"
+
+#define STATS_REQ_SZ 64
+
+struct stats_conn {
+	struct ev_io io;
+	char req[STATS_REQ_SZ];
+	int len;
+	/* the reply, sent as the socket takes it */
+	char *out;
+	size_t out_len;
+	size_t out_pos;
+};
+
+__thread struct stats *stats_self;
+
+/* pushed to by every thread, never popped */
+static struct stats *stats_list;
+
+static struct {
+	struct ev_loop *loop;
+	struct ev_io io;
+	char *path;
+	uint64_t start;
+} server = {
+	.io = { .fd = -1 },
+};
+
+static int stats_bucket(uint64_t us);
+static uint64_t stats_bucket_value(int idx);
+static uint64_t stats_percentile(const struct stats_cmd *c, double pct);
+static void stats_record(struct stats_mark *m, uint64_t now);
+static struct stats *stats_sum(void);
+static void stats_dump(FILE *f);
+static void stats_accept_cb(struct ev_io *io);
+static void stats_conn_cb(struct ev_io *io);
+static void stats_conn_close(struct stats_conn *c);
+static int stats_conn_reply(struct stats_conn *c);
+static void stats_conn_write(struct stats_conn *c);
+
+int stats_thread_init(void)
+{
+	struct stats *st;
+
+	if (stats_self) return 0;
+
+	st = calloc(1, sizeof(*st) + (at_ncmds + 1) * sizeof(st->cmd[0]));
+	if (st == NULL) return -1;
+	st->ncmds = at_ncmds + 1;
+
+	st->next = __atomic_load_n(&stats_list, __ATOMIC_RELAXED);
+	while (!__atomic_compare_exchange_n(&stats_list, &st->next, st, 0,
+				__ATOMIC_RELEASE, __ATOMIC_RELAXED))
+		;
+	stats_self = st;
+
+	return 0;
+}
+
+static int stats_bucket(uint64_t us)
+{
+	int e;
+
+	if (us < STATS_SUB_BUCKETS) return us;
+
+	e = 63 - __builtin_clzll(us);
+	if (e > 31) return STATS_BUCKETS - 1;
+
+	return (e - STATS_SUB_BITS + 1) * STATS_SUB_BUCKETS +
+		((us >> (e - STATS_SUB_BITS)) & (STATS_SUB_BUCKETS - 1));
+}
+
+/* highest value counted in bucket idx */
+static uint64_t stats_bucket_value(int idx)
+{
+	int e, sub;
+
+	if (idx < STATS_SUB_BUCKETS) return idx;
+
+	e = idx / STATS_SUB_BUCKETS + STATS_SUB_BITS - 1;
+	sub = idx % STATS_SUB_BUCKETS;
+
+	return ((uint64_t)(STATS_SUB_BUCKETS + sub + 1) << (e - STATS_SUB_BITS)) - 1;
+}
+
+static uint64_t stats_percentile(const struct stats_cmd *c, double pct)
+{
+	uint64_t rank, n;
+	int i;
+
+	if (!c->count) return 0;
+
+	rank = c->count * pct / 100.0;
+	if (rank >= c->count) rank = c->count - 1;
+
+	for (n = 0, i = 0; i < STATS_BUCKETS; i++) {
+		n += c->hist[i];
+		if (n > rank) break;
+	}
+	if (i == STATS_BUCKETS) i--;
+
+	return stats_bucket_value(i) < c->max_us ? stats_bucket_value(i) : c->max_us;
+}
+
+void stats_line(struct session *s)
+{
+	stats_add(stats_self->lines, 1);
+	s->lat.start = ev_now();
+	s->lat.cmd = -1;
+}
+
+void stats_reply(struct session *s)
+{
+	struct stats_marks *l = &s->lat;
+	struct stats_mark *m;
+
+	if (l->wr - l->rd == STATS_MARKS) {
+		stats_add(stats_self->untimed, 1);
+		return;
+	}
+
+	m = &l->mark[l->wr % STATS_MARKS];
+	m->start = l->start;
+	m->end = s->q.sent + outq_len(&s->q);
+	m->cmd = l->cmd;
+	l->wr++;
+
+	if (!outq_len(&s->q)) stats_written(s);
+}
+
+static void stats_record(struct stats_mark *m, uint64_t now)
+{
+	struct stats_cmd *c;
+	uint64_t us;
+	int b;
+
+	us = (now - m->start) / 1000;
+	c = &stats_self->cmd[(m->cmd >= 0) ? m->cmd : at_ncmds];
+	b = stats_bucket(us);
+
+	stats_add(c->hist[b], 1);
+	stats_add(c->sum_us, us);
+	if (us > c->max_us) __atomic_store_n(&c->max_us, us, __ATOMIC_RELAXED);
+	stats_add(c->count, 1);
+}
+
+void stats_written(struct session *s)
+{
+	struct stats_marks *l = &s->lat;
+	uint64_t now;
+
+	if (l->rd == l->wr || l->mark[l->rd % STATS_MARKS].end > s->q.sent)
+		return;
+
+	now = ev_now();
+	while (l->rd != l->wr && l->mark[l->rd % STATS_MARKS].end <= s->q.sent) {
+		stats_record(&l->mark[l->rd % STATS_MARKS], now);
+		l->rd++;
+	}
+}
+
+/* a snapshot of the counters of all threads added up */
+static struct stats *stats_sum(void)
+{
+	struct stats *sum, *st;
+	int i, b;
+
+	sum = calloc(1, sizeof(*sum) + (at_ncmds + 1) * sizeof(sum->cmd[0]));
+	if (sum == NULL) return NULL;
+	sum->ncmds = at_ncmds + 1;
+
+	for (st = __atomic_load_n(&stats_list, __ATOMIC_ACQUIRE); st; st = st->next) {
+		sum->lines += __atomic_load_n(&st->lines, __ATOMIC_RELAXED);
+		sum->bytes_in += __atomic_load_n(&st->bytes_in, __ATOMIC_RELAXED);
+		sum->bytes_out += __atomic_load_n(&st->bytes_out, __ATOMIC_RELAXED);
+		sum->drops += __atomic_load_n(&st->drops, __ATOMIC_RELAXED);
+		sum->untimed += __atomic_load_n(&st->untimed, __ATOMIC_RELAXED);
+		sum->urcs += __atomic_load_n(&st->urcs, __ATOMIC_RELAXED);
+		sum->urc_lost += __atomic_load_n(&st->urc_lost, __ATOMIC_RELAXED);
+		sum->syscalls += __atomic_load_n(&st->syscalls, __ATOMIC_RELAXED);
+		sum->queued += __atomic_load_n(&st->queued, __ATOMIC_RELAXED);
+
+		for (i = 0; i < sum->ncmds; i++) {
+			struct stats_cmd *d = &sum->cmd[i];
+			const struct stats_cmd *c = &st->cmd[i];
+			uint64_t max;
+
+			/* counted last by the writer, read first: never more than the buckets hold */
+			d->count += __atomic_load_n(&c->count, __ATOMIC_RELAXED);
+			d->sum_us += __atomic_load_n(&c->sum_us, __ATOMIC_RELAXED);
+			max = __atomic_load_n(&c->max_us, __ATOMIC_RELAXED);
+			if (max > d->max_us) d->max_us = max;
+			for (b = 0; b < STATS_BUCKETS; b++)
+				d->hist[b] += __atomic_load_n(&c->hist[b], __ATOMIC_RELAXED);
+		}
+	}
+
+	return sum;
+}
+
+static void stats_dump(FILE *f)
+{
+	struct stats *sum;
+	const struct stats_cmd *c;
+	int i;
+
+	sum = stats_sum();
+	if (sum == NULL) {
+		fprintf(f, "ERROR out of memory\n");
+		return;
+	}
+
+	fprintf(f, "uptime_s %.3f\n", (ev_now() - server.start) / 1e9);
+	fprintf(f, "lines %llu\n", (unsigned long long)sum->lines);
+	fprintf(f, "bytes_in %llu\n", (unsigned long long)sum->bytes_in);
+	fprintf(f, "bytes_out %llu\n", (unsigned long long)sum->bytes_out);
+	fprintf(f, "queued %lld\n", (long long)sum->queued);
+	fprintf(f, "drops %llu\n", (unsigned long long)sum->drops);
+	fprintf(f, "untimed %llu\n", (unsigned long long)sum->untimed);
+	fprintf(f, "urcs %llu\n", (unsigned long long)sum->urcs);
+	fprintf(f, "urc_lost %llu\n", (unsigned long long)sum->urc_lost);
+	fprintf(f, "syscalls %llu\n", (unsigned long long)sum->syscalls);
+
+	fprintf(f, "# command count mean_us p50_us p99_us p999_us max_us\n");
+	for (i = 0; i < sum->ncmds; i++) {
+		c = &sum->cmd[i];
+		if (!c->count) continue;
+		fprintf(f, "cmd %s %llu %llu %llu %llu %llu %llu\n",
+				(i < at_ncmds) ? at_name(i) : "(other)",
+				(unsigned long long)c->count,
+				(unsigned long long)(c->sum_us / c->count),
+				(unsigned long long)stats_percentile(c, 50),
+				(unsigned long long)stats_percentile(c, 99),
+				(unsigned long long)stats_percentile(c, 99.9),
+				(unsigned long long)c->max_us);
+	}
+
+	free(sum);
+}
+
+int stats_server_open(struct ev_loop *loop, const char *path)
+{
+	struct sockaddr_un sa;
+	int fd;
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sun_family = AF_UNIX;
+	if (strlen(path) >= sizeof(sa.sun_path)) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+	strcpy(sa.sun_path, path);
+
+	fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (fd < 0) return -1;
+
+	unlink(path);
+	if (bind(fd, (struct sockaddr *)&sa, sizeof(sa)) < 0 || listen(fd, 16) < 0 ||
+			ev_io_add(loop, &server.io, fd, stats_accept_cb) < 0) {
+		close(fd);
+		server.io.fd = -1;
+		return -1;
+	}
+
+	server.loop = loop;
+	server.path = strdup(path);
+	server.start = ev_now();
+
+	return 0;
+}
+
+void stats_server_close(void)
+{
+	if (server.io.fd < 0) return;
+
+	ev_io_del(server.loop, &server.io);
+	close(server.io.fd);
+	server.io.fd = -1;
+	if (server.path) unlink(server.path);
+	free(server.path);
+	server.path = NULL;
+}
+
+static void stats_accept_cb(struct ev_io *io)
+{
+	struct stats_conn *c;
+	int fd;
+
+	if (!(io->state & EV_READABLE)) return;
+
+	fd = accept4(io->fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+	if (fd < 0) {
+		if (errno == EAGAIN || errno == EWOULDBLOCK) io->state &= ~EV_READABLE;
+		return;
+	}
+
+	c = calloc(1, sizeof(*c));
+	if (c == NULL || ev_io_add(server.loop, &c->io, fd, stats_conn_cb) < 0) {
+		free(c);
+		close(fd);
+	}
+
+	/* there may be more connections waiting */
+	ev_io_kick(server.loop, io);
+}
+
+static void stats_conn_cb(struct ev_io *io)
+{
+	struct stats_conn *c = container_of(io, struct stats_conn, io);
+	char *eol;
+	int n;
+
+	if (c->out) {
+		if (io->state & EV_WRITABLE) stats_conn_write(c);
+		return;
+	}
+
+	if (!(io->state & EV_READABLE)) return;
+
+	/* a request is one line; EOF or a full buffer end it as well */
+	do {
+		n = read(io->fd, c->req + c->len, sizeof(c->req) - 1 - c->len);
+		if (n < 0) {
+			if (errno == EINTR) continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK) {
+				io->state &= ~EV_READABLE;
+				return;
+			}
+			stats_conn_close(c);
+			return;
+		}
+		c->len += n;
+		c->req[c->len] = '\0';
+		eol = strpbrk(c->req, "\r\n");
+	} while (!eol && n && c->len < (int)sizeof(c->req) - 1);
+
+	if (eol) *eol = '\0';
+
+	if (stats_conn_reply(c) < 0) {
+		stats_conn_close(c);
+		return;
+	}
+	stats_conn_write(c);
+}
+
+static void stats_conn_close(struct stats_conn *c)
+{
+	ev_io_del(server.loop, &c->io);
+	close(c->io.fd);
+	free(c->out);
+	free(c);
+}
+
+static int stats_conn_reply(struct stats_conn *c)
+{
+	FILE *f;
+
+	f = open_memstream(&c->out, &c->out_len);
+	if (f == NULL) return -1;
+
+	if (!c->req[0] || !strcmp(c->req, "stats"))
+		stats_dump(f);
+	else
+		fprintf(f, "ERROR unknown request, try: stats\n");
+	fclose(f);
+
+	return 0;
+}
+
+/* send what the socket takes, the rest when it is writable again; close when done */
+static void stats_conn_write(struct stats_conn *c)
+{
+	ssize_t n;
+
+	while (c->out_pos < c->out_len) {
+		n = write(c->io.fd, c->out + c->out_pos, c->out_len - c->out_pos);
+		if (n < 0) {
+			if (errno == EINTR) continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK) {
+				c->io.state &= ~EV_WRITABLE;
+				return;
+			}
+			break;
+		}
+		c->out_pos += n;
+	}
+
+	stats_conn_close(c);
+}
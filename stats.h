@@ -0,0 +1,90 @@
+#ifndef __STATS_H
+#define __STATS_H
+
+/*
+ * Runtime statistics, served as text over the Unix socket given with -s.
+ *
+ * Every thread that serves sessions owns a struct stats and is the only one
+ * writing to it; the socket handler sums the blocks of all threads. Updates
+ * are plain relaxed stores, so counting costs no more than an add and no
+ * lock or atomic read-modify-write is ever taken on the AT path.
+ *
+ * Command latency is measured from the moment a line was split off the
+ * input to the moment the last byte of its response was written to the
+ * tty, and kept in log-linear histograms: STATS_SUB_BUCKETS buckets per
+ * power of two microseconds, i.e. a relative error of at most 1/16.
+ */
+
+#include <stdint.h>
+
+struct session;
+struct ev_loop;
+
+#define STATS_SUB_BITS		4
+#define STATS_SUB_BUCKETS	(1 << STATS_SUB_BITS)
+/* up to 2^31 us, longer responses are counted in the last bucket */
+#define STATS_BUCKETS		((31 - STATS_SUB_BITS + 1) * STATS_SUB_BUCKETS)
+
+/* responses queued but not completely written yet, per session */
+#define STATS_MARKS		32
+
+struct stats_cmd {
+	uint64_t count;
+	uint64_t sum_us;
+	uint64_t max_us;
+	uint32_t hist[STATS_BUCKETS];
+};
+
+struct stats {
+	struct stats *next;	/* all threads' blocks */
+
+	uint64_t lines;
+	uint64_t bytes_in;
+	uint64_t bytes_out;
+	uint64_t drops;		/* bytes the old fixed queue would have dropped */
+	uint64_t untimed;	/* responses that found no free mark */
+	uint64_t urcs;		/* unsolicited result codes sent */
+	uint64_t urc_lost;	/* and lost while the session could not take them */
+	uint64_t syscalls;	/* made by the thread's event loop and its ports */
+	int64_t queued;		/* bytes in the output queues right now */
+
+	int ncmds;
+	struct stats_cmd cmd[];	/* at_ncmds + 1, the last one for other lines */
+};
+
+struct stats_mark {
+	uint64_t start;		/* ev_now() when the line was received */
+	uint64_t end;		/* outq.sent once the response is written */
+	int cmd;
+};
+
+/* latency bookkeeping of a session */
+struct stats_marks {
+	struct stats_mark mark[STATS_MARKS];
+	unsigned rd;
+	unsigned wr;
+	uint64_t start;		/* line being processed */
+	int cmd;
+};
+
+/* relaxed store, only the owning thread ever writes a counter */
+#define stats_add(var, n) \
+	__atomic_store_n(&(var), (var) + (n), __ATOMIC_RELAXED)
+
+/* the calling thread's block, NULL until stats_thread_init() */
+extern __thread struct stats *stats_self;
+
+int stats_thread_init(void);
+
+/* a line was received, cmd is filled in by the AT layer */
+void stats_line(struct session *s);
+/* the response to the current line is complete and queued */
+void stats_reply(struct session *s);
+/* output was written, finish the latency of fully written responses */
+void stats_written(struct session *s);
+
+/* serve statistics on a Unix socket at path */
+int stats_server_open(struct ev_loop *loop, const char *path);
+void stats_server_close(void);
+
+#endif /* __STATS_H */
@@ -65,12 +65,17 @@
 
 /***************************************************************************/
 
+/* initial size of the table, doubled as higher filedes are added */
+#define TERM_TABLE_MIN 16
+
+/* indexed by filedes; fd[i] is i if filedes i is managed, -1 otherwise */
 static struct term_s {
 	int init;
-	int fd[MAX_TERMS];
-	struct termios origtermios[MAX_TERMS];
-	struct termios currtermios[MAX_TERMS];
-	struct termios nexttermios[MAX_TERMS];
+	int size;
+	int *fd;
+	struct termios *origtermios;
+	struct termios *currtermios;
+	struct termios *nexttermios;
 } term;
 
 /***************************************************************************/
@@ -100,7 +105,8 @@ static const char * const term_err_str[] = {
     [TERM_EDTRUP]     = "Cannot raise DTR",
 	[TERM_EMCTL]      = "Cannot get mctl status",
 	[TERM_EDRAIN]     = "Cannot drain the device",
-	[TERM_EBREAK]     = "Cannot send break sequence"
+	[TERM_EBREAK]     = "Cannot send break sequence",
+	[TERM_ENOMEM]     = "Out of memory"
 };
 
 static char term_err_buff[1024];
@@ -303,29 +309,44 @@ term_baud_ok(int baud)
 /**************************************************************************/
 
 static int
-term_find_next_free (void)
+term_grow (int fd)
 {
-	int rval, i;
-
-	do { /* dummy */
-		if ( ! term.init ) {
-			term_errno = TERM_ENOINIT;
-			rval = -1;
-			break;
-		}
-
-		for (i = 0; i < MAX_TERMS; i++)
-			if ( term.fd[i] == -1 ) break;
+	int rval, size, i;
+	void *p;
 
-		if ( i == MAX_TERMS ) {
-			term_errno = TERM_EFULL;
-			rval = -1;
-			break;
-		}
+	rval = 0;
 
-		rval = i;
+	do { /* dummy */
+		if ( fd < term.size )
+			break;
+
+		size = term.size ? term.size : TERM_TABLE_MIN;
+		while ( size <= fd )
+			size *= 2;
+
+		/* each array is taken as soon as it is moved, the size only
+		   once all of them are */
+		p = realloc(term.fd, size * sizeof(*term.fd));
+		if ( ! p ) { rval = -1; break; }
+		term.fd = p;
+		p = realloc(term.origtermios, size * sizeof(*term.origtermios));
+		if ( ! p ) { rval = -1; break; }
+		term.origtermios = p;
+		p = realloc(term.currtermios, size * sizeof(*term.currtermios));
+		if ( ! p ) { rval = -1; break; }
+		term.currtermios = p;
+		p = realloc(term.nexttermios, size * sizeof(*term.nexttermios));
+		if ( ! p ) { rval = -1; break; }
+		term.nexttermios = p;
+
+		for (i = term.size; i < size; i++)
+			term.fd[i] = -1;
+		term.size = size;
 	} while (0);
 
+	if ( rval < 0 )
+		term_errno = TERM_ENOMEM;
+
 	return rval;
 }
 
@@ -334,7 +355,7 @@ term_find_next_free (void)
 static int
 term_find (int fd)
 {
-	int rval, i;
+	int rval;
 
 	do { /* dummy */
 		if ( ! term.init ) {
@@ -343,16 +364,13 @@ term_find (int fd)
 			break;
 		}
 
-		for (i = 0; i < MAX_TERMS; i++)
-			if (term.fd[i] == fd) break;
-
-		if ( i == MAX_TERMS ) {
+		if ( fd < 0 || fd >= term.size || term.fd[fd] != fd ) {
 			term_errno = TERM_ENOTFOUND;
 			rval = -1;
 			break;
 		}
 
-		rval = i;
+		rval = fd;
 	} while (0);
 
 	return rval;
@@ -369,7 +387,7 @@ term_exitfunc (void)
 		if ( ! term.init )
 			break;
 
-		for (i = 0; i < MAX_TERMS; i++) {
+		for (i = 0; i < term.size; i++) {
 			if (term.fd[i] == -1)
 				continue;
 			tcflush(term.fd[i], TCIOFLUSH);
@@ -386,6 +404,15 @@ term_exitfunc (void)
 			}
 			term.fd[i] = -1;
 		}
+
+		free(term.fd);
+		free(term.origtermios);
+		free(term.currtermios);
+		free(term.nexttermios);
+		term.fd = NULL;
+		term.origtermios = term.currtermios = term.nexttermios = NULL;
+		term.size = 0;
+		term.init = 0;
 	} while (0);
 }
 
@@ -401,7 +428,7 @@ term_lib_init (void)
 	do { /* dummy */
 		if ( term.init ) {
 			/* reset all terms back to their original settings */
-			for (i = 0; i < MAX_TERMS; i++) {
+			for (i = 0; i < term.size; i++) {
 				if (term.fd[i] == -1)
 					continue;
 				tcflush(term.fd[i], TCIOFLUSH);
@@ -419,9 +446,8 @@ term_lib_init (void)
 				term.fd[i] = -1;
 			}
 		} else {
-			/* initialize term structure. */
-			for (i = 0; i < MAX_TERMS; i++)
-				term.fd[i] = -1;
+			/* initialize term structure, the table grows on term_add() */
+			term.size = 0;
 			if ( atexit(term_exitfunc) != 0 ) {
 				term_errno = TERM_EATEXIT;
 				rval = -1; 
@@ -458,11 +484,17 @@ term_add (int fd)
 			break;
 		}
 
-		i = term_find_next_free();
-		if ( i < 0 ) {
+		if ( ! term.init ) {
+			term_errno = TERM_ENOINIT;
+			rval = -1;
+			break;
+		}
+
+		if ( term_grow(fd) < 0 ) {
 			rval = -1;
 			break;
 		}
+		i = fd;
 
 		r = tcgetattr(fd, &term.origtermios[i]);
 		if ( r < 0 ) {
@@ -555,6 +587,17 @@ term_replace (int oldfd, int newfd)
 			break;
 		}
 
+		if ( newfd != oldfd && term_find(newfd) >= 0 ) {
+			term_errno = TERM_EEXISTS;
+			rval = -1;
+			break;
+		}
+
+		if ( term_grow(newfd) < 0 ) {
+			rval = -1;
+			break;
+		}
+
 		r = tcsetattr(newfd, TCSANOW, &term.currtermios[i]);
 		if ( r < 0 ) {
 			term_errno = TERM_ESETATTR;
@@ -568,7 +611,14 @@ term_replace (int oldfd, int newfd)
 			break;
 		}
 
-		term.fd[i] = newfd;
+		/* the settings move to the slot of the new filedes */
+		if ( newfd != oldfd ) {
+			term.origtermios[newfd] = term.origtermios[i];
+			term.currtermios[newfd] = term.currtermios[i];
+			term.nexttermios[newfd] = term.nexttermios[i];
+			term.fd[i] = -1;
+		}
+		term.fd[newfd] = newfd;
 
 	} while (0);
 
@@ -1207,11 +1257,11 @@ term_set(int fd,
 
 		i = term_find(fd);
 		if ( i < 0 ) {
-			ni = term_add(fd);
-			if ( ni < 0 ) {
+			if ( term_add(fd) < 0 ) {
 				rval = -1;
 				break;
 			}
+			ni = fd;
 		} else {
 			ni = i;
 		}
@@ -33,6 +33,12 @@
  * from it and updating currtermios (to catch up with changes made to
  * the device by means outside of this framework).
  *
+ * The structures of a filedes are kept in a table indexed by the
+ * filedes itself, so finding them costs the same however many
+ * terminals are managed. The table grows as filedes are added, to
+ * the highest filedes in it, and is freed at program termination.
+ * Neither is safe against concurrent calls from other threads.
+ *
  * Interface summary:
  *
  * F term_lib_init  - library initialization
@@ -73,7 +79,6 @@
  * E term_errno_e - error condition codes
  * E parity_t - library supported parity types
  * E flocntrl_t - library supported folw-control modes
- * M MAX_TERM - maximum number of fds that can be managed
  *
  * by Nick Patavalis (npat@inaccessnetworks.com)
  *
@@ -101,14 +106,6 @@
 #ifndef TERM_H
 #define TERM_H
 
-/* M MAX_TERMS
- *
- * Maximum nuber of terminals that can be managed by the library. Keep
- * relatively low, since linear searches are used. Reasonable values
- * would be: 16, 32, 64, etc.
- */
-#define MAX_TERMS 16
-
 /*
  * E term_errno_e
  *
@@ -142,7 +139,8 @@ enum term_errno_e {
 	TERM_EDTRUP,
 	TERM_EMCTL,
 	TERM_EDRAIN,     /* see errno */
-	TERM_EBREAK
+	TERM_EBREAK,
+	TERM_ENOMEM
 };
 
 /* E parity_e
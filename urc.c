@@ -0,0 +1,187 @@
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "main.h"
+#include "session.h"
+#include "stats.h"
+#include "urc.h"
+
+struct urc_stream {
+	const char *line;	/* terminated */
+	unsigned len;
+	enum urc_pattern pattern;
+	unsigned burst;		/* URCs per deadline */
+	uint64_t gap_ns;	/* mean time between deadlines */
+};
+
+static const struct {
+	const char *name;
+	const char *line;
+	unsigned len;
+} urc_types[] = {
+	{ "ring", TTY_STR("RING") },
+	{ "cmti", TTY_STR("+CMTI: \"ME\",0") },
+	{ "creg", TTY_STR("+CREG: 1") },
+	{ "cereg", TTY_STR("+CEREG: 1") },
+	{ "qind", TTY_STR("+QIND: \"csq\",31,99") },
+};
+
+static const char * const urc_patterns[] = {
+	[URC_PERIODIC] = "periodic",
+	[URC_POISSON] = "poisson",
+	[URC_BURST] = "burst",
+};
+
+/* set up before any session is, read-only afterwards */
+static struct urc_stream urc_streams[URC_MAX];
+static int urc_nstreams;
+
+static uint64_t urc_gap(struct session *s, const struct urc_stream *u);
+static void urc_timer_cb(struct ev_timer *t);
+static void urc_arm(struct session *s, uint64_t now);
+
+int urc_add(const char *spec)
+{
+	struct urc_stream *u;
+	char name[16], pattern[16] = "periodic";
+	double rate;
+	unsigned burst = 1;
+	int i, n;
+
+	if (urc_nstreams == URC_MAX) return -1;
+	u = &urc_streams[urc_nstreams];
+
+	n = sscanf(spec, "%15[^,],%lf,%15[^,],%u", name, &rate, pattern, &burst);
+	if (n < 2 || !(rate > 0 && rate <= 1e6) || !burst || burst > URC_HELD)
+		return -1;
+
+	for (i = 0; i < (int)(sizeof(urc_types) / sizeof(urc_types[0])); i++)
+		if (!strcmp(urc_types[i].name, name)) break;
+	if (i == (int)(sizeof(urc_types) / sizeof(urc_types[0]))) return -1;
+	u->line = urc_types[i].line;
+	u->len = urc_types[i].len;
+
+	for (i = 0; i < (int)(sizeof(urc_patterns) / sizeof(urc_patterns[0])); i++)
+		if (!strcmp(urc_patterns[i], pattern)) break;
+	if (i == (int)(sizeof(urc_patterns) / sizeof(urc_patterns[0]))) return -1;
+	u->pattern = i;
+
+	/* a burst counts against the rate with all its URCs */
+	u->burst = (u->pattern == URC_BURST) ? burst : 1;
+	u->gap_ns = 1e9 * u->burst / rate;
+	if (!u->gap_ns) u->gap_ns = 1;
+
+	urc_nstreams++;
+
+	return 0;
+}
+
+/* time to the next deadline of u */
+static uint64_t urc_gap(struct session *s, const struct urc_stream *u)
+{
+	double r;
+
+	if (u->pattern == URC_PERIODIC) return u->gap_ns;
+
+	/* xorshift32, (0, 1] */
+	s->urc.rnd ^= s->urc.rnd << 13;
+	s->urc.rnd ^= s->urc.rnd >> 17;
+	s->urc.rnd ^= s->urc.rnd << 5;
+	r = (s->urc.rnd + 1.0) / 4294967296.0;
+
+	return -log(r) * u->gap_ns + 1;
+}
+
+void urc_session_init(struct session *s)
+{
+	uint64_t now;
+	int i;
+
+	ev_timer_init(&s->urc.timer, urc_timer_cb);
+	s->urc.nheld = 0;
+	if (!urc_nstreams) return;
+
+	now = ev_now();
+	s->urc.rnd = (uint32_t)(now ^ (now >> 32) ^ (uintptr_t)s) | 1;
+
+	/* sessions start out of phase with each other */
+	for (i = 0; i < urc_nstreams; i++) {
+		s->urc.held[i] = 0;
+		s->urc.next[i] = now + urc_gap(s, &urc_streams[i]) *
+			(s->urc.rnd % 1024) / 1024;
+	}
+
+	urc_arm(s, now);
+}
+
+void urc_session_close(struct session *s)
+{
+	ev_timer_stop(s->loop, &s->urc.timer);
+}
+
+static void urc_arm(struct session *s, uint64_t now)
+{
+	uint64_t next = s->urc.next[0];
+	int i;
+
+	for (i = 1; i < urc_nstreams; i++)
+		if (s->urc.next[i] < next) next = s->urc.next[i];
+
+	if (next < now + URC_SLICE_NS) next = now + URC_SLICE_NS;
+	ev_timer_start_at(s->loop, &s->urc.timer, next);
+}
+
+static void urc_timer_cb(struct ev_timer *t)
+{
+	struct session *s = container_of(t, struct session, urc.timer);
+	const struct urc_stream *u;
+	uint64_t now = ev_now();
+	uint64_t n, lost;
+	unsigned held;
+	int i;
+
+	for (i = 0; i < urc_nstreams; i++) {
+		u = &urc_streams[i];
+		held = s->urc.held[i];
+		lost = 0;
+		/* after a long stall, skip what would not be held anyway */
+		if (s->urc.next[i] + (uint64_t)URC_HELD * u->gap_ns < now) {
+			n = (now - s->urc.next[i]) / u->gap_ns - URC_HELD;
+			lost += n * u->burst;
+			s->urc.next[i] += n * u->gap_ns;
+		}
+		while (s->urc.next[i] <= now) {
+			if (held + u->burst <= URC_HELD) held += u->burst;
+			else lost += u->burst;
+			s->urc.next[i] += urc_gap(s, u);
+		}
+		s->urc.nheld += held - s->urc.held[i];
+		s->urc.held[i] = held;
+		if (lost) stats_add(stats_self->urc_lost, lost);
+	}
+
+	urc_flush(s);
+	urc_arm(s, now);
+}
+
+void urc_flush(struct session *s)
+{
+	const struct urc_stream *u;
+	unsigned n;
+	int i;
+
+	if (!s->urc.nheld || session_held(s) || s->waitPdu) return;
+
+	/* static lines, queued by reference */
+	for (i = 0; i < urc_nstreams; i++) {
+		u = &urc_streams[i];
+		for (n = s->urc.held[i]; n; n--)
+			tty_write_ref(s, u->line, u->len);
+		s->urc.held[i] = 0;
+	}
+	stats_add(stats_self->urcs, s->urc.nheld);
+	s->urc.nheld = 0;
+
+	s->kick(s);
+}
@@ -0,0 +1,53 @@
+#ifndef __URC_H
+#define __URC_H
+
+#include <stdint.h>
+
+#include "ev.h"
+
+/*
+ * Unsolicited result codes generated on a schedule.
+ *
+ * Streams are configured once for all sessions with urc_add(); every
+ * session plays each of them on its own from a single event loop timer
+ * armed to the earliest deadline. The timer is never armed closer than
+ * URC_SLICE_NS apart and a late one sends everything that has become due,
+ * so a session costs at most one wakeup per slice at any rate.
+ *
+ * A URC never lands inside a response: while the session has one in
+ * progress (a deferred reply, a listing, a PDU being entered) or its
+ * output queue is full, URCs are held and sent once it can take them
+ * again. At most URC_HELD of a stream are held, later ones are lost.
+ */
+
+struct session;
+
+#define URC_MAX		8	/* streams */
+#define URC_HELD	256	/* held per stream and session */
+#define URC_SLICE_NS	1000000ULL
+
+enum urc_pattern {
+	URC_PERIODIC,		/* evenly spaced */
+	URC_POISSON,		/* exponentially distributed gaps */
+	URC_BURST,		/* bursts back to back, Poisson spaced */
+};
+
+/* per session */
+struct urc_state {
+	struct ev_timer timer;
+	uint64_t next[URC_MAX];	/* deadline of each stream, ns */
+	unsigned held[URC_MAX];
+	unsigned nheld;		/* of all streams */
+	uint32_t rnd;		/* xorshift32 state */
+};
+
+/* add a stream given as <urc>,<rate>[,<pattern>[,<burst>]], -1 if invalid */
+int urc_add(const char *spec);
+
+/* start playing the streams in a new session */
+void urc_session_init(struct session *s);
+void urc_session_close(struct session *s);
+/* send held URCs if the session can take them now */
+void urc_flush(struct session *s);
+
+#endif /* __URC_H */
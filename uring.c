@@ -0,0 +1,267 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "main.h"
+#include "uring.h"
+
+/* newer than some uapi headers */
+#define URING_OP_READ_MULTISHOT	49
+
+#define URING_CQ_MULT		4
+
+static int sys_io_uring_setup(unsigned entries, struct io_uring_params *p);
+static int sys_io_uring_enter(int fd, unsigned to_submit, unsigned flags);
+static int sys_io_uring_register(int fd, unsigned op, void *arg, unsigned nr_args);
+static int uring_probe(struct uring *u, int op);
+static void uring_cancel_cb(struct uring_req *r, int res, unsigned flags);
+static void uring_io_cb(struct ev_io *io);
+
+/* completions of cancel requests are of no interest */
+static struct uring_req uring_cancel_req = { uring_cancel_cb };
+
+static int sys_io_uring_setup(unsigned entries, struct io_uring_params *p)
+{
+	return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_io_uring_enter(int fd, unsigned to_submit, unsigned flags)
+{
+	return syscall(__NR_io_uring_enter, fd, to_submit, 0, flags, NULL, 0);
+}
+
+static int sys_io_uring_register(int fd, unsigned op, void *arg, unsigned nr_args)
+{
+	return syscall(__NR_io_uring_register, fd, op, arg, nr_args);
+}
+
+/* the kernel supports op */
+static int uring_probe(struct uring *u, int op)
+{
+	struct io_uring_probe *probe;
+	size_t sz = sizeof(*probe) + 256 * sizeof(probe->ops[0]);
+	int r = 0;
+
+	probe = calloc(1, sz);
+	if (probe == NULL) return 0;
+
+	if (sys_io_uring_register(u->fd, IORING_REGISTER_PROBE, probe, 256) == 0 &&
+			op <= probe->last_op)
+		r = !!(probe->ops[op].flags & IO_URING_OP_SUPPORTED);
+	free(probe);
+
+	return r;
+}
+
+int uring_open(struct uring *u, struct ev_loop *loop, unsigned entries,
+		unsigned nbufs, unsigned buf_sz)
+{
+	struct io_uring_params p;
+	struct io_uring_buf_reg reg;
+	unsigned i;
+	int err;
+
+	memset(u, 0, sizeof(*u));
+	u->fd = -1;
+	u->loop = loop;
+
+	/* multishot reads complete many times per request */
+	memset(&p, 0, sizeof(p));
+	p.flags = IORING_SETUP_CQSIZE;
+	p.cq_entries = entries * URING_CQ_MULT;
+	u->fd = sys_io_uring_setup(entries, &p);
+	if (u->fd < 0) return -1;
+
+	u->sq_ring_sz = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	u->cq_ring_sz = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		if (u->cq_ring_sz > u->sq_ring_sz) u->sq_ring_sz = u->cq_ring_sz;
+		u->cq_ring_sz = u->sq_ring_sz;
+	}
+
+	u->sq_ring = mmap(NULL, u->sq_ring_sz, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQ_RING);
+	if (u->sq_ring == MAP_FAILED) goto fail;
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		u->cq_ring = u->sq_ring;
+	} else {
+		u->cq_ring = mmap(NULL, u->cq_ring_sz, PROT_READ | PROT_WRITE,
+				MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_CQ_RING);
+		if (u->cq_ring == MAP_FAILED) goto fail;
+	}
+	u->sqes_sz = p.sq_entries * sizeof(struct io_uring_sqe);
+	u->sqes = mmap(NULL, u->sqes_sz, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQES);
+	if (u->sqes == MAP_FAILED) goto fail;
+
+	u->sq_head = (unsigned *)((char *)u->sq_ring + p.sq_off.head);
+	u->sq_tail = (unsigned *)((char *)u->sq_ring + p.sq_off.tail);
+	u->sq_array = (unsigned *)((char *)u->sq_ring + p.sq_off.array);
+	u->sq_flags = (unsigned *)((char *)u->sq_ring + p.sq_off.flags);
+	u->sq_mask = *(unsigned *)((char *)u->sq_ring + p.sq_off.ring_mask);
+	u->sq_entries = p.sq_entries;
+	u->tail = *u->sq_tail;
+	u->cq_head = (unsigned *)((char *)u->cq_ring + p.cq_off.head);
+	u->cq_tail = (unsigned *)((char *)u->cq_ring + p.cq_off.tail);
+	u->cq_mask = *(unsigned *)((char *)u->cq_ring + p.cq_off.ring_mask);
+	u->cqes = (struct io_uring_cqe *)((char *)u->cq_ring + p.cq_off.cqes);
+
+	/* the buffer ring and the buffers, all handed to the kernel up front */
+	u->nbufs = nbufs;
+	u->buf_sz = buf_sz;
+	u->br_sz = nbufs * sizeof(struct io_uring_buf);
+	u->br = mmap(NULL, u->br_sz, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (u->br == MAP_FAILED) goto fail;
+	u->bufs = malloc((size_t)nbufs * buf_sz);
+	if (u->bufs == NULL) goto fail;
+
+	memset(&reg, 0, sizeof(reg));
+	reg.ring_addr = (uintptr_t)u->br;
+	reg.ring_entries = nbufs;
+	reg.bgid = 0;
+	if (sys_io_uring_register(u->fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0)
+		goto fail;
+	for (i = 0; i < nbufs; i++)
+		uring_buf_put(u, i << IORING_CQE_BUFFER_SHIFT);
+
+	u->multishot = uring_probe(u, URING_OP_READ_MULTISHOT);
+
+	if (ev_io_add(loop, &u->io, u->fd, uring_io_cb) < 0) goto fail;
+
+	return 0;
+
+fail:
+	err = errno;
+	uring_close(u);
+	errno = err;
+	return -1;
+}
+
+void uring_close(struct uring *u)
+{
+	if (u->fd >= 0) close(u->fd);
+	if (u->sqes && u->sqes != MAP_FAILED) munmap(u->sqes, u->sqes_sz);
+	if (u->cq_ring && u->cq_ring != MAP_FAILED && u->cq_ring != u->sq_ring)
+		munmap(u->cq_ring, u->cq_ring_sz);
+	if (u->sq_ring && u->sq_ring != MAP_FAILED) munmap(u->sq_ring, u->sq_ring_sz);
+	if (u->br && u->br != MAP_FAILED) munmap(u->br, u->br_sz);
+	free(u->bufs);
+	memset(u, 0, sizeof(*u));
+	u->fd = -1;
+}
+
+struct io_uring_sqe *uring_sqe(struct uring *u, struct uring_req *r)
+{
+	struct io_uring_sqe *sqe;
+
+	/* a full queue is submitted right away */
+	if (u->tail - __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE) == u->sq_entries) {
+		uring_submit(u);
+		if (u->tail - __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE) == u->sq_entries)
+			fatal("io_uring submission queue is stuck");
+	}
+
+	sqe = &u->sqes[u->tail & u->sq_mask];
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->user_data = (uintptr_t)r;
+	u->sq_array[u->tail & u->sq_mask] = u->tail & u->sq_mask;
+	u->tail++;
+
+	return sqe;
+}
+
+void uring_submit(struct uring *u)
+{
+	unsigned n;
+	int r = 0;
+
+	/* all the kernel has not consumed, what an earlier call left included */
+	n = u->tail - __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE);
+	if (!n) return;
+
+	__atomic_store_n(u->sq_tail, u->tail, __ATOMIC_RELEASE);
+	while (n) {
+		u->loop->syscalls++;
+		r = sys_io_uring_enter(u->fd, n, 0);
+		if (r > 0) n -= r;
+		else if (r == 0 || errno != EINTR) break;
+	}
+
+	/* busy with completions to reap first, the rest goes with the next call */
+	if (r < 0 && errno != EAGAIN && errno != EBUSY)
+		fatal("io_uring_enter failed: %s", strerror(errno));
+}
+
+void uring_read(struct uring *u, struct uring_req *r, int fd)
+{
+	struct io_uring_sqe *sqe = uring_sqe(u, r);
+
+	sqe->opcode = u->multishot ? URING_OP_READ_MULTISHOT : IORING_OP_READ;
+	sqe->fd = fd;
+	sqe->off = -1;
+	sqe->len = u->multishot ? 0 : u->buf_sz;
+	sqe->flags = IOSQE_BUFFER_SELECT;
+	sqe->buf_group = 0;
+}
+
+void uring_cancel(struct uring *u, struct uring_req *r)
+{
+	struct io_uring_sqe *sqe = uring_sqe(u, &uring_cancel_req);
+
+	sqe->opcode = IORING_OP_ASYNC_CANCEL;
+	sqe->fd = -1;
+	sqe->addr = (uintptr_t)r;
+}
+
+static void uring_cancel_cb(struct uring_req *r, int res, unsigned flags)
+{
+}
+
+void uring_buf_put(struct uring *u, unsigned flags)
+{
+	unsigned bid = flags >> IORING_CQE_BUFFER_SHIFT;
+	struct io_uring_buf *b = &u->br->bufs[u->br_tail & (u->nbufs - 1)];
+
+	b->addr = (uintptr_t)(u->bufs + (size_t)bid * u->buf_sz);
+	b->len = u->buf_sz;
+	b->bid = bid;
+	u->br_tail++;
+	__atomic_store_n(&u->br->tail, u->br_tail, __ATOMIC_RELEASE);
+}
+
+static void uring_io_cb(struct ev_io *io)
+{
+	struct uring *u = container_of(io, struct uring, io);
+	struct io_uring_cqe *cqe;
+	struct uring_req *r;
+	unsigned head, tail, flags;
+	int res;
+
+	if (!(io->state & EV_READABLE)) return;
+	io->state &= ~EV_READABLE;
+
+	/* a completion posted meanwhile makes the descriptor readable again */
+	head = *u->cq_head;
+	tail = __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE);
+	for (; head != tail; head++) {
+		cqe = &u->cqes[head & u->cq_mask];
+		r = (struct uring_req *)(uintptr_t)cqe->user_data;
+		res = cqe->res;
+		flags = cqe->flags;
+		__atomic_store_n(u->cq_head, head + 1, __ATOMIC_RELEASE);
+		r->cb(r, res, flags);
+	}
+
+	/* completions that did not fit are flushed by the kernel on request */
+	if (__atomic_load_n(u->sq_flags, __ATOMIC_ACQUIRE) & IORING_SQ_CQ_OVERFLOW) {
+		u->loop->syscalls++;
+		sys_io_uring_enter(u->fd, 0, IORING_ENTER_GETEVENTS);
+		io->state |= EV_READABLE;
+		ev_io_kick(u->loop, io);
+	}
+}
@@ -0,0 +1,87 @@
+#ifndef __URING_H
+#define __URING_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <linux/io_uring.h>
+
+#include "ev.h"
+
+/*
+ * io_uring for the tty path, selected with -i uring.
+ *
+ * Every worker owns a ring. Its descriptor sits in the worker's epoll loop
+ * like any other, so timers, signals and the statistics socket are served
+ * as before and only port I/O moves to the ring. Requests are collected
+ * while the loop runs its callbacks and submitted with one io_uring_enter()
+ * before it waits again (see uring_submit()); completions are reaped when
+ * the ring descriptor turns readable.
+ *
+ * Reads take their buffer from a ring of buffers provided to the kernel
+ * and shared by the worker's ports. They are multishot where the kernel
+ * has it, so a port that keeps receiving costs no system call per read.
+ */
+
+struct uring_req {
+	/* res and flags of the completion */
+	void (*cb)(struct uring_req *r, int res, unsigned flags);
+};
+
+struct uring {
+	int fd;
+	struct ev_io io;
+	struct ev_loop *loop;
+
+	/* submission queue */
+	unsigned *sq_head;
+	unsigned *sq_tail;
+	unsigned *sq_array;
+	unsigned *sq_flags;
+	unsigned sq_mask;
+	unsigned sq_entries;
+	unsigned tail;		/* local tail, published by uring_submit() */
+	struct io_uring_sqe *sqes;
+
+	/* completion queue */
+	unsigned *cq_head;
+	unsigned *cq_tail;
+	unsigned cq_mask;
+	struct io_uring_cqe *cqes;
+
+	void *sq_ring;
+	size_t sq_ring_sz;
+	void *cq_ring;		/* sq_ring if the kernel maps both at once */
+	size_t cq_ring_sz;
+	size_t sqes_sz;
+
+	/* provided buffers, group 0 */
+	struct io_uring_buf_ring *br;
+	size_t br_sz;
+	char *bufs;
+	unsigned nbufs;		/* power of two */
+	unsigned buf_sz;
+	uint16_t br_tail;
+
+	int multishot;		/* the kernel has multishot reads */
+};
+
+/* set up a ring of entries SQEs with nbufs read buffers of buf_sz, -1 with errno set */
+int uring_open(struct uring *u, struct ev_loop *loop, unsigned entries,
+		unsigned nbufs, unsigned buf_sz);
+void uring_close(struct uring *u);
+
+/* a cleared SQE that completes to r, queued until the next uring_submit() */
+struct io_uring_sqe *uring_sqe(struct uring *u, struct uring_req *r);
+/* hand the kernel all SQEs it has not taken yet, fatal on errors other than EAGAIN/EBUSY */
+void uring_submit(struct uring *u);
+
+/* read from fd into a provided buffer, keeps reading if multishot */
+void uring_read(struct uring *u, struct uring_req *r, int fd);
+/* cancel the request completing to r */
+void uring_cancel(struct uring *u, struct uring_req *r);
+
+/* the buffer a read completed into, and giving it back */
+#define uring_buf(u, flags) ((u)->bufs + (size_t)((flags) >> IORING_CQE_BUFFER_SHIFT) * (u)->buf_sz)
+void uring_buf_put(struct uring *u, unsigned flags);
+
+#endif /* __URING_H */